@@ -0,0 +1,131 @@
+/**
+ * alloc_stats.c
+ *
+ * Counting allocations by call site. See alloc_stats.h.
+ **/
+#include <stdlib.h>
+#include <malloc.h>
+#include "cab202_alloc.h"
+#include "alloc_stats.h"
+
+static alloc_site sites[ALLOC_MAX_SITES];
+static int num_sites;
+static alloc_totals totals;
+
+/**
+ * Finds the counts of a call site. Sites are string literals, so they are the same if their
+ * addresses are. Once the table is full, the last entry counts every other site
+ **/
+static alloc_site *alloc_find_site(const char *site) {
+	for(int i=0; i<num_sites; i++) {
+		if(sites[i].site == site) {
+			return &sites[i];
+		}
+	}
+
+	if(num_sites < ALLOC_MAX_SITES - 1) {
+		sites[num_sites].site = site;
+		return &sites[num_sites++];
+	}
+	sites[ALLOC_MAX_SITES - 1].site = "(other sites)";
+	num_sites = ALLOC_MAX_SITES;
+	return &sites[ALLOC_MAX_SITES - 1];
+}
+
+/**
+ * Counts an allocation. Bytes are counted as the usable size of the memory, so the bytes freed
+ * match the bytes allocated exactly
+ **/
+static void alloc_count(void *memory, const char *site) {
+	if(memory == NULL) {
+		return;
+	}
+
+	size_t bytes = malloc_usable_size(memory);
+	alloc_site *counts = alloc_find_site(site);
+	counts->allocations++;
+	counts->bytes_allocated += bytes;
+	totals.allocations++;
+	totals.bytes += bytes;
+	totals.frame_allocations++;
+	totals.last_site = site;
+}
+
+static void alloc_count_free(void *memory, const char *site) {
+	if(memory == NULL) {
+		return;
+	}
+
+	alloc_site *counts = alloc_find_site(site);
+	counts->frees++;
+	counts->bytes_freed += malloc_usable_size(memory);
+	totals.frees++;
+}
+
+static void *alloc_counted(size_t size, const char *site) {
+	void *memory = malloc(size);
+	alloc_count(memory, site);
+	return memory;
+}
+
+static void *alloc_counted_zeroed(size_t count, size_t size, const char *site) {
+	void *memory = calloc(count, size);
+	alloc_count(memory, site);
+	return memory;
+}
+
+/**
+ * A reallocation counts as freeing the old memory and allocating the new
+ **/
+static void *alloc_counted_resize(void *memory, size_t size, const char *site) {
+	size_t old_bytes = (memory != NULL) ? malloc_usable_size(memory) : 0;
+	void *resized = realloc(memory, size);
+	if(resized != NULL) {
+		if(memory != NULL) {
+			alloc_site *counts = alloc_find_site(site);
+			counts->frees++;
+			counts->bytes_freed += old_bytes;
+			totals.frees++;
+		}
+		alloc_count(resized, site);
+	}
+	return resized;
+}
+
+static zdk_allocator counting_hooks = {
+	alloc_counted,
+	alloc_counted_zeroed,
+	alloc_counted_resize,
+	alloc_count_free,
+};
+
+void alloc_stats_start() {
+	zdk_allocator_hooks = &counting_hooks;
+}
+
+uint64_t alloc_stats_end_frame() {
+	uint64_t allocations = totals.frame_allocations;
+	totals.frames++;
+	if(allocations > 0) {
+		totals.frames_allocating++;
+	}
+	if(allocations > totals.max_frame_allocations) {
+		totals.max_frame_allocations = allocations;
+	}
+	totals.frame_allocations = 0;
+	return allocations;
+}
+
+const alloc_totals *alloc_stats_totals() {
+	return &totals;
+}
+
+void alloc_stats_report(FILE *file) {
+	fprintf(file, "%-28s %10s %12s %10s %12s\n", "call site", "allocs", "bytes", "frees", "bytes freed");
+	for(int i=0; i<num_sites; i++) {
+		const alloc_site *counts = &sites[i];
+		fprintf(file, "%-28s %10llu %12llu %10llu %12llu\n", counts->site, (unsigned long long)counts->allocations,
+			(unsigned long long)counts->bytes_allocated, (unsigned long long)counts->frees,
+			(unsigned long long)counts->bytes_freed);
+	}
+}
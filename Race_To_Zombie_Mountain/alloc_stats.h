@@ -0,0 +1,68 @@
+/**
+ * alloc_stats.h
+ *
+ * Counts the allocations made through the ZDK's allocator hooks (see cab202_alloc.h), by call site.
+ * The ZDK and the game's own modules allocate through those hooks, so once the counting hooks are
+ * installed every allocation they make is counted, and the game can check how many happened in a
+ * frame. The highscore modules are shared with tools built without the ZDK, so they aren't counted.
+ *
+ * The counts live in a fixed table, so counting never allocates. Only the game thread may allocate
+ * through the hooks while they are installed.
+ **/
+#ifndef ALLOC_STATS_H_
+#define ALLOC_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+// The most call sites counted separately. Any more are counted together
+#define ALLOC_MAX_SITES	64
+
+/**
+ * The allocations made at one call site, and the frees made at it
+ **/
+typedef struct alloc_site {
+	const char *site;
+	uint64_t allocations;
+	uint64_t frees;
+	uint64_t bytes_allocated;
+	uint64_t bytes_freed;
+} alloc_site;
+
+/**
+ * The allocations over a game, and in the current frame
+ **/
+typedef struct alloc_totals {
+	uint64_t allocations;
+	uint64_t frees;
+	uint64_t bytes;
+	uint64_t frame_allocations;
+	// The frames that allocated, and the most allocations in one frame
+	uint64_t frames;
+	uint64_t frames_allocating;
+	uint64_t max_frame_allocations;
+	// Where the last allocation was made
+	const char *last_site;
+} alloc_totals;
+
+/**
+ * Installs the counting hooks.
+ **/
+void alloc_stats_start();
+
+/**
+ * Ends a frame, returning the number of allocations made in it.
+ **/
+uint64_t alloc_stats_end_frame();
+
+/**
+ * Gets the totals.
+ **/
+const alloc_totals *alloc_stats_totals();
+
+/**
+ * Prints the allocations and frees made at each call site.
+ **/
+void alloc_stats_report(FILE *file);
+
+#endif
@@ -0,0 +1,143 @@
+/**
+ * arena.c
+ *
+ * Bump allocator with a one step reset. See arena.h.
+ **/
+#include <stdlib.h>
+#include <string.h>
+#include "cab202_alloc.h"
+#include "arena.h"
+
+void arena_init(arena *arena, size_t block_size) {
+	memset(arena, 0, sizeof(*arena));
+	arena->block_size = block_size;
+}
+
+/**
+ * Gets a new block from the system that can hold at least the given number of bytes, and adds it
+ * to the end of the arena's blocks
+ **/
+static arena_block *arena_grow(arena *arena, size_t size) {
+	if(size < arena->block_size) {
+		size = arena->block_size;
+	}
+
+	arena_block *block = zdk_malloc(sizeof(arena_block) + size);
+	if(block == NULL) {
+		return NULL;
+	}
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+
+	if(arena->first == NULL) {
+		arena->first = block;
+	} else {
+		arena_block *last = arena->current;
+		while(last->next != NULL) {
+			last = last->next;
+		}
+		last->next = block;
+	}
+	arena->stats.blocks++;
+	arena->stats.block_bytes += size;
+	return block;
+}
+
+void *arena_alloc(arena *arena, size_t size) {
+	// Keep every allocation aligned for any type
+	size_t align = sizeof(arena_align);
+	size = (size + align - 1) / align * align;
+
+	if(arena->current == NULL) {
+		arena->current = arena->first;
+	}
+	// Move on to the next block that has room, getting a new one once they are all full
+	while((arena->current != NULL) && (arena->current->used + size > arena->current->size)) {
+		if(arena->current->next == NULL) {
+			break;
+		}
+		arena->current = arena->current->next;
+		arena->current->used = 0;
+	}
+	if((arena->current == NULL) || (arena->current->used + size > arena->current->size)) {
+		arena_block *block = arena_grow(arena, size);
+		if(block == NULL) {
+			return NULL;
+		}
+		arena->current = block;
+	}
+
+	void *memory = (unsigned char *)arena->current->data + arena->current->used;
+	arena->current->used += size;
+	memset(memory, 0, size);
+
+	arena->stats.allocations++;
+	arena->stats.bytes += size;
+	if(arena->stats.bytes > arena->stats.peak_bytes) {
+		arena->stats.peak_bytes = arena->stats.bytes;
+	}
+	return memory;
+}
+
+void arena_reset(arena *arena) {
+	arena->current = arena->first;
+	if(arena->first != NULL) {
+		arena->first->used = 0;
+	}
+	arena->stats.allocations = 0;
+	arena->stats.bytes = 0;
+	arena->stats.resets++;
+}
+
+void *arena_contents(arena *arena, size_t *used, size_t *size) {
+	if((arena->first == NULL) && (arena_grow(arena, arena->block_size) == NULL)) {
+		return NULL;
+	}
+	if((arena->current != NULL) && (arena->current != arena->first)) {
+		return NULL;
+	}
+
+	*used = (arena->current == NULL) ? 0 : arena->first->used;
+	*size = arena->first->size;
+	return arena->first->data;
+}
+
+bool arena_fit(arena *arena, size_t size) {
+	if((arena->first != NULL) && (arena->first->size >= size)) {
+		arena_reset(arena);
+		return true;
+	}
+
+	arena_block *block = arena->first;
+	while(block != NULL) {
+		arena_block *next = block->next;
+		arena->stats.blocks--;
+		arena->stats.block_bytes -= block->size;
+		zdk_free(block);
+		block = next;
+	}
+	arena->first = NULL;
+	arena->current = NULL;
+	arena_reset(arena);
+	return arena_grow(arena, size) != NULL;
+}
+
+void arena_set_contents(arena *arena, size_t used) {
+	arena_reset(arena);
+	arena->first->used = used;
+	arena->stats.bytes = used;
+	if(used > arena->stats.peak_bytes) {
+		arena->stats.peak_bytes = used;
+	}
+}
+
+void arena_free(arena *arena) {
+	arena_block *block = arena->first;
+	while(block != NULL) {
+		arena_block *next = block->next;
+		zdk_free(block);
+		block = next;
+	}
+	arena_init(arena, arena->block_size);
+}
@@ -0,0 +1,104 @@
+/**
+ * arena.h
+ *
+ * A bump allocator for memory that all lives and dies together, such as everything a single race
+ * needs. Allocating just moves a pointer along a block, and everything allocated is released at
+ * once by resetting the arena.
+ *
+ * Resetting keeps the arena's blocks, so once an arena has grown to fit a race it never asks the
+ * system for memory again. The arena counts its allocations so this can be checked.
+ **/
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A type with the strictest alignment of any type the game uses
+ **/
+typedef union arena_align {
+	long double number;
+	long long integer;
+	void *pointer;
+} arena_align;
+
+/**
+ * A block of memory the arena hands out allocations from
+ **/
+typedef struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	// Aligned for any type
+	arena_align data[];
+} arena_block;
+
+/**
+ * What an arena has done
+ **/
+typedef struct arena_stats {
+	// The allocations and bytes handed out since the last reset
+	size_t allocations;
+	size_t bytes;
+	// The most bytes ever handed out between resets
+	size_t peak_bytes;
+	// The blocks the arena holds, the memory in them and the number of times it has reset
+	size_t blocks;
+	size_t block_bytes;
+	size_t resets;
+} arena_stats;
+
+/**
+ * The state of an arena
+ **/
+typedef struct arena {
+	arena_block *first;
+	arena_block *current;
+	size_t block_size;
+	arena_stats stats;
+} arena;
+
+/**
+ * Prepares an empty arena that will get memory from the system in blocks of at least the given
+ * size.
+ **/
+void arena_init(arena *arena, size_t block_size);
+
+/**
+ * Allocates zeroed memory, aligned for any type. Returns NULL if out of memory.
+ **/
+void *arena_alloc(arena *arena, size_t size);
+
+/**
+ * Releases everything allocated from the arena, keeping its blocks to use again.
+ **/
+void arena_reset(arena *arena);
+
+/**
+ * Gets the memory of the arena's first block, how much of it is allocated and its size, so that
+ * everything allocated from an arena can be saved and loaded in one piece. Gets a block from the
+ * system if the arena has none. Returns NULL if the arena has spread into more than one block or
+ * is out of memory.
+ **/
+void *arena_contents(arena *arena, size_t *used, size_t *size);
+
+/**
+ * Makes the arena's first block hold at least the given number of bytes, replacing its blocks with
+ * one big enough if it doesn't, so that much can be allocated and saved in one piece. Everything 
+ * allocated from the arena is released. Returns false if out of memory.
+ **/
+bool arena_fit(arena *arena, size_t size);
+
+/**
+ * Marks the given number of bytes at the start of the arena's first block as allocated, after
+ * contents saved from another arena have been loaded into it. Everything else is released.
+ **/
+void arena_set_contents(arena *arena, size_t used);
+
+/**
+ * Gives the arena's blocks back to the system.
+ **/
+void arena_free(arena *arena);
+
+#endif
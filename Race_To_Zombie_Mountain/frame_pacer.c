@@ -0,0 +1,89 @@
+/**
+ * frame_pacer.c
+ *
+ * Frames drawn no faster than the terminal takes them. See frame_pacer.h.
+ **/
+#include <math.h>
+#include <string.h>
+#include "frame_pacer.h"
+
+void frame_pacer_init(frame_pacer *pacer, double frame_rate, double now) {
+	memset(pacer, 0, sizeof(frame_pacer));
+	pacer->frame_rate = frame_rate;
+	pacer->interval = 1;
+	pacer->max_interval = 1;
+	pacer->interval_changed = now;
+	pacer->second_start = now;
+	pacer->fps = frame_rate;
+	pacer->min_fps = frame_rate;
+}
+
+/**
+ * Finds how many frames apart frames have to be drawn for the terminal to keep up, cutting the
+ * rate at once but only raising it slowly
+ **/
+static void frame_pacer_adapt(frame_pacer *pacer, double now) {
+	int needed = 1;
+	if((pacer->link.throughput > 0) && (pacer->link.frame_bytes > 0)) {
+		double frames = pacer->link.frame_bytes * pacer->frame_rate / (pacer->link.throughput * PACER_HEADROOM);
+		needed = (frames >= PACER_MAX_INTERVAL) ? PACER_MAX_INTERVAL : (int)ceil(frames);
+		if(needed < 1) {
+			needed = 1;
+		}
+	}
+
+	if(needed > pacer->interval) {
+		pacer->interval = needed;
+		pacer->interval_changed = now;
+	} else if((needed < pacer->interval) && (now - pacer->interval_changed >= PACER_RECOVER_TIME)) {
+		// A quarter closer to drawing every frame each time
+		int step = (pacer->interval / 4 > 1) ? pacer->interval / 4 : 1;
+		pacer->interval = (pacer->interval - step > needed) ? pacer->interval - step : needed;
+		pacer->interval_changed = now;
+	}
+	if(pacer->interval > pacer->max_interval) {
+		pacer->max_interval = pacer->interval;
+	}
+}
+
+bool frame_pacer_draw(frame_pacer *pacer, bool must_draw, double now) {
+	pacer->frames++;
+	if(now - pacer->second_start >= 1) {
+		pacer->fps = pacer->second_drawn / (now - pacer->second_start);
+		if(pacer->fps < pacer->min_fps) {
+			pacer->min_fps = pacer->fps;
+		}
+		pacer->second_start = now;
+		pacer->second_drawn = 0;
+	}
+
+	zdk_output_measure(&pacer->link);
+	frame_pacer_adapt(pacer, now);
+
+	pacer->since_drawn++;
+	if(!must_draw) {
+		if(pacer->since_drawn < pacer->interval) {
+			pacer->paced++;
+			return false;
+		}
+		// The terminal still has more than the frame it is taking
+		if(pacer->link.pending > pacer->link.frame_bytes) {
+			pacer->backlogged++;
+			return false;
+		}
+	}
+
+	pacer->since_drawn = 0;
+	pacer->drawn++;
+	pacer->second_drawn++;
+	return true;
+}
+
+bool frame_pacer_dashboard(frame_pacer *pacer) {
+	pacer->since_dashboard++;
+	if((pacer->interval == 1) || (pacer->since_dashboard >= PACER_DASHBOARD_FRAMES)) {
+		pacer->since_dashboard = 0;
+		return true;
+	}
+	return false;
+}
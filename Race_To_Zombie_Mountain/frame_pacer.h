@@ -0,0 +1,68 @@
+/**
+ * frame_pacer.h
+ *
+ * Decides which frames are drawn, so that a slow terminal is never sent more than it can take. The
+ * game keeps updating every frame, but frames are only drawn as often as the terminal's throughput
+ * (measured by the ZDK's write-behind output) allows, and not while it has more than a frame still
+ * to take. The rate is cut as soon as the terminal falls behind, and only raised a step at a time,
+ * once a second, so it doesn't swing back and forth.
+ *
+ * While frames are being dropped to pace the terminal, the dashboard is only redrawn every few drawn
+ * frames, as it is more text than the road and matters less to see at once.
+ **/
+#ifndef FRAME_PACER_H_
+#define FRAME_PACER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cab202_output.h"
+
+// The part of the terminal's throughput frames may use
+#define PACER_HEADROOM			0.8
+// The most frames in a row that are dropped to pace the terminal
+#define PACER_MAX_INTERVAL		30
+// How long, in seconds, before the rate is raised again
+#define PACER_RECOVER_TIME		1.0
+// The dashboard is redrawn every this many drawn frames while frames are being dropped
+#define PACER_DASHBOARD_FRAMES	4
+
+typedef struct frame_pacer {
+	double frame_rate;
+	// A frame is drawn every interval frames
+	int interval;
+	int since_drawn;
+	int since_dashboard;
+	double interval_changed;
+	// The last measure of the terminal
+	zdk_output_link link;
+
+	// The frames drawn in the current second, and the frames a second drawn in the last
+	double second_start;
+	int second_drawn;
+	double fps;
+	double min_fps;
+
+	// Every frame, the frames drawn and the frames dropped to pace the terminal or for its backlog
+	uint64_t frames;
+	uint64_t drawn;
+	uint64_t paced;
+	uint64_t backlogged;
+	int max_interval;
+} frame_pacer;
+
+/**
+ * Starts pacing frames that come at the given rate a second.
+ **/
+void frame_pacer_init(frame_pacer *pacer, double frame_rate, double now);
+
+/**
+ * Decides whether this frame is drawn. A frame that must be drawn always is.
+ **/
+bool frame_pacer_draw(frame_pacer *pacer, bool must_draw, double now);
+
+/**
+ * Decides whether the dashboard is redrawn in a frame that is being drawn.
+ **/
+bool frame_pacer_dashboard(frame_pacer *pacer);
+
+#endif
@@ -0,0 +1,239 @@
+/**
+ * ghost.c
+ *
+ * Recording and playing back ghosts. See ghost.h.
+ *
+ * Each step of a trace is a byte: the move in its lowest two bits, whether the world scrolled in
+ * the next bit, and one less than the number of frames it lasts in the rest. A jump is followed by
+ * the new column, and never lasts more than one frame.
+ **/
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "cab202_alloc.h"
+#include "ghost.h"
+
+// The moves a step can make
+#define GHOST_STAY		0
+#define GHOST_LEFT		1
+#define GHOST_RIGHT		2
+#define GHOST_JUMP		3
+#define GHOST_MOVE		3
+// Set if the world scrolled
+#define GHOST_SCROLLED	4
+// Where the number of frames is kept, and the most frames a step can last
+#define GHOST_REPEAT_SHIFT	3
+#define GHOST_MAX_REPEAT	32
+
+/**
+ * Makes room for a trace of the given length, doubling the room until it fits
+ **/
+static bool ghost_reserve(ghost_recorder *recorder, size_t length) {
+	if(length <= recorder->capacity) {
+		return true;
+	}
+
+	size_t capacity = (recorder->capacity == 0) ? 4096 : recorder->capacity;
+	while(capacity < length) {
+		capacity *= 2;
+	}
+	uint8_t *trace = zdk_realloc(recorder->trace, capacity);
+	if(trace == NULL) {
+		return false;
+	}
+	recorder->trace = trace;
+	recorder->capacity = capacity;
+	return true;
+}
+
+void ghost_record_start(ghost_recorder *recorder, int x) {
+	recorder->length = 0;
+	recorder->can_repeat = false;
+	recorder->start_x = x;
+	recorder->x = x;
+	recorder->frames = 0;
+
+	// Make room now rather than in the middle of the race
+	ghost_reserve(recorder, GHOST_RESERVE);
+}
+
+/**
+ * Adds bytes to the end of a trace, making room for them if needed
+ **/
+static bool ghost_append(ghost_recorder *recorder, const void *bytes, size_t length) {
+	if(!ghost_reserve(recorder, recorder->length + length)) {
+		return false;
+	}
+
+	memcpy(recorder->trace + recorder->length, bytes, length);
+	recorder->length += length;
+	return true;
+}
+
+bool ghost_record(ghost_recorder *recorder, int x, bool scrolled) {
+	uint8_t step = GHOST_JUMP;
+	if(x == recorder->x) {
+		step = GHOST_STAY;
+	} else if(x == recorder->x - 1) {
+		step = GHOST_LEFT;
+	} else if(x == recorder->x + 1) {
+		step = GHOST_RIGHT;
+	}
+	if(scrolled) {
+		step |= GHOST_SCROLLED;
+	}
+	recorder->x = x;
+	recorder->frames++;
+
+	// Carry on with the last step if this frame did the same thing
+	if(recorder->can_repeat) {
+		uint8_t *last = &recorder->trace[recorder->last_step];
+		int repeat = (*last >> GHOST_REPEAT_SHIFT) + 1;
+		if((((*last ^ step) & (GHOST_MOVE | GHOST_SCROLLED)) == 0) && (repeat < GHOST_MAX_REPEAT)) {
+			*last += 1 << GHOST_REPEAT_SHIFT;
+			return true;
+		}
+	}
+
+	recorder->last_step = recorder->length;
+	if(!ghost_append(recorder, &step, 1)) {
+		return false;
+	}
+	recorder->can_repeat = ((step & GHOST_MOVE) != GHOST_JUMP);
+	if(!recorder->can_repeat) {
+		int16_t column = x;
+		return ghost_append(recorder, &column, sizeof(column));
+	}
+	return true;
+}
+
+bool ghost_save(const ghost_recorder *recorder, const char *path, int score) {
+	ghost_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = GHOST_MAGIC;
+	header.version = GHOST_VERSION;
+	header.trace_bytes = recorder->length;
+	header.frames = recorder->frames;
+	header.score = score;
+	header.start_x = recorder->start_x;
+
+	// The header and trace go on in one write, so a ghost is never left half written
+	struct iovec parts[2];
+	parts[0].iov_base = &header;
+	parts[0].iov_len = sizeof(header);
+	parts[1].iov_base = recorder->trace;
+	parts[1].iov_len = recorder->length;
+	int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if(fd < 0) {
+		return false;
+	}
+	bool saved = (writev(fd, parts, 2) == (ssize_t)(sizeof(header) + recorder->length));
+	return (close(fd) == 0) && saved;
+}
+
+void ghost_recorder_free(ghost_recorder *recorder) {
+	zdk_free(recorder->trace);
+	memset(recorder, 0, sizeof(*recorder));
+}
+
+bool ghost_open(ghost *ghost, const char *path) {
+	memset(ghost, 0, sizeof(*ghost));
+	ghost->fd = open(path, O_RDONLY);
+	if(ghost->fd < 0) {
+		return false;
+	}
+
+	// Skip from header to header, keeping the best score (and the quickest run with that score)
+	off_t best = -1;
+	off_t offset = 0;
+	ghost_header header;
+	while(pread(ghost->fd, &header, sizeof(header), offset) == sizeof(header)) {
+		if((header.magic != GHOST_MAGIC) || (header.version != GHOST_VERSION)) {
+			break;
+		}
+		if((best < 0) || (header.score > ghost->header.score)
+				|| ((header.score == ghost->header.score) && (header.frames < ghost->header.frames))) {
+			best = offset;
+			ghost->header = header;
+		}
+		offset += sizeof(header) + header.trace_bytes;
+	}
+	if((best < 0) || (lseek(ghost->fd, best + sizeof(header), SEEK_SET) < 0)) {
+		ghost_close(ghost);
+		return false;
+	}
+
+	ghost->remaining = ghost->header.trace_bytes;
+	ghost->x = ghost->header.start_x;
+	ghost->playing = true;
+	return true;
+}
+
+/**
+ * Gets the next byte of the trace, reading another piece of it once the last one has been played
+ **/
+static bool ghost_next_byte(ghost *ghost, uint8_t *byte) {
+	if(ghost->position == ghost->buffered) {
+		size_t length = (ghost->remaining < GHOST_BUFFER) ? ghost->remaining : GHOST_BUFFER;
+		ssize_t got = (length > 0) ? read(ghost->fd, ghost->buffer, length) : 0;
+		if(got <= 0) {
+			return false;
+		}
+		ghost->buffered = got;
+		ghost->position = 0;
+		ghost->remaining -= got;
+	}
+
+	*byte = ghost->buffer[ghost->position++];
+	return true;
+}
+
+bool ghost_step(ghost *ghost) {
+	if(!ghost->playing) {
+		return false;
+	}
+
+	if(ghost->repeat == 0) {
+		if(!ghost_next_byte(ghost, &ghost->step)) {
+			ghost->playing = false;
+			return false;
+		}
+		ghost->repeat = (ghost->step >> GHOST_REPEAT_SHIFT) + 1;
+
+		if((ghost->step & GHOST_MOVE) == GHOST_JUMP) {
+			uint8_t column[2];
+			if(!ghost_next_byte(ghost, &column[0]) || !ghost_next_byte(ghost, &column[1])) {
+				ghost->playing = false;
+				return false;
+			}
+			int16_t x;
+			memcpy(&x, column, sizeof(x));
+			ghost->x = x;
+		}
+	}
+
+	switch(ghost->step & GHOST_MOVE) {
+		case GHOST_LEFT:
+			ghost->x--;
+			break;
+		case GHOST_RIGHT:
+			ghost->x++;
+			break;
+		default:
+			break;
+	}
+	if(ghost->step & GHOST_SCROLLED) {
+		ghost->rows++;
+	}
+	ghost->repeat--;
+	return true;
+}
+
+void ghost_close(ghost *ghost) {
+	if(ghost->fd > 0) {
+		close(ghost->fd);
+	}
+	memset(ghost, 0, sizeof(*ghost));
+}
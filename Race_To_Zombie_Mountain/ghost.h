@@ -0,0 +1,117 @@
+/**
+ * ghost.h
+ *
+ * Ghosts: recordings of how a run moved, which can be raced against later on the same world.
+ *
+ * A ghost is a trace of the player's car, one step per frame: whether it moved left or right or
+ * jumped to a new column, and whether the world scrolled under it. Consecutive frames that do the
+ * same thing share a single byte, so a trace takes at most a byte per frame and usually much less.
+ *
+ * All of the ghosts of one world are appended to the same file, each as a header followed by its
+ * trace. Only the headers are read to find the best ghost, and its trace is then read a small
+ * piece at a time as it plays, so a file can hold thousands of ghosts without slowing anything down.
+ **/
+#ifndef GHOST_H_
+#define GHOST_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Identifies a ghost, and the version of its layout
+#define GHOST_MAGIC		0x5453485a
+#define GHOST_VERSION	1
+
+// The number of bytes of a trace read at a time while it plays
+#define GHOST_BUFFER	256
+// The room made for a trace when recording starts, about 18 minutes of steps at one byte a frame
+#define GHOST_RESERVE	(64 * 1024)
+
+/**
+ * The start of a ghost in a ghost file
+ **/
+typedef struct ghost_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t trace_bytes;
+	uint32_t frames;
+	int32_t score;
+	// The column the car started in
+	int16_t start_x;
+	int16_t reserved;
+} ghost_header;
+
+/**
+ * Records the trace of a run
+ **/
+typedef struct ghost_recorder {
+	uint8_t *trace;
+	size_t length;
+	size_t capacity;
+	// Where the last step started, so frames that do the same thing can be added to it
+	size_t last_step;
+	bool can_repeat;
+	int start_x;
+	int x;
+	uint32_t frames;
+} ghost_recorder;
+
+/**
+ * A ghost being played back
+ **/
+typedef struct ghost {
+	int fd;
+	bool playing;
+	ghost_header header;
+	// The part of the trace that has been read but not played yet, and how much is still in the file
+	uint8_t buffer[GHOST_BUFFER];
+	size_t buffered;
+	size_t position;
+	size_t remaining;
+	// The step being played and the frames it has left
+	uint8_t step;
+	int repeat;
+	// Where the ghost's car is, and how many rows of the world it has travelled
+	int x;
+	int rows;
+} ghost;
+
+/**
+ * Starts recording a new run, with the car in the given column. Room is made for GHOST_RESERVE bytes
+ * of trace now, so a race doesn't need to allocate until its trace is longer than that.
+ **/
+void ghost_record_start(ghost_recorder *recorder, int x);
+
+/**
+ * Records a frame of the run, with the car now in the given column. Returns false if out of memory.
+ **/
+bool ghost_record(ghost_recorder *recorder, int x, bool scrolled);
+
+/**
+ * Adds the recorded run to the end of a ghost file, with the score it got. Returns false if it
+ * couldn't be saved.
+ **/
+bool ghost_save(const ghost_recorder *recorder, const char *path, int score);
+
+/**
+ * Frees the memory of a recorder.
+ **/
+void ghost_recorder_free(ghost_recorder *recorder);
+
+/**
+ * Starts playing the ghost with the best score in a ghost file. Returns false if the file has no
+ * ghosts.
+ **/
+bool ghost_open(ghost *ghost, const char *path);
+
+/**
+ * Plays the next frame of a ghost. Returns false once the ghost has finished its run.
+ **/
+bool ghost_step(ghost *ghost);
+
+/**
+ * Stops playing a ghost.
+ **/
+void ghost_close(ghost *ghost);
+
+#endif
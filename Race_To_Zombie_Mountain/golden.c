@@ -0,0 +1,253 @@
+/**
+ * golden.c
+ *
+ * Scripted runs checked against golden frames. See golden.h.
+ **/
+#define _XOPEN_SOURCE 700
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cab202_alloc.h"
+#include "cab202_timers.h"
+#include "golden.h"
+
+// The longest line of a script
+#define GOLDEN_LINE_SIZE	256
+
+static double clock_now;
+
+/**
+ * Copies the keys of a step, turning \n into Enter and \\ into a backslash
+ **/
+static bool golden_read_keys(golden_step *step, const char *keys) {
+	int length = 0;
+	for(const char *key=keys; (*key != '\0') && (*key != '\n'); key++) {
+		char value = *key;
+		if(value == '\\') {
+			key++;
+			if(*key == 'n') {
+				value = '\n';
+			} else if(*key == '\\') {
+				value = '\\';
+			} else {
+				return false;
+			}
+		}
+		if(length == GOLDEN_MAX_KEYS) {
+			return false;
+		}
+		step->keys[length++] = value;
+	}
+	step->keys[length] = '\0';
+	return length > 0;
+}
+
+bool golden_load(golden_script *script, const char *path) {
+	memset(script, 0, sizeof(golden_script));
+	FILE *file = fopen(path, "r");
+	if(file == NULL) {
+		fprintf(stderr, "%s: can't be opened\n", path);
+		return false;
+	}
+
+	char line[GOLDEN_LINE_SIZE];
+	int line_number = 0;
+	int capacity = 0;
+	bool valid = true;
+	while(valid && (fgets(line, sizeof(line), file) != NULL)) {
+		line_number++;
+		char *comment = strchr(line, '#');
+		if(comment != NULL) {
+			*comment = '\0';
+		}
+
+		char word[GOLDEN_LINE_SIZE];
+		int frame;
+		int used = 0;
+		if(sscanf(line, "%255s", word) != 1) {
+			continue;
+		} else if(strcmp(word, "frames") == 0) {
+			valid = (sscanf(line, "frames %d", &script->frames) == 1) && (script->frames > 0);
+		} else if(strcmp(word, "seed") == 0) {
+			valid = (sscanf(line, "seed %u", &script->seed) == 1);
+		} else if(strcmp(word, "budget") == 0) {
+			valid = (sscanf(line, "budget update %lf", &script->update_budget_ms) == 1)
+				|| (sscanf(line, "budget draw %lf", &script->draw_budget_ms) == 1)
+				|| (sscanf(line, "budget flush %d", &script->flush_budget) == 1);
+		} else if((sscanf(line, "%d %n", &frame, &used) == 1) && (used > 0)) {
+			// Steps are played in order, so they have to be in order
+			if((frame < 0) || ((script->num_steps > 0) && (frame <= script->steps[script->num_steps - 1].frame))) {
+				valid = false;
+				break;
+			}
+			if(script->num_steps == capacity) {
+				capacity = (capacity == 0) ? 64 : capacity * 2;
+				golden_step *steps = zdk_realloc(script->steps, capacity * sizeof(golden_step));
+				if(steps == NULL) {
+					valid = false;
+					break;
+				}
+				script->steps = steps;
+			}
+			golden_step *step = &script->steps[script->num_steps];
+			step->frame = frame;
+			valid = golden_read_keys(step, line + used);
+			script->num_steps++;
+		} else {
+			valid = false;
+		}
+	}
+	fclose(file);
+
+	if(!valid) {
+		fprintf(stderr, "%s:%d: not a script line\n", path, line_number);
+	} else if(script->frames == 0) {
+		fprintf(stderr, "%s: has no frames line\n", path);
+		valid = false;
+	}
+	if(!valid) {
+		golden_free(script);
+	}
+	return valid;
+}
+
+const char *golden_keys(golden_script *script, int frame) {
+	if((script->next_step < script->num_steps) && (script->steps[script->next_step].frame == frame)) {
+		return script->steps[script->next_step++].keys;
+	}
+	return "";
+}
+
+void golden_free(golden_script *script) {
+	zdk_free(script->steps);
+	script->steps = NULL;
+	script->num_steps = 0;
+}
+
+/**
+ * The virtual clock, as the ZDK sees it
+ **/
+static double golden_clock() {
+	return clock_now;
+}
+
+static void golden_clock_pause(long milliseconds) {
+	golden_clock_advance(milliseconds);
+}
+
+void golden_clock_start(double seconds) {
+	clock_now = seconds;
+	zdk_get_current_time = golden_clock;
+	zdk_timer_pause = golden_clock_pause;
+}
+
+void golden_clock_advance(long milliseconds) {
+	clock_now += milliseconds / 1000.0;
+}
+
+bool golden_sandbox(char *directory, size_t size) {
+	const char *base = getenv("TMPDIR");
+	snprintf(directory, size, "%s/race-golden-XXXXXX", (base != NULL) ? base : "/tmp");
+	return (mkdtemp(directory) != NULL) && (chdir(directory) == 0);
+}
+
+/**
+ * Removes one thing in the sandbox, after everything in it when it is a directory
+ **/
+static int golden_remove_entry(const char *path, const struct stat *info, int type, struct FTW *walk) {
+	remove(path);
+	return 0;
+}
+
+void golden_sandbox_remove(const char *directory) {
+	nftw(directory, golden_remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/**
+ * Finds the end of the line starting at the given offset
+ **/
+static size_t golden_line_end(const char *text, size_t length, size_t start) {
+	const char *end = memchr(text + start, '\n', length - start);
+	return (end != NULL) ? (size_t)(end - text) : length;
+}
+
+/**
+ * Prints a line, without its end
+ **/
+static void golden_print_line(FILE *report, const char *label, const char *text, size_t start, size_t end) {
+	fprintf(report, "  %s %.*s\n", label, (int)(end - start), text + start);
+}
+
+bool golden_compare(const char *captured, size_t length, const char *path, FILE *report) {
+	FILE *file = fopen(path, "r");
+	if(file == NULL) {
+		file = fopen(path, "w");
+		if((file == NULL) || (fwrite(captured, 1, length, file) != length)) {
+			fprintf(report, "%s: can't save the golden frames\n", path);
+			if(file != NULL) {
+				fclose(file);
+			}
+			return false;
+		}
+		fclose(file);
+		fprintf(report, "%s: saved as the golden frames\n", path);
+		return true;
+	}
+
+	fseek(file, 0, SEEK_END);
+	size_t golden_length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	char *golden = zdk_malloc(golden_length + 1);
+	if((golden == NULL) || (fread(golden, 1, golden_length, file) != golden_length)) {
+		fprintf(report, "%s: can't be read\n", path);
+		zdk_free(golden);
+		fclose(file);
+		return false;
+	}
+	fclose(file);
+
+	// Go through both a line at a time, keeping track of which frame and row each line is
+	size_t at = 0;
+	size_t golden_at = 0;
+	int frame = 0;
+	int row = 0;
+	size_t header = 0;
+	size_t header_end = 0;
+	bool same = true;
+	while((at < length) || (golden_at < golden_length)) {
+		if((at >= length) || (golden_at >= golden_length)) {
+			fprintf(report, "%s: the run drew %s frames than the golden frames, after frame %d\n", path,
+				(at >= length) ? "fewer" : "more", frame);
+			same = false;
+			break;
+		}
+
+		size_t end = golden_line_end(captured, length, at);
+		size_t golden_end = golden_line_end(golden, golden_length, golden_at);
+		if(strncmp(golden + golden_at, "Frame(", 6) == 0) {
+			frame++;
+			row = 0;
+			header = golden_at;
+			header_end = golden_end;
+		}
+		if(((end - at) != (golden_end - golden_at)) || (memcmp(captured + at, golden + golden_at, end - at) != 0)) {
+			fprintf(report, "%s: frame %d differs at line %d\n", path, frame, row);
+			if(frame > 0) {
+				golden_print_line(report, "in", golden, header, header_end);
+			}
+			golden_print_line(report, "expected", golden, golden_at, golden_end);
+			golden_print_line(report, "got     ", captured, at, end);
+			same = false;
+			break;
+		}
+
+		row++;
+		at = end + 1;
+		golden_at = golden_end + 1;
+	}
+
+	zdk_free(golden);
+	return same;
+}
@@ -0,0 +1,91 @@
+/**
+ * golden.h
+ *
+ * Plays the game from a script of keys and checks every frame it draws against golden frames saved
+ * from an earlier run, and checks how long each frame took against budgets in the script.
+ *
+ * A script is a text file of lines, where # starts a comment:
+ *   frames 900				the most frames to play
+ *   seed 7					the seed of the world
+ *   budget update 2.5		the longest update() may take, in milliseconds
+ *   budget draw 5			the longest draw() may take, in milliseconds
+ *   budget flush 1920		the most bytes show_screen() may write in a frame
+ *   40 www					the keys pressed in frame 40 (\n is Enter and \\ is a backslash)
+ *
+ * The game runs on a virtual clock (through the ZDK's zdk_get_current_time and zdk_timer_pause)
+ * that moves on exactly one frame each frame, so the same script always draws the same frames. The
+ * frames are captured in the ZDK's screen-cast format, and the golden frames are a file in the same
+ * format.
+ **/
+#ifndef GOLDEN_H_
+#define GOLDEN_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// The most keys pressed in one frame of a script
+#define GOLDEN_MAX_KEYS	16
+
+/**
+ * The keys pressed in one frame
+ **/
+typedef struct golden_step {
+	int frame;
+	char keys[GOLDEN_MAX_KEYS + 1];
+} golden_step;
+
+/**
+ * A script, and the next of its steps to be played
+ **/
+typedef struct golden_script {
+	int frames;
+	unsigned int seed;
+	// The budgets of a frame. A budget of 0 isn't checked
+	double update_budget_ms;
+	double draw_budget_ms;
+	int flush_budget;
+	golden_step *steps;
+	int num_steps;
+	int next_step;
+} golden_script;
+
+/**
+ * Reads a script. Returns false, having said why on stderr, if it can't be read.
+ **/
+bool golden_load(golden_script *script, const char *path);
+
+/**
+ * Gets the keys pressed in a frame (frames must be asked for in order). There are none in most frames.
+ **/
+const char *golden_keys(golden_script *script, int frame);
+
+/**
+ * Releases a script.
+ **/
+void golden_free(golden_script *script);
+
+/**
+ * Starts the virtual clock at the given time, and moves it on.
+ **/
+void golden_clock_start(double seconds);
+void golden_clock_advance(long milliseconds);
+
+/**
+ * Makes a new empty directory and works in it, so the files of earlier games (highscores, ghosts and
+ * saved races) can't change what is drawn. Returns false if it couldn't be made.
+ **/
+bool golden_sandbox(char *directory, size_t size);
+
+/**
+ * Removes the directory made by golden_sandbox and everything in it.
+ **/
+void golden_sandbox_remove(const char *directory);
+
+/**
+ * Compares captured frames with the golden frames in a file, reporting the first difference. If there
+ * is no golden file yet, the captured frames are saved as it. Returns false if they differ.
+ **/
+bool golden_compare(const char *captured, size_t length, const char *path, FILE *report);
+
+#endif
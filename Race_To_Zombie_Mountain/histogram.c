@@ -0,0 +1,66 @@
+/**
+ * histogram.c
+ *
+ * Bucketed times. See histogram.h.
+ **/
+#include <string.h>
+#include "histogram.h"
+
+void histogram_clear(histogram *histogram) {
+	memset(histogram, 0, sizeof(*histogram));
+}
+
+void histogram_add(histogram *histogram, double seconds) {
+	if(seconds < 0) {
+		seconds = 0;
+	}
+
+	long bucket = seconds * 1e6 / HISTOGRAM_BUCKET_US;
+	if(bucket >= HISTOGRAM_BUCKETS) {
+		bucket = HISTOGRAM_BUCKETS - 1;
+	}
+	histogram->buckets[bucket]++;
+
+	if((histogram->count == 0) || (seconds < histogram->min)) {
+		histogram->min = seconds;
+	}
+	if(seconds > histogram->max) {
+		histogram->max = seconds;
+	}
+	histogram->count++;
+	histogram->total += seconds;
+}
+
+double histogram_percentile(const histogram *histogram, double percent) {
+	if(histogram->count == 0) {
+		return 0;
+	}
+
+	// The rank of the time wanted, counting from 1
+	uint64_t rank = (percent / 100.0) * histogram->count + 0.5;
+	if(rank < 1) {
+		return histogram->min;
+	} else if(rank >= histogram->count) {
+		return histogram->max;
+	}
+
+	uint64_t seen = 0;
+	for(int i=0; i<HISTOGRAM_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if(seen >= rank) {
+			// Report the middle of the bucket, but never outside the times actually seen
+			double seconds = (i + 0.5) * HISTOGRAM_BUCKET_US / 1e6;
+			if(seconds < histogram->min) {
+				seconds = histogram->min;
+			} else if(seconds > histogram->max) {
+				seconds = histogram->max;
+			}
+			return seconds;
+		}
+	}
+	return histogram->max;
+}
+
+double histogram_mean(const histogram *histogram) {
+	return (histogram->count > 0) ? histogram->total / histogram->count : 0;
+}
@@ -0,0 +1,50 @@
+/**
+ * histogram.h
+ *
+ * Counts how long things take in fixed size buckets, so that percentiles can be found at any time
+ * without keeping every time or sorting anything. Times are in seconds, and are kept to within
+ * HISTOGRAM_BUCKET_US microseconds (apart from the smallest and largest, which are exact). Anything
+ * longer than the last bucket is counted in it.
+ **/
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <stdint.h>
+
+// The width of each bucket, and the number of buckets (covering half a second)
+#define HISTOGRAM_BUCKET_US	50
+#define HISTOGRAM_BUCKETS	10000
+
+/**
+ * The times counted so far
+ **/
+typedef struct histogram {
+	uint32_t buckets[HISTOGRAM_BUCKETS];
+	uint64_t count;
+	double total;
+	double min;
+	double max;
+} histogram;
+
+/**
+ * Forgets every time.
+ **/
+void histogram_clear(histogram *histogram);
+
+/**
+ * Counts a time.
+ **/
+void histogram_add(histogram *histogram, double seconds);
+
+/**
+ * Finds the time that the given percentage of the times are no longer than. Returns 0 if there
+ * are no times.
+ **/
+double histogram_percentile(const histogram *histogram, double percent);
+
+/**
+ * The mean of the times.
+ **/
+double histogram_mean(const histogram *histogram);
+
+#endif
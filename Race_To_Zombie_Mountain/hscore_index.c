@@ -0,0 +1,229 @@
+/**
+ * hscore_index.c
+ *
+ * Indexable skip list holding every highscore. See hscore_index.h.
+ **/
+#include <stdlib.h>
+#include <string.h>
+#include "hscore_index.h"
+
+/**
+ * Allocates a node with the given number of links
+ **/
+static hscore_node *hscore_node_create(int level) {
+	hscore_node *node = malloc(sizeof(hscore_node) + (level * sizeof(hscore_link)));
+	if(node != NULL) {
+		node->level = level;
+	}
+	return node;
+}
+
+/**
+ * Picks the level of a new node. Each extra level is 4 times less likely than the one below
+ **/
+static int hscore_random_level(hscore_index *index) {
+	int level = 1;
+	while(level < HSCORE_INDEX_MAX_LEVEL) {
+		// xorshift32
+		index->seed ^= index->seed << 13;
+		index->seed ^= index->seed >> 17;
+		index->seed ^= index->seed << 5;
+		if((index->seed & 3) != 0) {
+			break;
+		}
+		level++;
+	}
+	return level;
+}
+
+/**
+ * Checks if a node is ordered before an entry with the given score and insertion order
+ **/
+static bool hscore_before(const hscore_node *node, int score, unsigned long long order) {
+	return (node->entry.score > score) || ((node->entry.score == score) && (node->order < order));
+}
+
+bool hscore_index_init(hscore_index *index) {
+	memset(index, 0, sizeof(hscore_index));
+
+	index->head = hscore_node_create(HSCORE_INDEX_MAX_LEVEL);
+	if(index->head == NULL) {
+		return false;
+	}
+	for(int i=0; i<HSCORE_INDEX_MAX_LEVEL; i++) {
+		index->head->links[i].next = NULL;
+		index->head->links[i].span = 0;
+	}
+
+	index->level = 1;
+	index->seed = 0x2545f491;
+	return true;
+}
+
+void hscore_index_clear(hscore_index *index) {
+	hscore_node *node = index->head->links[0].next;
+	while(node != NULL) {
+		hscore_node *next = node->links[0].next;
+		free(node);
+		node = next;
+	}
+
+	for(int i=0; i<HSCORE_INDEX_MAX_LEVEL; i++) {
+		index->head->links[i].next = NULL;
+		index->head->links[i].span = 0;
+	}
+	index->level = 1;
+	index->count = 0;
+}
+
+void hscore_index_free(hscore_index *index) {
+	if(index->head != NULL) {
+		hscore_index_clear(index);
+		free(index->head);
+		index->head = NULL;
+	}
+}
+
+int hscore_index_insert(hscore_index *index, const char *name, int score, unsigned long long id) {
+	hscore_node *update[HSCORE_INDEX_MAX_LEVEL];
+	int rank[HSCORE_INDEX_MAX_LEVEL];
+	unsigned long long order = index->next_order++;
+
+	// Find the last node before the new one on every level, and its rank
+	hscore_node *node = index->head;
+	for(int i=index->level-1; i>=0; i--) {
+		rank[i] = (i == index->level-1) ? 0 : rank[i+1];
+		while((node->links[i].next != NULL) && hscore_before(node->links[i].next, score, order)) {
+			rank[i] += node->links[i].span;
+			node = node->links[i].next;
+		}
+		update[i] = node;
+	}
+
+	int level = hscore_random_level(index);
+	if(level > index->level) {
+		for(int i=index->level; i<level; i++) {
+			rank[i] = 0;
+			update[i] = index->head;
+			update[i]->links[i].span = index->count;
+		}
+		index->level = level;
+	}
+
+	hscore_node *created = hscore_node_create(level);
+	if(created == NULL) {
+		return 0;
+	}
+	strncpy(created->entry.name, name, MAX_NAME_SIZE);
+	created->entry.name[MAX_NAME_SIZE] = '\0';
+	created->entry.score = score;
+	created->entry.id = id;
+	created->order = order;
+
+	// Splice the node in, splitting the spans of the links it is inserted into
+	for(int i=0; i<level; i++) {
+		created->links[i].next = update[i]->links[i].next;
+		update[i]->links[i].next = created;
+
+		created->links[i].span = update[i]->links[i].span - (rank[0] - rank[i]);
+		update[i]->links[i].span = (rank[0] - rank[i]) + 1;
+	}
+
+	// The links above the new node now skip over one more entry
+	for(int i=level; i<index->level; i++) {
+		update[i]->links[i].span++;
+	}
+
+	index->count++;
+	return rank[0] + 1;
+}
+
+int hscore_index_rank(const hscore_index *index, int score) {
+	int traversed = 0;
+
+	// A new score ranks below every score it ties with
+	hscore_node *node = index->head;
+	for(int i=index->level-1; i>=0; i--) {
+		while((node->links[i].next != NULL) && (node->links[i].next->entry.score >= score)) {
+			traversed += node->links[i].span;
+			node = node->links[i].next;
+		}
+	}
+
+	return traversed + 1;
+}
+
+int hscore_index_find(const hscore_index *index, int score, unsigned long long id) {
+	int traversed = 0;
+
+	// Find the last node with a higher score
+	hscore_node *node = index->head;
+	for(int i=index->level-1; i>=0; i--) {
+		while((node->links[i].next != NULL) && (node->links[i].next->entry.score > score)) {
+			traversed += node->links[i].span;
+			node = node->links[i].next;
+		}
+	}
+
+	// Then walk along the scores tied with it
+	for(node = node->links[0].next; (node != NULL) && (node->entry.score == score); node = node->links[0].next) {
+		traversed++;
+		if(node->entry.id == id) {
+			return traversed;
+		}
+	}
+
+	return 0;
+}
+
+int hscore_index_page(const hscore_index *index, int rank, int max_entries, hscore_entry *entries) {
+	if((rank < 1) || (rank > index->count)) {
+		return 0;
+	}
+
+	// Find the node at the given rank
+	int traversed = 0;
+	hscore_node *node = index->head;
+	for(int i=index->level-1; i>=0; i--) {
+		while((node->links[i].next != NULL) && (traversed + node->links[i].span <= rank)) {
+			traversed += node->links[i].span;
+			node = node->links[i].next;
+		}
+	}
+
+	// Then walk along the bottom level
+	int count = 0;
+	while((node != NULL) && (count < max_entries)) {
+		entries[count++] = node->entry;
+		node = node->links[0].next;
+	}
+
+	return count;
+}
+
+bool hscore_index_sync(hscore_index *index) {
+	hscore_list list = { NULL, 0, 0 };
+
+	// Usually only a few scores have been appended since we last looked. A score posted more than
+	// once under the same id (such as the seed) is only added the first time
+	if(hscore_store_read_new(&index->reader, &list)) {
+		for(int i=0; i<list.count; i++) {
+			hscore_entry *entry = &list.entries[i];
+			if((entry->id == 0) || (hscore_index_find(index, entry->score, entry->id) == 0)) {
+				hscore_index_insert(index, entry->name, entry->score, entry->id);
+			}
+		}
+		hscore_list_free(&list);
+		return true;
+	}
+
+	// The files were compacted (or never read), so start again from scratch
+	hscore_index_clear(index);
+	bool found = hscore_store_read(&index->reader, &list);
+	for(int i=0; i<list.count; i++) {
+		hscore_index_insert(index, list.entries[i].name, list.entries[i].score, list.entries[i].id);
+	}
+	hscore_list_free(&list);
+
+	return found;
+}
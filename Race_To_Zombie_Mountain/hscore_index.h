@@ -0,0 +1,97 @@
+/**
+ * hscore_index.h
+ *
+ * An order-statistics index over every highscore ever posted. It is a skip list whose links also
+ * record how many entries they skip over, so finding the rank of a score, inserting a score and
+ * finding the entry at a given rank all take O(log n) time, no matter how many scores are held.
+ *
+ * Scores are ordered from the highest to the lowest. Equal scores are kept in the order they were
+ * inserted, so a new score always ranks below the scores it ties with.
+ **/
+#ifndef HSCORE_INDEX_H_
+#define HSCORE_INDEX_H_
+
+#include "hscore_store.h"
+
+// The most levels a node can have. With a 1 in 4 chance of each extra level this comfortably
+// covers far more entries than we could ever hold in memory
+#define HSCORE_INDEX_MAX_LEVEL	16
+
+/**
+ * A link from a node to the next node on the same level. The span is the number of entries the
+ * link moves forward by (1 on the bottom level)
+ **/
+typedef struct hscore_link {
+	struct hscore_node *next;
+	int span;
+} hscore_link;
+
+/**
+ * An entry in the index. Only as many links as the node's level are allocated
+ **/
+typedef struct hscore_node {
+	hscore_entry entry;
+	unsigned long long order;
+	int level;
+	hscore_link links[];
+} hscore_node;
+
+/**
+ * The index itself, along with what is needed to keep it in step with the highscore files
+ **/
+typedef struct hscore_index {
+	hscore_node *head;
+	int level;
+	int count;
+	// Increases with every insertion, used to keep equal scores in insertion order
+	unsigned long long next_order;
+	unsigned int seed;
+	hscore_reader reader;
+} hscore_index;
+
+/**
+ * Prepares an empty index. Returns false if out of memory.
+ **/
+bool hscore_index_init(hscore_index *index);
+
+/**
+ * Removes every entry from the index.
+ **/
+void hscore_index_clear(hscore_index *index);
+
+/**
+ * Releases all of the memory held by the index.
+ **/
+void hscore_index_free(hscore_index *index);
+
+/**
+ * Inserts a score and returns the rank it was given (1 is the highest score), or 0 if out of
+ * memory.
+ **/
+int hscore_index_insert(hscore_index *index, const char *name, int score, unsigned long long id);
+
+/**
+ * Returns the rank a new score would be given if it were inserted now.
+ **/
+int hscore_index_rank(const hscore_index *index, int score);
+
+/**
+ * Returns the rank of the entry with the given score and id, or 0 if it isn't in the index. Only
+ * the entries tied with the score are searched one by one.
+ **/
+int hscore_index_find(const hscore_index *index, int score, unsigned long long id);
+
+/**
+ * Copies up to max_entries entries, starting from the one at the given (1-based) rank, into
+ * entries. Returns the number of entries copied.
+ **/
+int hscore_index_page(const hscore_index *index, int rank, int max_entries, hscore_entry *entries);
+
+/**
+ * Brings the index up to date with the highscore files. Only the scores appended since the last
+ * sync are read, unless the files have been compacted in the meantime. A score already in the
+ * index under the same id isn't added again. Returns false if there are no highscore files yet.
+ **/
+bool hscore_index_sync(hscore_index *index);
+
+#endif
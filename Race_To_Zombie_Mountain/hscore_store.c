@@ -0,0 +1,437 @@
+/**
+ * hscore_store.c
+ *
+ * Append-only log and atomically replaced table that hold the highscores. See hscore_store.h for
+ * an overview of the protocol.
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "hscore_store.h"
+
+// Temporary files that are renamed over the table and log once they are complete
+#define HSCORE_TABLE_TMP_FILE	"highscores.tmp"
+#define HSCORE_LOG_TMP_FILE		"highscores.log.tmp"
+
+// The longest line we expect in either file (name, score and id plus separators)
+#define HSCORE_LINE_SIZE	64
+// A lower bound on the size of a log record (the id alone takes most of a line), used to decide
+// from the size of the log whether it holds more than HSCORE_COMPACT_THRESHOLD records
+#define HSCORE_MIN_RECORD_SIZE	20
+// The log is also allowed to grow to this fraction of the table before being compacted, so the
+// cost of rewriting a large table is spread over many appends
+#define HSCORE_COMPACT_RATIO	4
+
+/**
+ * Returns a monotonic time in seconds, used to measure lock waits
+ **/
+static double hscore_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+/**
+ * Creates an id that is unique to this posting of a score, even across many processes
+ **/
+static unsigned long long hscore_new_id() {
+	static unsigned int counter = 0;
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	unsigned long long id = ((unsigned long long)ts.tv_sec << 32) ^ ((unsigned long long)ts.tv_nsec << 12);
+	id ^= ((unsigned long long)getpid() << 40) ^ ((unsigned long long)getpid());
+	id += ++counter;
+
+	// 0 is reserved for entries that came from a table without ids, and HSCORE_SEED_ID for the seed
+	return (id <= HSCORE_SEED_ID) ? HSCORE_SEED_ID + 1 : id;
+}
+
+/**
+ * Adds an entry to the end of the list, growing it if needed
+ **/
+bool hscore_list_add(hscore_list *list, const char *name, int score, unsigned long long id) {
+	if(list->count == list->capacity) {
+		int capacity = (list->capacity == 0) ? (MAX_SCORES + HSCORE_COMPACT_THRESHOLD) : (list->capacity * 2);
+		hscore_entry *entries = realloc(list->entries, capacity * sizeof(hscore_entry));
+		if(entries == NULL) {
+			return false;
+		}
+		list->entries = entries;
+		list->capacity = capacity;
+	}
+
+	hscore_entry *entry = &list->entries[list->count++];
+	strncpy(entry->name, name, MAX_NAME_SIZE);
+	entry->name[MAX_NAME_SIZE] = '\0';
+	entry->score = score;
+	entry->id = id;
+	return true;
+}
+
+/**
+ * Reads every complete "name score [id]" line from a file into the list. A line that was only
+ * partially written (no trailing newline) is ignored, as it belongs to a writer that crashed or is
+ * still writing. Returns false if the file couldn't be opened.
+ **/
+static bool hscore_read_file(FILE *file, hscore_list *list, off_t *end) {
+	if(file == NULL) {
+		return false;
+	}
+
+	char line[HSCORE_LINE_SIZE];
+	while(fgets(line, sizeof(line), file) != NULL) {
+		size_t length = strlen(line);
+		if((length == 0) || (line[length-1] != '\n')) {
+			// Skip the rest of an overlong line as well
+			while((length > 0) && (line[length-1] != '\n') && fgets(line, sizeof(line), file) != NULL) {
+				length = strlen(line);
+			}
+			continue;
+		}
+
+		// Remember where the last complete line ended, so we can carry on from there next time
+		if(end != NULL) {
+			*end = ftello(file);
+		}
+
+		char name[MAX_NAME_SIZE+1];
+		int score;
+		unsigned long long id = 0;
+		int fields = sscanf(line, "%12s %d %llu", name, &score, &id);
+		if((fields >= 2) && (score > 0)) {
+			hscore_list_add(list, name, score, (fields == 3) ? id : 0);
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Orders entries by id so duplicates end up next to each other
+ **/
+static int hscore_compare_id(const void *a, const void *b) {
+	unsigned long long id_a = ((const hscore_entry *)a)->id;
+	unsigned long long id_b = ((const hscore_entry *)b)->id;
+	return (id_a > id_b) - (id_a < id_b);
+}
+
+/**
+ * Orders entries from the highest score to the lowest
+ **/
+static int hscore_compare_score(const void *a, const void *b) {
+	int score_a = ((const hscore_entry *)a)->score;
+	int score_b = ((const hscore_entry *)b)->score;
+	return (score_b > score_a) - (score_b < score_a);
+}
+
+/**
+ * Removes entries that appear more than once with the same id and sorts the remaining entries by
+ * score. Entries with an id of 0 are never considered duplicates.
+ **/
+static void hscore_list_finish(hscore_list *list) {
+	if(list->count == 0) {
+		return;
+	}
+
+	qsort(list->entries, list->count, sizeof(hscore_entry), hscore_compare_id);
+
+	int kept = 0;
+	for(int i=0; i<list->count; i++) {
+		if((kept > 0) && (list->entries[i].id != 0) && (list->entries[i].id == list->entries[kept-1].id)) {
+			continue;
+		}
+		list->entries[kept++] = list->entries[i];
+	}
+	list->count = kept;
+
+	qsort(list->entries, list->count, sizeof(hscore_entry), hscore_compare_score);
+}
+
+/**
+ * Gets the identity of an open file, so we can tell later whether it has been replaced or changed
+ **/
+static void hscore_identify(FILE *file, ino_t *ino, off_t *size, struct timespec *mtime) {
+	struct stat file_stat;
+	if((file != NULL) && (fstat(fileno(file), &file_stat) == 0)) {
+		*ino = file_stat.st_ino;
+		*size = file_stat.st_size;
+		*mtime = file_stat.st_mtim;
+	} else {
+		*ino = 0;
+		*size = 0;
+		mtime->tv_sec = 0;
+		mtime->tv_nsec = 0;
+	}
+}
+
+/**
+ * Reads the log and the table into the list. The log is opened first: a compaction always
+ * publishes the new table before it replaces the log, so whichever pair of files we end up with
+ * holds every score (possibly twice, which hscore_list_finish takes care of).
+ * Returns false if neither file exists.
+ **/
+static bool hscore_read_all(hscore_reader *reader, hscore_list *list) {
+	FILE *log_file = fopen(HSCORE_LOG_FILE, "r");
+	FILE *table_file = fopen(HSCORE_TABLE_FILE, "r");
+
+	hscore_reader ignored;
+	if(reader == NULL) {
+		reader = &ignored;
+	}
+	off_t log_size;
+	struct timespec log_mtime;
+	hscore_identify(log_file, &reader->log_ino, &log_size, &log_mtime);
+	hscore_identify(table_file, &reader->table_ino, &reader->table_size, &reader->table_mtime);
+	reader->log_offset = 0;
+
+	bool found = hscore_read_file(table_file, list, NULL);
+	found = hscore_read_file(log_file, list, &reader->log_offset) || found;
+	reader->loaded = found;
+
+	if(table_file != NULL) {
+		fclose(table_file);
+	}
+	if(log_file != NULL) {
+		fclose(log_file);
+	}
+
+	hscore_list_finish(list);
+	return found;
+}
+
+bool hscore_store_read(hscore_reader *reader, hscore_list *list) {
+	return hscore_read_all(reader, list);
+}
+
+bool hscore_store_read_new(hscore_reader *reader, hscore_list *list) {
+	if(!reader->loaded) {
+		return false;
+	}
+
+	FILE *log_file = fopen(HSCORE_LOG_FILE, "r");
+	FILE *table_file = fopen(HSCORE_TABLE_FILE, "r");
+
+	ino_t log_ino;
+	off_t log_size;
+	struct timespec log_mtime;
+	ino_t table_ino;
+	off_t table_size;
+	struct timespec table_mtime;
+	hscore_identify(log_file, &log_ino, &log_size, &log_mtime);
+	hscore_identify(table_file, &table_ino, &table_size, &table_mtime);
+	if(table_file != NULL) {
+		fclose(table_file);
+	}
+
+	// A compaction replaces both files, after which everything has to be read again
+	bool unchanged = (log_ino == reader->log_ino) && (table_ino == reader->table_ino) && (table_size == reader->table_size) 
+		&& (table_mtime.tv_sec == reader->table_mtime.tv_sec) && (table_mtime.tv_nsec == reader->table_mtime.tv_nsec)
+		&& (log_size >= reader->log_offset);
+
+	if(unchanged && (log_file != NULL) && (log_size > reader->log_offset)) {
+		fseeko(log_file, reader->log_offset, SEEK_SET);
+		hscore_read_file(log_file, list, &reader->log_offset);
+	}
+
+	if(log_file != NULL) {
+		fclose(log_file);
+	}
+	return unchanged;
+}
+
+void hscore_list_free(hscore_list *list) {
+	free(list->entries);
+	list->entries = NULL;
+	list->count = 0;
+	list->capacity = 0;
+}
+
+int hscore_store_load(hscore_entry *entries, int max_entries) {
+	hscore_list list = { NULL, 0, 0 };
+
+	if(!hscore_read_all(NULL, &list)) {
+		hscore_list_free(&list);
+		return -1;
+	}
+
+	int count = (list.count < max_entries) ? list.count : max_entries;
+	memcpy(entries, list.entries, count * sizeof(hscore_entry));
+	hscore_list_free(&list);
+
+	return count;
+}
+
+/**
+ * Writes the whole buffer to the file descriptor, retrying on short writes
+ **/
+static bool hscore_write_all(int fd, const char *buffer, size_t length) {
+	while(length > 0) {
+		ssize_t written = write(fd, buffer, length);
+		if(written <= 0) {
+			return false;
+		}
+		buffer += written;
+		length -= written;
+	}
+	return true;
+}
+
+/**
+ * Merges the log into the table. Must be called while holding the exclusive lock.
+ **/
+static bool hscore_compact_locked() {
+	hscore_list list = { NULL, 0, 0 };
+	hscore_read_all(NULL, &list);
+
+	FILE *table_file = fopen(HSCORE_TABLE_TMP_FILE, "w");
+	if(table_file == NULL) {
+		hscore_list_free(&list);
+		return false;
+	}
+
+	// Every score ever posted is kept, so the table can be ranked beyond the top MAX_SCORES
+	bool ok = true;
+	for(int i=0; ok && i<list.count; i++) {
+		ok = fprintf(table_file, "%s %d %llu\n", list.entries[i].name, list.entries[i].score, list.entries[i].id) > 0;
+	}
+	hscore_list_free(&list);
+
+	ok = (fflush(table_file) == 0) && ok;
+	ok = ok && (fsync(fileno(table_file)) == 0);
+	ok = (fclose(table_file) == 0) && ok;
+
+	// Publish the new table, then replace the log with an empty one. A crash in between leaves
+	// scores in both files, which readers remove again by id
+	if(ok && (rename(HSCORE_TABLE_TMP_FILE, HSCORE_TABLE_FILE) == 0)) {
+		int log_fd = open(HSCORE_LOG_TMP_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(log_fd >= 0) {
+			close(log_fd);
+			rename(HSCORE_LOG_TMP_FILE, HSCORE_LOG_FILE);
+		}
+		return true;
+	}
+
+	unlink(HSCORE_TABLE_TMP_FILE);
+	return false;
+}
+
+/**
+ * Decides if a log of the given size should be merged into the table
+ **/
+static bool hscore_log_too_long(off_t log_size) {
+	struct stat table_stat;
+	off_t table_size = (stat(HSCORE_TABLE_FILE, &table_stat) == 0) ? table_stat.st_size : 0;
+
+	off_t limit = HSCORE_COMPACT_THRESHOLD * HSCORE_MIN_RECORD_SIZE;
+	if(table_size / HSCORE_COMPACT_RATIO > limit) {
+		limit = table_size / HSCORE_COMPACT_RATIO;
+	}
+	return log_size > limit;
+}
+
+bool hscore_store_compact() {
+	int lock_fd = open(HSCORE_LOCK_FILE, O_RDWR | O_CREAT, 0644);
+	if(lock_fd < 0) {
+		return false;
+	}
+
+	bool ok = false;
+	if(flock(lock_fd, LOCK_EX) == 0) {
+		ok = hscore_compact_locked();
+		flock(lock_fd, LOCK_UN);
+	}
+
+	close(lock_fd);
+	return ok;
+}
+
+bool hscore_store_append(const char *name, int score, hscore_append_stats *stats) {
+	hscore_entry entry;
+	strncpy(entry.name, name, MAX_NAME_SIZE);
+	entry.name[MAX_NAME_SIZE] = '\0';
+	entry.score = score;
+	entry.id = 0;
+
+	return hscore_store_append_batch(&entry, 1, stats);
+}
+
+bool hscore_store_append_batch(hscore_entry *entries, int count, hscore_append_stats *stats) {
+	hscore_append_stats ignored;
+	if(stats == NULL) {
+		stats = &ignored;
+	}
+	stats->lock_wait = 0;
+	stats->compacted = false;
+	stats->compact_time = 0;
+
+	if(count <= 0) {
+		return true;
+	}
+
+	// Format every record up front so the lock is held as briefly as possible
+	char *records = malloc(count * HSCORE_LINE_SIZE);
+	if(records == NULL) {
+		return false;
+	}
+	size_t length = 0;
+	for(int i=0; i<count; i++) {
+		if(entries[i].id == 0) {
+			entries[i].id = hscore_new_id();
+		}
+		length += snprintf(records + length, HSCORE_LINE_SIZE, "%.*s %d %llu\n", MAX_NAME_SIZE, entries[i].name, entries[i].score, entries[i].id);
+	}
+
+	int lock_fd = open(HSCORE_LOCK_FILE, O_RDWR | O_CREAT, 0644);
+	if(lock_fd < 0) {
+		free(records);
+		return false;
+	}
+
+	// Appenders only share the lock with each other. It only has to keep them out while a
+	// compaction is reading the log and replacing it
+	double wait_start = hscore_now();
+	if(flock(lock_fd, LOCK_SH) != 0) {
+		close(lock_fd);
+		free(records);
+		return false;
+	}
+	stats->lock_wait = hscore_now() - wait_start;
+
+	// The records are written with a single write so concurrent appends never interleave, and are
+	// only committed once they've reached the disk
+	bool ok = false;
+	bool needs_compaction = false;
+	int log_fd = open(HSCORE_LOG_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if(log_fd >= 0) {
+		ok = hscore_write_all(log_fd, records, length) && (fsync(log_fd) == 0);
+
+		struct stat log_stat;
+		if(ok && (fstat(log_fd, &log_stat) == 0)) {
+			needs_compaction = hscore_log_too_long(log_stat.st_size);
+		}
+		close(log_fd);
+	}
+	flock(lock_fd, LOCK_UN);
+	free(records);
+
+	// Only one of the writers that notices the log is too long needs to compact it, the others
+	// carry on without waiting
+	if(needs_compaction && (flock(lock_fd, LOCK_EX | LOCK_NB) == 0)) {
+		double compact_start = hscore_now();
+		struct stat log_stat;
+		if((stat(HSCORE_LOG_FILE, &log_stat) == 0) && hscore_log_too_long(log_stat.st_size)) {
+			stats->compacted = hscore_compact_locked();
+		}
+		stats->compact_time = hscore_now() - compact_start;
+		flock(lock_fd, LOCK_UN);
+	}
+
+	close(lock_fd);
+	return ok;
+}
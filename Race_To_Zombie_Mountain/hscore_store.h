@@ -0,0 +1,137 @@
+/**
+ * hscore_store.h
+ *
+ * Crash-safe storage for the highscore table that can be shared by many game instances running
+ * in the same directory.
+ *
+ * New scores are never written into the table directly. Each one is appended as a single line to
+ * an append-only log while holding a shared advisory lock on a lock file. Once the log grows past
+ * HSCORE_COMPACT_THRESHOLD records (or a fraction of the table, whichever is larger), whoever
+ * notices first takes the lock exclusively, merges the log into the sorted table and publishes
+ * both with an atomic rename. Readers take no lock at all, so they never block writers.
+ *
+ * Every score ever posted is kept; ranking them is left to hscore_index.h.
+ **/
+#ifndef HSCORE_STORE_H_
+#define HSCORE_STORE_H_
+
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+
+// The maximum number of highscores we'll display
+#define MAX_SCORES      100
+// The maximum size of names
+#define MAX_NAME_SIZE   12
+
+// The sorted highscore table. Only ever replaced through an atomic rename
+#define HSCORE_TABLE_FILE	"highscores"
+// The append-only log of scores that haven't been merged into the table yet
+#define HSCORE_LOG_FILE		"highscores.log"
+// The file the advisory locks are taken on (the table and log are replaced, so can't hold locks)
+#define HSCORE_LOCK_FILE	"highscores.lock"
+
+// The number of records the log may hold before it is compacted into the table
+#define HSCORE_COMPACT_THRESHOLD	64
+
+// The id of the score an empty table is seeded with. Every game that finds the table empty posts
+// it, and as they all post it under this id only one of them is ever kept
+#define HSCORE_SEED_ID	1
+
+/**
+ * A single score as stored in the table or the log. The id is unique to each posted score and is
+ * used to drop the duplicates a reader can see while a compaction is being published. Scores read
+ * from tables written before the log existed have an id of 0.
+ **/
+typedef struct hscore_entry {
+	char name[MAX_NAME_SIZE+1];
+	int score;
+	unsigned long long id;
+} hscore_entry;
+
+/**
+ * A growable list of entries read from the table and log
+ **/
+typedef struct hscore_list {
+	hscore_entry *entries;
+	int count;
+	int capacity;
+} hscore_list;
+
+/**
+ * Remembers which versions of the table and log were last read and how far into the log we got,
+ * so the next read only has to look at what was appended since. Zero it before the first use.
+ **/
+typedef struct hscore_reader {
+	bool loaded;
+	ino_t table_ino;
+	off_t table_size;
+	struct timespec table_mtime;
+	ino_t log_ino;
+	off_t log_offset;
+} hscore_reader;
+
+/**
+ * Information about a single append, used to measure lock contention
+ **/
+typedef struct hscore_append_stats {
+	// Seconds spent waiting for the shared lock before the record could be written
+	double lock_wait;
+	// True if this append triggered (and performed) a compaction
+	bool compacted;
+	// Seconds spent compacting, if a compaction happened
+	double compact_time;
+} hscore_append_stats;
+
+/**
+ * Reads the table and any scores still in the log, without taking a lock. Fills entries with at
+ * most max_entries scores sorted from highest to lowest and returns how many were read, or -1 if
+ * neither the table nor the log exist yet.
+ **/
+int hscore_store_load(hscore_entry *entries, int max_entries);
+
+/**
+ * Reads every score in the table and log into the list, sorted from the highest to the lowest,
+ * and records in reader (which may be NULL) where the reading stopped. Takes no lock. Returns
+ * false if neither the table nor the log exist yet.
+ **/
+bool hscore_store_read(hscore_reader *reader, hscore_list *list);
+
+/**
+ * Adds only the scores appended to the log since the last read to the list (unsorted). Returns
+ * false, adding nothing, if the files have been compacted since, in which case everything has to
+ * be read again with hscore_store_read.
+ **/
+bool hscore_store_read_new(hscore_reader *reader, hscore_list *list);
+
+/**
+ * Adds an entry to the end of a list, growing it if needed
+ **/
+bool hscore_list_add(hscore_list *list, const char *name, int score, unsigned long long id);
+
+/**
+ * Releases the memory held by a list and empties it
+ **/
+void hscore_list_free(hscore_list *list);
+
+/**
+ * Appends a score to the log, compacting the log into the table if it has grown too large. The
+ * stats pointer may be NULL. Returns false if the score could not be written.
+ **/
+bool hscore_store_append(const char *name, int score, hscore_append_stats *stats);
+
+/**
+ * Appends several scores to the log with a single write and a single fsync, so they are committed
+ * together. An entry with an id of 0 is given a new id, which is stored in the entry; any other id
+ * is kept. Otherwise behaves like hscore_store_append.
+ **/
+bool hscore_store_append_batch(hscore_entry *entries, int count, hscore_append_stats *stats);
+
+/**
+ * Merges the log into the sorted table and starts a new, empty log. Blocks until the exclusive lock
+ * is available. Returns false if the new table could not be written, in which case the old table
+ * and log are left untouched.
+ **/
+bool hscore_store_compact(void);
+
+#endif
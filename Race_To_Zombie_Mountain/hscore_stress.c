@@ -0,0 +1,352 @@
+/**
+ * hscore_stress.c
+ *
+ * Stress test for the highscore store. Forks many writer processes that post scores at the same
+ * time (as many game instances finishing together would) while a reader keeps loading the table,
+ * then checks that every score posted is kept exactly once and reports how much the writers had to
+ * wait on each other.
+ *
+ * Usage: hscore_stress [writers] [scores per writer]
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "hscore_store.h"
+
+// The defaults asked for when measuring contention
+#define DEFAULT_WRITERS		64
+#define DEFAULT_SCORES		200
+
+/**
+ * What each writer reports back to the parent through the results pipe
+ **/
+typedef struct writer_result {
+	int appended;
+	int failed;
+	int compactions;
+	double total_wait;
+	double max_wait;
+	double total_compact_time;
+} writer_result;
+
+/**
+ * What the reader reports back to the parent through the results pipe
+ **/
+typedef struct reader_result {
+	int loads;
+	int unsorted;
+	double max_load_time;
+} reader_result;
+
+/**
+ * Returns a monotonic time in seconds
+ **/
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+/**
+ * The score a writer posts at a given step. Deterministic so the parent can work out which
+ * scores should have made it into the table
+ **/
+int writer_score(int writer, int step) {
+	unsigned int x = (writer * 7919u) ^ (step * 104729u) ^ 0x9e3779b9u;
+	x ^= x >> 16;
+	x *= 0x45d9f3bu;
+	x ^= x >> 16;
+	return 1 + (x % 999999);
+}
+
+/**
+ * Waits for the parent to close the start pipe so every process begins at the same time
+ **/
+void wait_for_start(int start_fd) {
+	char ignored;
+	while(read(start_fd, &ignored, 1) > 0) { }
+}
+
+/**
+ * The file a writer leaves the ids of its scores in
+ **/
+void ids_file(int writer, char *path, size_t size) {
+	snprintf(path, size, "ids.%d", writer);
+}
+
+/**
+ * Body of a writer process. The id of each score it posts (or 0 where posting failed) is left in
+ * its ids file, so the parent can check each is kept exactly once
+ **/
+void run_writer(int writer, int num_scores, int start_fd, int result_fd) {
+	writer_result result;
+	memset(&result, 0, sizeof(result));
+	unsigned long long *ids = calloc(num_scores, sizeof(unsigned long long));
+
+	wait_for_start(start_fd);
+
+	for(int i=0; i<num_scores; i++) {
+		// Posted as a batch of one, so the score's id is handed back
+		hscore_entry entry;
+		memset(&entry, 0, sizeof(entry));
+		snprintf(entry.name, sizeof(entry.name), "w%d_%d", writer % 1000, i % 100000);
+		entry.score = writer_score(writer, i);
+
+		hscore_append_stats stats;
+		if(hscore_store_append_batch(&entry, 1, &stats)) {
+			result.appended++;
+			ids[i] = entry.id;
+		} else {
+			result.failed++;
+		}
+
+		result.total_wait += stats.lock_wait;
+		if(stats.lock_wait > result.max_wait) {
+			result.max_wait = stats.lock_wait;
+		}
+		if(stats.compacted) {
+			result.compactions++;
+			result.total_compact_time += stats.compact_time;
+		}
+	}
+
+	char path[32];
+	ids_file(writer, path, sizeof(path));
+	FILE *file = fopen(path, "w");
+	if(file != NULL) {
+		fwrite(ids, sizeof(unsigned long long), num_scores, file);
+		fclose(file);
+	}
+	free(ids);
+
+	write(result_fd, &result, sizeof(result));
+}
+
+/**
+ * Body of the reader process. Keeps loading the table until the stop pipe is closed, checking
+ * every load is sorted (a half-written table would not be)
+ **/
+void run_reader(int start_fd, int stop_fd, int result_fd) {
+	reader_result result;
+	memset(&result, 0, sizeof(result));
+	hscore_entry entries[MAX_SCORES];
+
+	wait_for_start(start_fd);
+	fcntl(stop_fd, F_SETFL, O_NONBLOCK);
+
+	char ignored;
+	while(read(stop_fd, &ignored, 1) != 0) {
+		double start = now();
+		int count = hscore_store_load(entries, MAX_SCORES);
+		double load_time = now() - start;
+
+		result.loads++;
+		if(load_time > result.max_load_time) {
+			result.max_load_time = load_time;
+		}
+		for(int i=1; i<count; i++) {
+			if(entries[i].score > entries[i-1].score) {
+				result.unsorted++;
+				break;
+			}
+		}
+	}
+
+	write(result_fd, &result, sizeof(result));
+}
+
+/**
+ * Orders scores from the highest to the lowest
+ **/
+int compare_scores(const void *a, const void *b) {
+	int score_a = *(const int *)a;
+	int score_b = *(const int *)b;
+	return (score_b > score_a) - (score_b < score_a);
+}
+
+/**
+ * Orders entries by id
+ **/
+int compare_ids(const void *a, const void *b) {
+	unsigned long long id_a = ((const hscore_entry *)a)->id;
+	unsigned long long id_b = ((const hscore_entry *)b)->id;
+	return (id_a > id_b) - (id_a < id_b);
+}
+
+/**
+ * Checks that every score the writers posted is in the store exactly once, under the id it was
+ * posted with. Returns the number of scores missing, kept with the wrong score, or kept that
+ * nobody posted
+ **/
+int check_ids(int num_writers, int num_scores) {
+	hscore_list list = { NULL, 0, 0 };
+	hscore_store_read(NULL, &list);
+	qsort(list.entries, list.count, sizeof(hscore_entry), compare_ids);
+
+	int problems = 0;
+	int found = 0;
+	unsigned long long *ids = malloc(num_scores * sizeof(unsigned long long));
+	for(int i=0; i<num_writers; i++) {
+		char path[32];
+		ids_file(i, path, sizeof(path));
+		FILE *file = fopen(path, "r");
+		if((file == NULL) || (fread(ids, sizeof(unsigned long long), num_scores, file) != (size_t)num_scores)) {
+			fprintf(stderr, "hscore_stress: lost writer %d's ids\n", i);
+			problems += num_scores;
+		} else {
+			for(int j=0; j<num_scores; j++) {
+				if(ids[j] == 0) {
+					continue;
+				}
+				hscore_entry key = { .id = ids[j] };
+				hscore_entry *kept = bsearch(&key, list.entries, list.count, sizeof(hscore_entry), compare_ids);
+				if((kept == NULL) || (kept->score != writer_score(i, j))) {
+					problems++;
+				} else {
+					found++;
+				}
+			}
+		}
+		if(file != NULL) {
+			fclose(file);
+		}
+		unlink(path);
+	}
+	free(ids);
+
+	// The ids are unique, so any other score was kept twice or never posted
+	problems += list.count - found;
+	hscore_list_free(&list);
+	return problems;
+}
+
+/**
+ * Removes the files the store creates so the temporary directory can be deleted
+ **/
+void remove_store_files() {
+	unlink(HSCORE_TABLE_FILE);
+	unlink(HSCORE_LOG_FILE);
+	unlink(HSCORE_LOCK_FILE);
+}
+
+int main(int argc, char *argv[]) {
+	int num_writers = (argc > 1) ? atoi(argv[1]) : DEFAULT_WRITERS;
+	int num_scores = (argc > 2) ? atoi(argv[2]) : DEFAULT_SCORES;
+	if((num_writers <= 0) || (num_scores <= 0)) {
+		fprintf(stderr, "usage: %s [writers] [scores per writer]\n", argv[0]);
+		return 2;
+	}
+
+	// Work in a fresh directory so we don't touch the real highscores
+	char dir[] = "/tmp/hscore_stress.XXXXXX";
+	if((mkdtemp(dir) == NULL) || (chdir(dir) != 0)) {
+		perror("hscore_stress");
+		return 2;
+	}
+
+	int start_pipe[2];
+	int stop_pipe[2];
+	int writer_pipe[2];
+	int reader_pipe[2];
+	if(pipe(start_pipe) || pipe(stop_pipe) || pipe(writer_pipe) || pipe(reader_pipe)) {
+		perror("hscore_stress");
+		return 2;
+	}
+
+	// Start the reader and all of the writers. They wait on the start pipe until all exist
+	if(fork() == 0) {
+		close(start_pipe[1]);
+		close(stop_pipe[1]);
+		run_reader(start_pipe[0], stop_pipe[0], reader_pipe[1]);
+		_exit(0);
+	}
+	for(int i=0; i<num_writers; i++) {
+		if(fork() == 0) {
+			close(start_pipe[1]);
+			close(stop_pipe[1]);
+			run_writer(i, num_scores, start_pipe[0], writer_pipe[1]);
+			_exit(0);
+		}
+	}
+
+	double start = now();
+	close(start_pipe[1]);
+
+	// Collect the writers' results
+	writer_result total;
+	memset(&total, 0, sizeof(total));
+	for(int i=0; i<num_writers; i++) {
+		writer_result result;
+		if(read(writer_pipe[0], &result, sizeof(result)) != sizeof(result)) {
+			fprintf(stderr, "hscore_stress: lost a writer's result\n");
+			return 2;
+		}
+		total.appended += result.appended;
+		total.failed += result.failed;
+		total.compactions += result.compactions;
+		total.total_wait += result.total_wait;
+		total.total_compact_time += result.total_compact_time;
+		if(result.max_wait > total.max_wait) {
+			total.max_wait = result.max_wait;
+		}
+	}
+	double elapsed = now() - start;
+
+	// Stop the reader
+	close(stop_pipe[1]);
+	reader_result reader;
+	memset(&reader, 0, sizeof(reader));
+	read(reader_pipe[0], &reader, sizeof(reader));
+	while(wait(NULL) > 0) { }
+
+	// Every score that should be in the top of the table
+	int num_posted = num_writers * num_scores;
+	int *expected = malloc(num_posted * sizeof(int));
+	for(int i=0; i<num_writers; i++) {
+		for(int j=0; j<num_scores; j++) {
+			expected[(i * num_scores) + j] = writer_score(i, j);
+		}
+	}
+	qsort(expected, num_posted, sizeof(int), compare_scores);
+
+	hscore_store_compact();
+	hscore_entry entries[MAX_SCORES];
+	int count = hscore_store_load(entries, MAX_SCORES);
+	int expected_count = (num_posted < MAX_SCORES) ? num_posted : MAX_SCORES;
+
+	int mismatches = (count == expected_count) ? 0 : 1;
+	for(int i=0; (i<count) && (i<expected_count); i++) {
+		if(entries[i].score != expected[i]) {
+			mismatches++;
+		}
+	}
+	free(expected);
+
+	int id_problems = check_ids(num_writers, num_scores);
+
+	remove_store_files();
+	chdir("/");
+	rmdir(dir);
+
+	printf("writers              %d\n", num_writers);
+	printf("scores per writer    %d\n", num_scores);
+	printf("appended             %d\n", total.appended);
+	printf("failed               %d\n", total.failed);
+	printf("elapsed              %.3f s\n", elapsed);
+	printf("appends per second   %.0f\n", total.appended / elapsed);
+	printf("mean lock wait       %.1f us\n", (total.total_wait / num_posted) * 1.0e6);
+	printf("max lock wait        %.1f us\n", total.max_wait * 1.0e6);
+	printf("compactions          %d\n", total.compactions);
+	printf("mean compaction      %.1f us\n", total.compactions ? (total.total_compact_time / total.compactions) * 1.0e6 : 0.0);
+	printf("reader loads         %d\n", reader.loads);
+	printf("reader max load      %.1f us\n", reader.max_load_time * 1.0e6);
+	printf("unsorted loads       %d\n", reader.unsorted);
+	printf("table mismatches     %d\n", mismatches);
+	printf("id mismatches        %d\n", id_problems);
+
+	return (total.failed || reader.unsorted || mismatches || id_problems) ? 1 : 0;
+}
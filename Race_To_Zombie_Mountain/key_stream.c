@@ -0,0 +1,219 @@
+/**
+ * key_stream.c
+ *
+ * Stamping keys as they arrive. See key_stream.h.
+ **/
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "key_stream.h"
+
+// The states of the thread's escape sequence reader: between keys, after an escape, inside a
+// sequence, and reading the three bytes of a mouse event
+#define KEY_PLAIN		0
+#define KEY_ESCAPE		1
+#define KEY_SEQUENCE	2
+#define KEY_MOUSE		3
+
+#define KEY_ESCAPE_BYTE	27
+
+double key_stream_now() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + (now.tv_nsec / 1e9);
+}
+
+/**
+ * Adds the stamp of a key to the queue. Only ever called from the thread
+ **/
+static void key_stream_push(key_stream *stream, double arrived) {
+	key_event_queue *queue = &stream->queue;
+	unsigned int tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	unsigned int next = (tail + 1) % KEY_QUEUE_SIZE;
+	if(next == __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) {
+		__atomic_add_fetch(&stream->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	queue->events[tail].id = stream->next_id++;
+	queue->events[tail].arrived = arrived;
+	// Publish the stamp before the game can see it
+	__atomic_store_n(&queue->tail, next, __ATOMIC_RELEASE);
+}
+
+bool key_stream_take(key_stream *stream, key_event *event) {
+	key_event_queue *queue = &stream->queue;
+	unsigned int head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	if(!stream->running || (head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE))) {
+		return false;
+	}
+
+	*event = queue->events[head];
+	__atomic_store_n(&queue->head, (head + 1) % KEY_QUEUE_SIZE, __ATOMIC_RELEASE);
+	return true;
+}
+
+/**
+ * Reads a byte from the terminal, stamping a key once it has all of its bytes
+ **/
+static void key_stream_read_byte(key_stream *stream, unsigned char byte, double arrived) {
+	switch(stream->state) {
+		case KEY_ESCAPE:
+			if((byte == '[') || (byte == 'O')) {
+				stream->state = KEY_SEQUENCE;
+				stream->remaining = 0;
+				return;
+			}
+			// Not a sequence, so the escape was a key of its own
+			key_stream_push(stream, stream->started);
+			stream->state = KEY_PLAIN;
+			break;
+		case KEY_SEQUENCE:
+			// A sequence ends with its first byte from @ to ~. A mouse event then has three more bytes
+			if((byte >= '@') && (byte <= '~')) {
+				if((byte == 'M') && (stream->remaining == 0)) {
+					stream->state = KEY_MOUSE;
+					stream->remaining = 3;
+				} else {
+					key_stream_push(stream, stream->started);
+					stream->state = KEY_PLAIN;
+				}
+			} else {
+				stream->remaining++;
+			}
+			return;
+		case KEY_MOUSE:
+			if(--stream->remaining == 0) {
+				key_stream_push(stream, stream->started);
+				stream->state = KEY_PLAIN;
+			}
+			return;
+		default:
+			break;
+	}
+
+	if(byte == KEY_ESCAPE_BYTE) {
+		stream->state = KEY_ESCAPE;
+		stream->started = arrived;
+	} else {
+		key_stream_push(stream, arrived);
+	}
+}
+
+/**
+ * Body of the thread. Stamps every key as it arrives, then passes it on to curses
+ **/
+static void *key_stream_run(void *argument) {
+	key_stream *stream = argument;
+	struct pollfd waiting[2];
+	waiting[0].fd = stream->terminal;
+	waiting[0].events = POLLIN;
+	waiting[1].fd = stream->wake[0];
+	waiting[1].events = POLLIN;
+
+	unsigned char bytes[64];
+	while(true) {
+		if(poll(waiting, 2, -1) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if(waiting[1].revents != 0) {
+			break;
+		}
+
+		ssize_t length = read(stream->terminal, bytes, sizeof(bytes));
+		if(length < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			break;
+		} else if(length == 0) {
+			break;
+		}
+
+		double arrived = key_stream_now();
+		for(ssize_t i=0; i<length; i++) {
+			key_stream_read_byte(stream, bytes[i], arrived);
+		}
+		// An escape at the end of what arrived at once was pressed on its own
+		if(stream->state == KEY_ESCAPE) {
+			key_stream_push(stream, stream->started);
+			stream->state = KEY_PLAIN;
+		}
+
+		// Only pass the keys on once they are stamped, so the game never reads a key without one
+		for(ssize_t written=0; written<length; ) {
+			ssize_t count = write(stream->output, bytes + written, length - written);
+			if(count < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				return NULL;
+			}
+			written += count;
+		}
+	}
+
+	return NULL;
+}
+
+bool key_stream_start(key_stream *stream) {
+	memset(stream, 0, sizeof(key_stream));
+
+	int channel[2];
+	if(pipe(channel) != 0) {
+		return false;
+	}
+	if(pipe(stream->wake) != 0) {
+		close(channel[0]);
+		close(channel[1]);
+		return false;
+	}
+
+	// Curses reads from the standard input, so put the pipe in its place
+	stream->terminal = dup(STDIN_FILENO);
+	stream->output = channel[1];
+	if((stream->terminal < 0) || (dup2(channel[0], STDIN_FILENO) < 0)) {
+		close(channel[0]);
+		close(channel[1]);
+		close(stream->wake[0]);
+		close(stream->wake[1]);
+		if(stream->terminal >= 0) {
+			close(stream->terminal);
+		}
+		return false;
+	}
+	close(channel[0]);
+
+	stream->running = true;
+	if(pthread_create(&stream->thread, NULL, key_stream_run, stream) != 0) {
+		stream->running = false;
+		dup2(stream->terminal, STDIN_FILENO);
+		close(stream->terminal);
+		close(stream->output);
+		close(stream->wake[0]);
+		close(stream->wake[1]);
+		return false;
+	}
+	return true;
+}
+
+void key_stream_stop(key_stream *stream) {
+	if(!stream->running) {
+		return;
+	}
+
+	while((write(stream->wake[1], "", 1) < 0) && (errno == EINTR)) { }
+	pthread_join(stream->thread, NULL);
+	stream->running = false;
+
+	dup2(stream->terminal, STDIN_FILENO);
+	close(stream->terminal);
+	close(stream->output);
+	close(stream->wake[0]);
+	close(stream->wake[1]);
+}
@@ -0,0 +1,83 @@
+/**
+ * key_stream.h
+ *
+ * Notes when each key arrives from the keyboard, so the time until the game shows its effect can be
+ * measured.
+ *
+ * A background thread takes over reading the terminal. Every key it reads is stamped with the time
+ * it arrived and numbered, and the stamp is passed to the game through a lock-free single producer,
+ * single consumer queue. The key itself is passed on to curses through a pipe put in place of the
+ * standard input, so curses reads and decodes keys just as it did before, and the game takes one
+ * stamp from the queue for every key curses gives it. The thread splits what it reads into keys
+ * the same way curses does: an escape sequence (such as an arrow key) is one key.
+ **/
+#ifndef KEY_STREAM_H_
+#define KEY_STREAM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// The number of stamps the queue holds (one less than this can be waiting at once)
+#define KEY_QUEUE_SIZE	256
+
+/**
+ * When a key arrived
+ **/
+typedef struct key_event {
+	uint32_t id;
+	double arrived;
+} key_event;
+
+/**
+ * A lock-free queue of stamps with one thread adding to it and one taking from it
+ **/
+typedef struct key_event_queue {
+	key_event events[KEY_QUEUE_SIZE];
+	unsigned int head;
+	unsigned int tail;
+} key_event_queue;
+
+/**
+ * The state of a key stream
+ **/
+typedef struct key_stream {
+	pthread_t thread;
+	bool running;
+	// The terminal the thread reads from, the pipe it passes keys on to curses through, and a pipe
+	// that wakes the thread to stop it
+	int terminal;
+	int output;
+	int wake[2];
+	key_event_queue queue;
+	// How far through an escape sequence the thread is, and when the sequence started
+	int state;
+	int remaining;
+	double started;
+	uint32_t next_id;
+	// The keys that had no room in the queue
+	uint32_t dropped;
+} key_stream;
+
+/**
+ * Starts reading the keyboard in the background. Must be called after the screen has been set up.
+ * Returns false (with the keyboard read as before) if the thread couldn't be started.
+ **/
+bool key_stream_start(key_stream *stream);
+
+/**
+ * Takes the stamp of the next key. Returns false if there is none.
+ **/
+bool key_stream_take(key_stream *stream, key_event *event);
+
+/**
+ * Stops the thread and gives the keyboard back to the standard input.
+ **/
+void key_stream_stop(key_stream *stream);
+
+/**
+ * The time that stamps are given in, in seconds.
+ **/
+double key_stream_now();
+
+#endif
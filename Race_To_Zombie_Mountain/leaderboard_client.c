@@ -0,0 +1,154 @@
+/**
+ * leaderboard_client.c
+ *
+ * Client for the local leaderboard daemon. See leaderboard_proto.h for the protocol.
+ **/
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "leaderboard_client.h"
+
+// The connection to the daemon, or -1 if we aren't connected
+static int lb_fd = -1;
+// The sequence number of the last request sent, used to match up responses
+static uint32_t lb_seq = 0;
+
+bool lb_connect() {
+	if(lb_fd >= 0) {
+		return true;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if(fd < 0) {
+		return false;
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, LB_SOCKET_FILE, sizeof(address.sun_path) - 1);
+
+	if(connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+		close(fd);
+		return false;
+	}
+
+	// Don't let a stuck daemon freeze the game
+	struct timeval timeout = { 0, LB_TIMEOUT_MS * 1000 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	lb_fd = fd;
+	return true;
+}
+
+void lb_disconnect() {
+	if(lb_fd >= 0) {
+		close(lb_fd);
+		lb_fd = -1;
+	}
+}
+
+/**
+ * Sends a request and waits for its response. Any failure drops the connection so the next call
+ * tries to reconnect (or the caller falls back to the files)
+ **/
+static bool lb_call(lb_request *request, lb_response *response) {
+	if(!lb_connect()) {
+		return false;
+	}
+
+	request->seq = ++lb_seq;
+	if(send(lb_fd, request, sizeof(lb_request), MSG_NOSIGNAL) != sizeof(lb_request)) {
+		lb_disconnect();
+		return false;
+	}
+
+	// Skip answers to earlier requests we gave up waiting for
+	while(true) {
+		ssize_t length = recv(lb_fd, response, sizeof(lb_response), 0);
+		if((length < (ssize_t)LB_RESPONSE_SIZE(0)) || (length != (ssize_t)LB_RESPONSE_SIZE(response->count))) {
+			lb_disconnect();
+			return false;
+		}
+		if(response->seq == request->seq) {
+			return response->status == LB_OK;
+		}
+	}
+}
+
+bool lb_submit(const char *name, int score, int *rank, int *total) {
+	lb_request request;
+	memset(&request, 0, sizeof(request));
+	request.op = LB_OP_SUBMIT;
+	request.score = score;
+	// The name fills its field, so it is only terminated if it is shorter
+	memcpy(request.name, name, strnlen(name, MAX_NAME_SIZE));
+
+	lb_response response;
+	if(!lb_call(&request, &response)) {
+		return false;
+	}
+
+	if(rank != NULL) {
+		*rank = response.rank;
+	}
+	if(total != NULL) {
+		*total = response.total;
+	}
+	return true;
+}
+
+bool lb_top(int offset, int max_entries, hscore_entry *entries, int *count) {
+	*count = 0;
+
+	while(*count < max_entries) {
+		int wanted = max_entries - *count;
+
+		lb_request request;
+		memset(&request, 0, sizeof(request));
+		request.op = LB_OP_TOP;
+		request.offset = offset + *count;
+		request.count = (wanted < LB_MAX_PAGE) ? wanted : LB_MAX_PAGE;
+
+		lb_response response;
+		if(!lb_call(&request, &response)) {
+			return false;
+		}
+
+		// Never take more entries than were asked for, whatever the daemon says it sent
+		int returned = (response.count < request.count) ? response.count : request.count;
+		for(int i=0; i<returned; i++) {
+			hscore_entry *entry = &entries[(*count)++];
+			memcpy(entry->name, response.entries[i].name, MAX_NAME_SIZE);
+			entry->name[MAX_NAME_SIZE] = '\0';
+			entry->score = response.entries[i].score;
+			entry->id = 0;
+		}
+
+		// A short page means we've reached the end of the table
+		if(returned < request.count) {
+			break;
+		}
+	}
+
+	return true;
+}
+
+bool lb_rank(int score, int *rank, int *total) {
+	lb_request request;
+	memset(&request, 0, sizeof(request));
+	request.op = LB_OP_RANK;
+	request.score = score;
+
+	lb_response response;
+	if(!lb_call(&request, &response)) {
+		return false;
+	}
+
+	*rank = response.rank;
+	*total = response.total;
+	return true;
+}
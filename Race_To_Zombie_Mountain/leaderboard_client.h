@@ -0,0 +1,44 @@
+/**
+ * leaderboard_client.h
+ *
+ * The game's side of the leaderboard daemon protocol. Every function returns false if the daemon
+ * isn't running or doesn't answer in time, in which case the caller should use the highscore
+ * files directly instead.
+ **/
+#ifndef LEADERBOARD_CLIENT_H_
+#define LEADERBOARD_CLIENT_H_
+
+#include <stdbool.h>
+#include "leaderboard_proto.h"
+
+// How long we wait for the daemon to answer before giving up on it
+#define LB_TIMEOUT_MS	200
+
+/**
+ * Connects to the daemon if it is running. Safe to call when already connected.
+ **/
+bool lb_connect(void);
+
+/**
+ * Closes the connection to the daemon, if any.
+ **/
+void lb_disconnect(void);
+
+/**
+ * Posts a score. On success the rank it was given and the number of scores held by the daemon
+ * are stored through rank and total (either may be NULL).
+ **/
+bool lb_submit(const char *name, int score, int *rank, int *total);
+
+/**
+ * Fetches up to max_entries entries starting at offset, paging through the daemon's table as
+ * needed. Returns the number of entries read through count.
+ **/
+bool lb_top(int offset, int max_entries, hscore_entry *entries, int *count);
+
+/**
+ * Gets the rank a score would be given and the number of scores held, without posting it.
+ **/
+bool lb_rank(int score, int *rank, int *total);
+
+#endif
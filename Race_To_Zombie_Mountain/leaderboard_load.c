@@ -0,0 +1,227 @@
+/**
+ * leaderboard_load.c
+ *
+ * Load test for the leaderboard daemon. Starts a daemon in a scratch directory, then has many
+ * clients hammer it with a mix of score submissions, top-N page requests and rank queries, each
+ * client waiting for every answer before sending its next request. Reports the throughput and the
+ * latency distribution of the requests.
+ *
+ * Usage: leaderboard_load [clients] [seconds] [path to leaderboardd]
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "leaderboard_proto.h"
+
+#define DEFAULT_CLIENTS		32
+#define DEFAULT_SECONDS		5
+#define DEFAULT_DAEMON		"./leaderboardd"
+
+/**
+ * The work done by one client thread
+ **/
+typedef struct client {
+	pthread_t thread;
+	int index;
+	double deadline;
+	// Latency of every request, in seconds
+	double *latencies;
+	int count;
+	int capacity;
+	int failed;
+} client;
+
+/**
+ * Returns a monotonic time in seconds
+ **/
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+/**
+ * Connects to the daemon's socket in the current directory
+ **/
+int connect_daemon() {
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if(fd < 0) {
+		return -1;
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, LB_SOCKET_FILE, sizeof(address.sun_path) - 1);
+
+	if(connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Body of a client thread. One request in ten posts a score; the rest are split between reading
+ * a page of the table and asking for a rank, as the game does
+ **/
+void *run_client(void *argument) {
+	client *c = argument;
+	int fd = connect_daemon();
+	if(fd < 0) {
+		c->failed++;
+		return NULL;
+	}
+
+	unsigned int seed = c->index + 1;
+	lb_request request;
+	lb_response response;
+	memset(&request, 0, sizeof(request));
+
+	for(uint32_t seq = 1; now() < c->deadline; seq++) {
+		request.seq = seq;
+		request.score = 1 + (rand_r(&seed) % 999999);
+		if(seq % 10 == 0) {
+			request.op = LB_OP_SUBMIT;
+			snprintf(request.name, MAX_NAME_SIZE, "load%d", c->index % 10000);
+		} else if(seq % 2 == 0) {
+			request.op = LB_OP_TOP;
+			request.offset = rand_r(&seed) % MAX_SCORES;
+			request.count = 20;
+		} else {
+			request.op = LB_OP_RANK;
+		}
+
+		double start = now();
+		if((send(fd, &request, sizeof(request), MSG_NOSIGNAL) != sizeof(request)) || (recv(fd, &response, sizeof(response), 0) <= 0) || (response.seq != seq)) {
+			c->failed++;
+			break;
+		}
+		double latency = now() - start;
+
+		if(c->count == c->capacity) {
+			c->capacity = (c->capacity == 0) ? 4096 : (c->capacity * 2);
+			c->latencies = realloc(c->latencies, c->capacity * sizeof(double));
+		}
+		c->latencies[c->count++] = latency;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Removes the files the daemon creates so the temporary directory can be deleted
+ **/
+void remove_store_files() {
+	unlink(HSCORE_TABLE_FILE);
+	unlink(HSCORE_LOG_FILE);
+	unlink(HSCORE_LOCK_FILE);
+	unlink(LB_SOCKET_FILE);
+}
+
+int main(int argc, char *argv[]) {
+	int num_clients = (argc > 1) ? atoi(argv[1]) : DEFAULT_CLIENTS;
+	double seconds = (argc > 2) ? atof(argv[2]) : DEFAULT_SECONDS;
+	const char *daemon_path = (argc > 3) ? argv[3] : DEFAULT_DAEMON;
+	if((num_clients <= 0) || (seconds <= 0)) {
+		fprintf(stderr, "usage: %s [clients] [seconds] [path to leaderboardd]\n", argv[0]);
+		return 2;
+	}
+
+	char daemon[4096];
+	if(realpath(daemon_path, daemon) == NULL) {
+		perror("leaderboard_load");
+		return 2;
+	}
+
+	// Run the daemon in a fresh directory so we don't touch the real highscores
+	char dir[] = "/tmp/leaderboard_load.XXXXXX";
+	if((mkdtemp(dir) == NULL) || (chdir(dir) != 0)) {
+		perror("leaderboard_load");
+		return 2;
+	}
+
+	pid_t daemon_pid = fork();
+	if(daemon_pid == 0) {
+		execl(daemon, daemon, dir, (char *)NULL);
+		perror("leaderboard_load: exec");
+		_exit(2);
+	}
+
+	// Wait for the daemon to start listening
+	int probe = -1;
+	for(int i=0; (i<200) && (probe < 0); i++) {
+		probe = connect_daemon();
+		if(probe < 0) {
+			usleep(10000);
+		}
+	}
+	if(probe < 0) {
+		fprintf(stderr, "leaderboard_load: the daemon didn't start\n");
+		kill(daemon_pid, SIGTERM);
+		return 2;
+	}
+	close(probe);
+
+	client *clients = calloc(num_clients, sizeof(client));
+	double start = now();
+	for(int i=0; i<num_clients; i++) {
+		clients[i].index = i;
+		clients[i].deadline = start + seconds;
+		pthread_create(&clients[i].thread, NULL, run_client, &clients[i]);
+	}
+
+	int total = 0;
+	int failed = 0;
+	for(int i=0; i<num_clients; i++) {
+		pthread_join(clients[i].thread, NULL);
+		total += clients[i].count;
+		failed += clients[i].failed;
+	}
+	double elapsed = now() - start;
+
+	kill(daemon_pid, SIGTERM);
+	waitpid(daemon_pid, NULL, 0);
+	remove_store_files();
+	chdir("/");
+	rmdir(dir);
+
+	// Merge every client's latencies to find the percentiles
+	double *latencies = malloc((total + 1) * sizeof(double));
+	int merged = 0;
+	for(int i=0; i<num_clients; i++) {
+		memcpy(latencies + merged, clients[i].latencies, clients[i].count * sizeof(double));
+		merged += clients[i].count;
+		free(clients[i].latencies);
+	}
+	free(clients);
+	qsort(latencies, total, sizeof(double), compare_doubles);
+
+	printf("clients              %d\n", num_clients);
+	printf("requests             %d\n", total);
+	printf("failed               %d\n", failed);
+	printf("elapsed              %.3f s\n", elapsed);
+	printf("requests per second  %.0f\n", total / elapsed);
+	if(total > 0) {
+		printf("p50 latency          %.1f us\n", latencies[total / 2] * 1.0e6);
+		printf("p99 latency          %.1f us\n", latencies[(int)(total * 0.99)] * 1.0e6);
+		printf("max latency          %.1f us\n", latencies[total - 1] * 1.0e6);
+	}
+	free(latencies);
+
+	return failed ? 1 : 0;
+}
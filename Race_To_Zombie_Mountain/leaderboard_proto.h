@@ -0,0 +1,82 @@
+/**
+ * leaderboard_proto.h
+ *
+ * The binary protocol spoken between the game and the local leaderboard daemon (leaderboardd)
+ * over a Unix domain socket. The socket is a SOCK_SEQPACKET one, so every request and every
+ * response is exactly one message and no extra framing is needed.
+ *
+ * All fields are in the host's byte order, as both ends always run on the same machine.
+ **/
+#ifndef LEADERBOARD_PROTO_H_
+#define LEADERBOARD_PROTO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hscore_store.h"
+
+// The socket lives next to the highscore files, so games sharing a directory share a daemon
+#define LB_SOCKET_FILE	"highscores.sock"
+
+// The most entries a single response can carry
+#define LB_MAX_PAGE		32
+
+/**
+ * The requests a client can make
+ **/
+enum lb_op {
+	// Post a new score. Answers with the rank the score was given
+	LB_OP_SUBMIT = 1,
+	// Get up to count entries of the table starting at offset (0 is the highest score)
+	LB_OP_TOP = 2,
+	// Get the rank a score would have, without posting it
+	LB_OP_RANK = 3
+};
+
+/**
+ * The status of a response
+ **/
+enum lb_status {
+	LB_OK = 0,
+	LB_BAD_REQUEST = 1,
+	LB_FAILED = 2
+};
+
+/**
+ * A request. The name is padded with '\0' and is only terminated if shorter than MAX_NAME_SIZE
+ **/
+typedef struct lb_request {
+	uint32_t seq;
+	uint8_t op;
+	uint8_t count;
+	uint16_t reserved;
+	int32_t score;
+	int32_t offset;
+	char name[MAX_NAME_SIZE];
+} lb_request;
+
+/**
+ * A single entry of the table as sent over the socket
+ **/
+typedef struct lb_entry {
+	char name[MAX_NAME_SIZE];
+	int32_t score;
+} lb_entry;
+
+/**
+ * A response. For LB_OP_TOP, count entries follow; otherwise count is 0. The rank is 1-based
+ * and total is the number of scores the daemon holds
+ **/
+typedef struct lb_response {
+	uint32_t seq;
+	uint8_t status;
+	uint8_t count;
+	uint16_t reserved;
+	int32_t rank;
+	int32_t total;
+	lb_entry entries[LB_MAX_PAGE];
+} lb_response;
+
+// The size of a response carrying count entries
+#define LB_RESPONSE_SIZE(count)	(offsetof(lb_response, entries) + ((count) * sizeof(lb_entry)))
+
+#endif
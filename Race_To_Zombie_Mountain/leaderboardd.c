@@ -0,0 +1,307 @@
+/**
+ * leaderboardd.c
+ *
+ * Optional local leaderboard daemon. Keeps every highscore ranked in memory and answers the games in
+ * the same directory over a Unix domain socket (see leaderboard_proto.h), so they don't each have
+ * to parse and append to the highscore files.
+ *
+ * Requests from every client that are ready at the same time are handled as one batch: all of
+ * the batch's new scores are committed to the highscore log with a single write and a single fsync
+ * before any of them are answered (group commit).
+ *
+ * Usage: leaderboardd [directory]
+ **/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "hscore_store.h"
+#include "hscore_index.h"
+#include "leaderboard_proto.h"
+
+// The most requests handled in a single batch
+#define LB_MAX_BATCH	256
+// The most events taken from epoll at once
+#define LB_MAX_EVENTS	64
+// The most milliseconds between bringing the table up to date with the scores the games append
+// to the highscore files themselves (when the daemon wasn't running for them)
+#define LB_SYNC_INTERVAL	1000
+
+/**
+ * A request waiting to be answered, along with the client that sent it
+ **/
+typedef struct lb_pending {
+	int fd;
+	lb_request request;
+} lb_pending;
+
+// Every score posted, ranked from the highest to the lowest
+hscore_index table;
+
+// Set by the signal handler to stop the daemon
+volatile sig_atomic_t running = 1;
+
+// Counters reported when the daemon exits
+long long total_requests;
+long long total_batches;
+long long total_commits;
+
+void stop_handler(int signal_code) {
+	running = 0;
+}
+
+/**
+ * Creates the listening socket, replacing a stale one left behind by a daemon that crashed.
+ * Returns -1 if another daemon is already serving this directory
+ **/
+int open_listener() {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, LB_SOCKET_FILE, sizeof(address.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0);
+	if(fd < 0) {
+		return -1;
+	}
+
+	if(bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+		// Only take over the socket if nobody is answering on it
+		int probe = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+		bool alive = (probe >= 0) && (connect(probe, (struct sockaddr *)&address, sizeof(address)) == 0);
+		if(probe >= 0) {
+			close(probe);
+		}
+		if(alive) {
+			fprintf(stderr, "leaderboardd: another daemon is already running\n");
+			close(fd);
+			return -1;
+		}
+
+		unlink(LB_SOCKET_FILE);
+		if(bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+			perror("leaderboardd: bind");
+			close(fd);
+			return -1;
+		}
+	}
+
+	if(listen(fd, SOMAXCONN) != 0) {
+		perror("leaderboardd: listen");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * Returns true if a client's name is one the game's name box could have typed: 1 to MAX_NAME_SIZE
+ * printable characters without spaces, as the highscore files store it as a single word
+ **/
+bool valid_name(const char *name) {
+	size_t length = strnlen(name, MAX_NAME_SIZE);
+	if(length == 0) {
+		return false;
+	}
+	for(size_t i=0; i<length; i++) {
+		if((name[i] <= ' ') || (name[i] >= 127)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Commits the batch's new scores to the highscore log together, reads them back into the table
+ * once they are committed and then answers every request in the batch
+ **/
+void process_batch(lb_pending *batch, int count) {
+	if(count == 0) {
+		return;
+	}
+
+	lb_response responses[LB_MAX_BATCH];
+	hscore_entry commits[LB_MAX_BATCH];
+	// The request each commit came from
+	int committed_by[LB_MAX_BATCH];
+	int num_commits = 0;
+
+	for(int i=0; i<count; i++) {
+		lb_request *request = &batch[i].request;
+		lb_response *response = &responses[i];
+
+		response->seq = request->seq;
+		response->status = LB_OK;
+		response->count = 0;
+		response->reserved = 0;
+		response->rank = 0;
+
+		switch(request->op) {
+			case LB_OP_SUBMIT:
+				if((request->score <= 0) || !valid_name(request->name)) {
+					response->status = LB_BAD_REQUEST;
+					break;
+				}
+				// The name fills its field if it is as long as it can be, so it is terminated here
+				memset(commits[num_commits].name, 0, sizeof(commits[num_commits].name));
+				memcpy(commits[num_commits].name, request->name, strnlen(request->name, MAX_NAME_SIZE));
+				commits[num_commits].score = request->score;
+				commits[num_commits].id = 0;
+				committed_by[num_commits] = i;
+				num_commits++;
+				break;
+			case LB_OP_TOP:
+				if((request->offset < 0) || (request->count > LB_MAX_PAGE)) {
+					response->status = LB_BAD_REQUEST;
+					break;
+				}
+				hscore_entry page[LB_MAX_PAGE];
+				response->count = hscore_index_page(&table, request->offset + 1, request->count, page);
+				for(int j=0; j<response->count; j++) {
+					memcpy(response->entries[j].name, page[j].name, MAX_NAME_SIZE);
+					response->entries[j].score = page[j].score;
+				}
+				response->rank = request->offset + 1;
+				break;
+			case LB_OP_RANK:
+				response->rank = hscore_index_rank(&table, request->score);
+				break;
+			default:
+				response->status = LB_BAD_REQUEST;
+				break;
+		}
+		response->total = table.count;
+	}
+
+	// Group commit: every score in this batch goes to disk in one write. A score only joins the
+	// table once it is on disk, so one that failed isn't ranked as if it had been kept. The table
+	// reads the scores back from the log like any others, so they are only ever added once
+	if(num_commits > 0) {
+		total_commits++;
+		bool committed = hscore_store_append_batch(commits, num_commits, NULL);
+		if(committed) {
+			hscore_index_sync(&table);
+		}
+		for(int i=0; i<num_commits; i++) {
+			lb_response *response = &responses[committed_by[i]];
+			if(committed) {
+				response->rank = hscore_index_find(&table, commits[i].score, commits[i].id);
+			} else {
+				response->status = LB_FAILED;
+			}
+		}
+		for(int i=0; i<count; i++) {
+			responses[i].total = table.count;
+		}
+	}
+
+	for(int i=0; i<count; i++) {
+		if(batch[i].fd >= 0) {
+			// A client that isn't reading its answers just times out; we never block on it
+			send(batch[i].fd, &responses[i], LB_RESPONSE_SIZE(responses[i].count), MSG_DONTWAIT | MSG_NOSIGNAL);
+		}
+	}
+
+	total_requests += count;
+	total_batches++;
+}
+
+int main(int argc, char *argv[]) {
+	if((argc > 1) && (chdir(argv[1]) != 0)) {
+		perror("leaderboardd");
+		return 1;
+	}
+
+	// Stop cleanly (so the socket is removed) when asked to
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stop_handler;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	// Load the table the games have been writing while we weren't running
+	if(!hscore_index_init(&table)) {
+		fprintf(stderr, "leaderboardd: out of memory\n");
+		return 1;
+	}
+	hscore_index_sync(&table);
+
+	int listener = open_listener();
+	if(listener < 0) {
+		return 1;
+	}
+
+	int epoll_fd = epoll_create1(0);
+	struct epoll_event event = { .events = EPOLLIN, .data.fd = listener };
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener, &event);
+
+	lb_pending batch[LB_MAX_BATCH];
+	int closed[LB_MAX_EVENTS];
+
+	while(running) {
+		struct epoll_event events[LB_MAX_EVENTS];
+		int num_events = epoll_wait(epoll_fd, events, LB_MAX_EVENTS, LB_SYNC_INTERVAL);
+		if(num_events < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		// Pick up the scores games appended while the daemon wasn't running for them, before
+		// answering anything with the table
+		hscore_index_sync(&table);
+
+		int batch_count = 0;
+		int num_closed = 0;
+		for(int i=0; i<num_events; i++) {
+			int fd = events[i].data.fd;
+
+			if(fd == listener) {
+				int client;
+				while((client = accept4(listener, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+					struct epoll_event client_event = { .events = EPOLLIN, .data.fd = client };
+					epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client, &client_event);
+				}
+				continue;
+			}
+
+			// Take every request this client has waiting. Anything left over once the batch is full
+			// is picked up on the next pass, as epoll keeps reporting the socket as readable
+			while(batch_count < LB_MAX_BATCH) {
+				ssize_t length = recv(fd, &batch[batch_count].request, sizeof(lb_request), 0);
+				if(length == sizeof(lb_request)) {
+					batch[batch_count++].fd = fd;
+				} else if((length < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+					break;
+				} else if(length < 0 || length == 0) {
+					closed[num_closed++] = fd;
+					break;
+				}
+				// Ignore messages of the wrong size
+			}
+		}
+
+		process_batch(batch, batch_count);
+
+		for(int i=0; i<num_closed; i++) {
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, closed[i], NULL);
+			close(closed[i]);
+		}
+	}
+
+	close(listener);
+	unlink(LB_SOCKET_FILE);
+	hscore_store_compact();
+	hscore_index_free(&table);
+
+	fprintf(stderr, "leaderboardd: %lld requests in %lld batches, %lld group commits\n", total_requests, total_batches, total_commits);
+	return 0;
+}
@@ -1,9 +1,39 @@
 /** ---------------------------- INCLUDES ----------------------------- **/
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <malloc.h>
+#include <limits.h>
+#include <curses.h>
 #include "cab202_graphics.h"
 #include "cab202_timers.h"
 #include "cab202_sprites.h"
+#include "cab202_alloc.h"
+#include "cab202_output.h"
+#include "hscore_store.h"
+#include "hscore_index.h"
+#include "leaderboard_client.h"
+#include "run_history.h"
+#include "text_input.h"
+#include "world.h"
+#include "world_gen.h"
+#include "world_stream.h"
+#include "track.h"
+#include "arena.h"
+#include "rewind.h"
+#include "ghost.h"
+#include "key_stream.h"
+#include "histogram.h"
+#include "profiler.h"
+#include "trace.h"
+#include "alloc_stats.h"
+#include "golden.h"
+#include "renderer.h"
+#include "frame_pacer.h"
+#include "spectate.h"
 
 /** ----------------------------- GLOBALS ----------------------------- **/
 // Define the border character as a full stop (.)
@@ -27,6 +57,10 @@
 #define INPUT_MOVE_RIGHT	'd'
 #define INPUT_ACCELERATE	'w'		
 #define INPUT_DECELERATE	's'
+#define INPUT_SAVE_QUIT		'q'
+#define INPUT_RESUME		'r'
+#define INPUT_REWIND		'b'
+#define INPUT_PROFILE		'o'
 
 // Define the player car's details
 #define PLAYER_WIDTH	8
@@ -37,13 +71,13 @@
 #define HAZARD      1
 
 // The types of terrain
-#define NUM_TERRAIN_TYPES	3
+#define NUM_TERRAIN_TYPES	WORLD_TERRAIN_TYPES
 #define TERRAIN_BOULDER		0
 #define TERRAIN_TREE 		1
 #define TERRAIN_GRAVE		2
 
 // The types of hazards
-#define NUM_HAZARD_TYPES	2
+#define NUM_HAZARD_TYPES	WORLD_HAZARD_TYPES
 #define HAZARD_SPIKES		0
 #define HAZARD_TRIANGLE		1
 
@@ -63,13 +97,57 @@
 // the more frequent a fuel station will appear)
 #define FUEL_STATION_VARIANCE	15
 
+// The average number of obstacles for every 100 cells of the verges and of the road
+#define TERRAIN_DENSITY	1.4
+#define HAZARD_DENSITY	0.4
+// The fewest empty cells between any two obstacles
+#define OBSTACLE_GAP	1
+
 // The distance to the finish line (the number that appears in the distance stat is 1/5 of this one)
 #define FINISH_LINE_DIST	500
 
-// The maximum number of highscores we'll display
-#define MAX_SCORES      100
-// The maximum size of names
-#define MAX_NAME_SIZE   12
+// Where the rows of the world come from. A normal race generates them as they are needed, an 
+// endurance race generates them ahead of time in the background and an authored track reads them 
+// from a track file
+#define WORLD_PROCEDURAL	0
+#define WORLD_ENDURANCE		1
+#define WORLD_TRACK			2
+// How often (in rows) the memory holding the rows of a track that have scrolled past is given back
+#define TRACK_RELEASE_ROWS	256
+
+// The size of the blocks the memory for each game is taken from (one block holds a whole game)
+#define SESSION_ARENA_SIZE	(64 * 1024)
+
+// The file a race is saved to when the player quits in the middle of it
+#define SNAPSHOT_FILE		"race.snapshot"
+// For this long (in seconds) after a race couldn't be saved, pressing quit again quits without it
+#define UNSAVED_QUIT_TIME	3.0
+// Identifies a snapshot, and the version of its layout
+#define SNAPSHOT_MAGIC		0x50535a52
+#define SNAPSHOT_VERSION	1
+
+// A practice race keeps the snapshots of its last minute of frames in a fixed amount of memory, with a
+// whole snapshot every REWIND_KEYFRAME_FRAMES frames. Each press of the rewind key goes back 3 seconds
+#define REWIND_BUDGET			(1024 * 1024)
+#define REWIND_FRAMES			(60 * 1000 / LOOP_INTERVAL)
+#define REWIND_KEYFRAME_FRAMES	120
+#define REWIND_STEP_FRAMES		(3 * 1000 / LOOP_INTERVAL)
+
+// The screen sizes the benchmarks run on, how long each one runs for (in seconds) at least, and the
+// world they run on
+#define NUM_BENCH_SIZES	5
+#define BENCH_TIME		0.05
+#define BENCH_SEED		1
+
+// When a golden-frame run starts on its virtual clock
+#define GOLDEN_START_TIME	1000.0
+
+// Where the ghosts of every world are kept, and what a ghost car is drawn with
+#define GHOST_DIR	"ghosts"
+#define GHOST_CHAR	':'
+
+// The most keys handled in a frame. Any more are left for the next frame
+#define INPUT_BUDGET	64
 
 // The speed of the player. This controls how long it takes for 
 int speed;
@@ -96,9 +174,104 @@ bool refuelling;
 // A timer that is used to verify if the car remained next to a fuel station long enough to refuel
 timer_id refuel_timer;
 
+// Everything a single game needs (its sprites, timers and arrays) is allocated from here, and it is
+// all released at once when the next game starts
+arena session;
+// Whether the next game should carry on from the saved race instead of starting a new one
+bool resuming;
+
+// Whether races can be rewound. Practice races don't count towards the highscores
+bool practice;
+// The history of a practice race, and room to take a snapshot of it in
+rewind_buffer history;
+char *history_frame;
+
+// The seed of the world the current race is on, and whether it was chosen by the player
+unsigned int race_seed;
+bool fixed_seed;
+// The name of the track being raced, without its directory or extension
+char track_name[NAME_MAX + 1];
+// The best earlier run on this world, and the trace of this run
+ghost rival;
+ghost_recorder run_trace;
+// Whether this run is being recorded, and the rows of the world it had travelled at the last frame
+bool recording_ghost;
+int traced_rows;
+
 // Checks if the game was over because of a loss instead of a win
 bool game_over_loss;
 
+// When the player last tried to quit a race that couldn't be saved
+double unsaved_quit_time;
+
+/**
+ * How long things took, in seconds
+ **/
+typedef struct latency_stats {
+	int count;
+	double total;
+	double max;
+	double last;
+} latency_stats;
+
+// When the screen last changed, and the same on the key stream's clock
+double transition_time;
+double transition_stamp;
+// When the last key read arrived on the key stream's clock, or -1 if it wasn't stamped
+double key_arrived = -1;
+// Whether the screen has changed since it was last drawn, and how long changes took to be drawn
+bool transition_pending;
+latency_stats transition_latency;
+// Whether to report how long things took when the game exits
+bool show_metrics;
+
+/**
+ * How many keys were waiting each frame of a race
+ **/
+typedef struct input_stats {
+	int frames;
+	int keys;
+	int last_depth;
+	int max_depth;
+	// Frames that took all INPUT_BUDGET keys they could, so may have left more waiting
+	int at_budget;
+} input_stats;
+input_stats input_queue;
+
+// Stamps each key with when it arrived, the keys read in this frame, and how long keys took to show
+key_stream keyboard;
+key_event frame_keys[INPUT_BUDGET];
+int num_frame_keys;
+histogram input_latency;
+
+// The allocations made in the last frame, and whether a race is stopped if it allocates
+uint64_t frame_allocations;
+bool check_allocations;
+
+// Draws frames on its own thread, so drawing them doesn't hold up the game. Frames are only drawn 
+// in the loop when asked for, or when there is no screen. Either way they are written to the 
+// terminal behind the game, by the ZDK
+renderer screen_renderer;
+bool serial_drawing;
+bool pipelined;
+
+// Drops frames while the terminal can't take them all, and keeps the dashboard to show again in 
+// the frames it isn't redrawn in
+frame_pacer pacer;
+bool pacing;
+char *dashboard_cells;
+int dashboard_rows;
+int dashboard_saved;
+
+// Publishes every frame drawn for spectators to watch
+spectate spectators;
+bool spectated;
+
+#ifdef PROFILE
+// Whether the last second's frame times are shown over the game
+bool show_profile;
+#endif
+
 /**
  * Holds information regarding what screen the player should be seeing right now. The state should
  * only be changed through the function change_state()
@@ -124,18 +297,44 @@ sprite_id finish_line;
 int road_length;
 // Decides if the odd or even on the y coord road sections will contain a middle stripe
 bool even_stripe;
+// The number of rows of the world held in the road arrays (the rows on screen and the rows just 
+// above it). Each row is stored at its row number modulo this
+int road_rows;
 // The array which will hold all of the road sections
 int *road;
 // The array which will hold the x coordinate of the road sections
 int *road_x_coords;
 
+// Where the rows of the world come from (WORLD_PROCEDURAL, WORLD_ENDURANCE or WORLD_TRACK)
+int world_mode = WORLD_PROCEDURAL;
+// The length of an endurance race, in rows
+int endurance_rows;
+// The authored track being raced on
+track race_track;
+// Generates the rows of the world
+world_gen world_generator;
+// Runs the generator in the background for endurance races
+world_stream endurance_stream;
+// Whether the current endurance race is generated in the background, and the number of endurance 
+// races that had to be generated as they were driven instead, as the background thread couldn't start
+bool endurance_streaming;
+int endurance_unstreamed;
+// The number of rows that have scrolled into the world so far
+int world_rows;
+// The last row of the world, which is repeated if an endurance race ever outruns its generator
+world_row last_row;
+
 // The maximum number of terrain obstacles that can appear at once
 int max_terrain_obs;
+// The number of terrain obstacles in play (they are at the start of the array)
+int num_terrain;
 // An array which contains all of the terrain obstacles
 sprite_id *terrain;
 
 // The maximum number of hazards that can appear at once
 int max_hazards;
+// The number of hazards in play (they are at the start of the array)
+int num_hazards;
 // An array which contains all of the hazard obstacles
 sprite_id *hazards;
 
@@ -155,10 +354,39 @@ int car_condition;
 // The score the player has achieved
 int score;
 
-// The names of the top 100 highscore players
-char hscore_names[MAX_SCORES][MAX_NAME_SIZE+1];
-// The score of the top 100 highscore players
-int hscore_scores[MAX_SCORES];
+// Every highscore ever posted, ranked. Only kept up to date when the leaderboard daemon isn't running
+hscore_index hscores;
+// The game master on its own, the score to beat until a highscore has been saved. Built once
+hscore_index hscore_fallback;
+// Whichever of the two the highscores are ranked against
+hscore_index *hscore_table = &hscores;
+// Whether the leaderboard daemon answered when the highscores were last read
+bool hscore_daemon;
+// The number of highscores the leaderboard daemon holds
+int hscore_daemon_total;
+// Whether any highscores had been saved when the table was last read
+bool hscore_saved;
+// Whether the player's score made it into the top MAX_SCORES. Worked out once when the game ends
+bool new_hscore;
+// The name the player is typing in for their highscore
+text_input name_input;
+
+// The number of obstacles the player has crashed into this game
+int collisions;
+// How the last finished run compares with every run before it
+run_percentiles run_stats;
+// The rank the player's score was given when it was saved (0 if it wasn't saved) and the number
+// of scores it was ranked against
+int player_rank;
+int ranked_total;
+
+// The rank of the first highscore shown on the highscore screen
+int hscore_first_rank;
+// The highscores currently on the highscore screen, and the rank of the first of them (0 if the
+// page needs to be fetched again)
+hscore_entry hscore_page[MAX_SCORES];
+int hscore_page_count;
+int hscore_page_rank;
 
 /** ------------------------ FUNCTION VARIABLES ------------------------ **/
 
@@ -173,9 +401,24 @@ bool check_collision(sprite_id sprite);
 bool check_sprite_collided(sprite_id sprite1, sprite_id sprite2);
 
 /**
- * Sorts the scores by placing the highest score at the top and the lowest at the bottom
+ * Updates the score based on the distance travelled, car condition and time
  **/
-void sort_scores();
+void update_score();
+
+/**
+ * Step the terrain so that it scrolls and take it out of play when it goes out of bounds
+ **/
+void update_terrain();
+
+/**
+ * Step the hazards so that it scrolls and take them out of play when they go out of bounds
+ **/
+void update_hazards();
+
+/**
+ * Step through all terrain and road hazards, scrolling the next row of the world in above them
+ **/
+void update_obs();
 
 /** ------------------------- IMAGE MANAGER --------------------------- **/
 /**
@@ -325,347 +568,395 @@ char* get_finish_line_image() {
     return image;
 }
 
+/** ---------------------------- SESSION ------------------------------ **/
+/**
+ * Creates a sprite that lasts until the next game starts
+ **/
+sprite_id session_sprite(double x, double y, int width, int height, char *image) {
+	sprite_id sprite = arena_alloc(&session, sizeof(Sprite));
+	sprite_init(sprite, x, y, width, height, image);
+	return sprite;
+}
+
+/**
+ * Creates a timer that lasts until the next game starts
+ **/
+timer_id session_timer(long milliseconds) {
+	timer_id timer = arena_alloc(&session, sizeof(cab202_timer_t));
+	timer->milliseconds = milliseconds;
+	timer_reset(timer);
+	return timer;
+}
+
 /** --------------------------- OBSTACLES ----------------------------- **/
 /**
- * Moves a terrain to the top of the screen and changes the terrain type
+ * Gets the x coordinate of the left edge of the road at the start of a race
  **/
-void terrain_reset(int index) {
-	// Choose a new terrain
-	int id = rand() % NUM_TERRAIN_TYPES;
-	int width = 0;
-	int height = 0;
-	char* image = get_image(id, TERRAIN, &width, &height);
-
-	// Check if we'll place the terrain on the left or right side of the road
-	bool left = rand() % 2;
-	int x = -1;
-	if(left) {
-		int min_x = DASHBOARD_SIZE + 1;
-		int max_x = road_x_coords[0] - width - 1;
-		x = rand() % (max_x + 1 - min_x) + min_x;
-	} else {
-		int min_x = road_x_coords[0] + ROAD_WIDTH + 1;
-		int max_x = screen_width() - 2 - width;
-		x = rand() % (max_x + 1 - min_x) + min_x;
-	}
+int road_left() {
+	return (screen_width() - ROAD_WIDTH - 1 + DASHBOARD_SIZE) * 0.5;
+}
 
-	// Place the terrain above the screen a random amount
-	int y = 0 - height - (rand() % 60);
+/**
+ * Gets the index in the road arrays of the row of the world at the given y coordinate. The newest 
+ * row has its bottom edge just above the top of the screen
+ **/
+int road_index(int y) {
+	int row = world_rows - 2 - y;
+	return ((row % road_rows) + road_rows) % road_rows;
+}
 
-	// Create a temporary sprite of the new terrain to check for collision
-	sprite_id temp_sprite = sprite_create(x, y, width, height, image);
-	// We won't reset the terrain unless there will be no collision
-	if(!check_collision(temp_sprite)) {
-		// Reset the terrain
-		terrain[index]->x = x;
-		terrain[index]->y = y;
-		terrain[index]->width = width;
-		terrain[index]->height = height;
-		sprite_set_image(terrain[index], image);
-		sprite_turn_to(terrain[index],0,1);
-	}
-	sprite_destroy(temp_sprite);
+/**
+ * Gets the x coordinate of the left edge of the road at the given y coordinate
+ **/
+int road_x_at(int y) {
+	return road_x_coords[road_index(y)];
 }
 
 /**
- * Moves a hazard to the top of the screen and changes the hazard type
+ * Gets the type of road section at the given y coordinate
  **/
-void hazard_reset(int index) {
-	// Choose the type of hazard to place
-	int id = rand() % NUM_HAZARD_TYPES;
-	int width = 0;
-	int height = 0;
-	char* image = get_image(id, HAZARD, &width, &height);
+int road_type_at(int y) {
+	return road[road_index(y)];
+}
 
-	// Move the hazard above the screen a random amount
-	int y = 0 - height - (rand() % 30);
+/**
+ * Describes the game to the world generator
+ **/
+void get_world_config(world_gen_config *config) {
+	int station_width = 0;
+	int station_height = 0;
+	get_fuel_station_image(&station_width, &station_height);
+
+	memset(config, 0, sizeof(world_gen_config));
+	config->min_x = DASHBOARD_SIZE + 1;
+	config->max_x = screen_width() - 1;
+	config->road_width = ROAD_WIDTH;
+	config->road_x = road_left();
+	world_row first_row;
+	if((world_mode == WORLD_TRACK) && track_read_row(&race_track, 0, &first_row)) {
+		config->road_x = first_row.road_x;
+	}
+	config->view_rows = road_length;
+	config->race_rows = (world_mode == WORLD_ENDURANCE) ? endurance_rows : FINISH_LINE_DIST;
+	// Keep the road clear in front of the player (the first rows fill the screen from the bottom)
+	config->safe_rows = road_length + 2 - (road_length / 2);
+	config->bends = (world_mode == WORLD_ENDURANCE);
+	config->terrain_density = TERRAIN_DENSITY;
+	config->hazard_density = HAZARD_DENSITY;
+	config->gap = OBSTACLE_GAP;
+	config->num_terrain_types = NUM_TERRAIN_TYPES;
+	config->terrain_widths = terrain_width;
+	config->terrain_heights = terrain_height;
+	config->num_hazard_types = NUM_HAZARD_TYPES;
+	config->hazard_widths = hazards_width;
+	config->hazard_heights = hazards_height;
+	config->station_width = station_width;
+	config->station_height = station_height;
+	config->station_delay = FUEL_STATION_DELAY_DIST;
+	config->station_variance = FUEL_STATION_VARIANCE;
+	config->seed = race_seed;
+}
+
+/**
+ * Stops generating the world of the last race
+ **/
+void stop_world() {
+	world_stream_stop(&endurance_stream);
+	world_gen_free(&world_generator);
+}
+
+/**
+ * Starts generating the world of a new race. If the background thread of an endurance race can't 
+ * be started, the rows of that race are generated as they are needed instead, and the next race
+ * tries to start it again
+ **/
+void setup_world() {
+	stop_world();
+	if(!fixed_seed) {
+		race_seed = rand();
+	}
 
-	// Choose a x coordinate between the road limits
-	int min_x = road_x_coords[0] + 1;
-	int max_x = road_x_coords[0] + ROAD_WIDTH - 1 - width;
-	int x = rand() % (max_x + 1 - min_x) + min_x;
+	world_gen_config config;
+	get_world_config(&config);
+	if(world_mode == WORLD_TRACK) {
+		track_rewind(&race_track);
+	} else if(!world_gen_init(&world_generator, &config)) {
+		// Without a generator there is no world to race on
+		trace_stop();
+		renderer_stop(&screen_renderer);
+		spectate_stop(&spectators);
+		key_stream_stop(&keyboard);
+		cleanup_screen();
+		fprintf(stderr, "out of memory for the world generator\n");
+		exit(1);
+	}
+	endurance_streaming = (world_mode == WORLD_ENDURANCE) && world_stream_start(&endurance_stream, &world_generator);
+	if((world_mode == WORLD_ENDURANCE) && !endurance_streaming) {
+		endurance_unstreamed++;
+	}
 
-	// Create a temporary sprite of the new hazard to check for collision
-	sprite_id temp_sprite = sprite_create(x, y, width, height, image);
-	if(!check_collision(temp_sprite)) {
-		// Reset the hazard
-		hazards[index]->x = x;
-		hazards[index]->y = y;
-		hazards[index]->width = width;
-		hazards[index]->height = height;
-		sprite_set_image(hazards[index], image);
-		sprite_turn_to(hazards[index], 0, 1);
+	world_rows = 0;
+	memset(&last_row, 0, sizeof(world_row));
+	for(int i=0; i<road_rows; i++) {
+		road[i] = ROAD_STRAIGHT;
+		road_x_coords[i] = config.road_x;
 	}
-	sprite_destroy(temp_sprite);
 }
 
 /**
- * Creates a piece of terrain at a valid location (anywhere outside the road)
+ * Gets the next row of the world. An endurance race never waits for its generator: if the row 
+ * isn't ready yet, the road carries on as it was. So does the road past the end of a track
  **/
-void terrain_create(int index) {
-	// Choose the type of terrain to place
-	int id = rand() % NUM_TERRAIN_TYPES;
-	int width = 0;
-	int height = 0;
-	char* image = get_image(id, TERRAIN, &width, &height);
-	
-	int min_y = 0 - (rand()%screen_height());
-	int max_y = screen_height() - height - 2;
-	int y = (rand()%(max_y + 1 - min_y)) + min_y;
-
-    // Check if we'll place the terrain on the left or right side of the road
-    bool left = rand() % 2;
-    int x = -1;
-    if(left) {
-        int min_x = DASHBOARD_SIZE + 1;
-        int max_x = road_x_coords[0] - width - 1;
-        x = rand() % (max_x + 1 - min_x) + min_x;
-    } else {
-        int min_x = road_x_coords[0] + ROAD_WIDTH + 1;
-        int max_x = screen_width() - 2 - width;
-        x = rand() % (max_x + 1 - min_x) + min_x;
-    }
+void next_world_row(world_row *row) {
+	bool ready = true;
+	if(endurance_streaming) {
+		ready = world_stream_next_row(&endurance_stream, row);
+	} else if(world_mode == WORLD_TRACK) {
+		ready = track_read_row(&race_track, world_rows, row);
+		if((world_rows % TRACK_RELEASE_ROWS) == 0) {
+			track_release(&race_track, world_rows - road_rows);
+		}
+	} else {
+		world_gen_row(&world_generator, row);
+	}
 
-    // Create the sprite of the terrain
-    terrain[index] = sprite_create(x, y, width, height, image);
-    sprite_turn_to(terrain[index], 0, 1);
+	if(!ready) {
+		*row = last_row;
+		row->num_obstacles = 0;
+		row->flags = 0;
+	}
+	last_row = *row;
 }
 
 /**
- * Creates a piece of hazard anywhere on the road
+ * Puts an obstacle into play, with its bottom edge just above the top of the screen
  **/
-void hazard_create(int index) {
-	// Choose the type of hazard to place
-	int id = rand() % NUM_HAZARD_TYPES;
+void spawn_obstacle(world_obstacle *placed) {
+	sprite_id obstacle;
 	int width = 0;
 	int height = 0;
-	char* image = get_image(id, HAZARD, &width, &height);
+	char *image = get_image(placed->type, placed->kind, &width, &height);
 
-    // Randomly get a x-y coordinate 
-	int y = (rand()%((screen_height()/2)-height)) + 2;
-    int min_x = road_x_coords[y] + 1;
-    int max_x = road_x_coords[y] + ROAD_WIDTH - 1 - width;
-    int x = rand() % (max_x + 1 - min_x) + min_x;
+	if(placed->kind == HAZARD) {
+		if(num_hazards == max_hazards) {
+			return;
+		}
+		obstacle = hazards[num_hazards++];
+	} else {
+		if(num_terrain == max_terrain_obs) {
+			return;
+		}
+		obstacle = terrain[num_terrain++];
+	}
 
-    // Create the hazard sprite
-    hazards[index] = sprite_create(x, y, width, height, image);
-    sprite_turn_to(hazards[index], 0, 1);
+	obstacle->x = placed->x;
+	obstacle->y = 0 - height;
+	obstacle->width = width;
+	obstacle->height = height;
+	sprite_set_image(obstacle, image);
+	sprite_turn_to(obstacle, 0, 1);
 }
 
 /**
- * Creates all terrain that will appear on the game screen
+ * Moves the fuel station to the given side of the road (WORLD_FUEL_LEFT or WORLD_FUEL_RIGHT), with 
+ * its bottom edge just above the top of the screen
  **/
-void setup_terrain() {
-    // Create all of the terrain obstacles 
-	for(int i=0; i<max_terrain_obs; i++) {
-		terrain_create(i);
+void place_fuel_station(int side, int road_x) {
+	int x;
+	if(side == WORLD_FUEL_LEFT) {
+		x = road_x - sprite_width(fuel_station);
+	} else {
+		x = road_x + ROAD_WIDTH + 1;
 	}
 
-    // Reset all of the terrain obstacles so that they don't collide
-    bool collided = true;
-	while(collided) {
-		collided = false;
-		for(int i=0; i<max_terrain_obs; i++) {
-			if(check_collision(terrain[i])) {
-				collided = true;
-				terrain_reset(i);
-			}
-		}
-	}
+	sprite_move_to(fuel_station, x, 0 - sprite_height(fuel_station));
 }
 
 /**
- * Creates all hazards that will appear on the game screen
+ * Moves the finish line to just above the top of the screen and shows it
  **/
-void setup_hazards() {
-	for(int i=0; i<max_hazards; i++) {
-		hazard_create(i);
-	}
+void place_finish_line(int road_x) {
+	sprite_move_to(finish_line, road_x, -1);
+	sprite_show(finish_line);
+}
 
-	// Reset all of the hazard obstacles so that they don't collide
-    bool collided = true;
-	while(collided) {
-		collided = false;
-		for(int i=0; i<max_hazards; i++) {
-			if(check_collision(hazards[i])) {
-				collided = true;
-				hazard_reset(i);
-			}
-		}
+/**
+ * Scrolls the next row of the world in just above the top of the screen
+ **/
+void scroll_world() {
+	world_row row;
+	next_world_row(&row);
+
+	road[world_rows % road_rows] = row.road_type;
+	road_x_coords[world_rows % road_rows] = row.road_x;
+	world_rows++;
+
+	for(int i=0; i<row.num_obstacles; i++) {
+		spawn_obstacle(&row.obstacles[i]);
 	}
+	if(row.flags & (WORLD_FUEL_LEFT | WORLD_FUEL_RIGHT)) {
+		place_fuel_station(row.flags & (WORLD_FUEL_LEFT | WORLD_FUEL_RIGHT), row.road_x);
+	}
+	if(row.flags & WORLD_FINISH) {
+		place_finish_line(row.road_x);
+	}
+}
+
+/**
+ * Takes a terrain out of play by swapping it with the last one in play
+ **/
+void remove_terrain(int index) {
+	num_terrain--;
+	sprite_id removed = terrain[index];
+	terrain[index] = terrain[num_terrain];
+	terrain[num_terrain] = removed;
+}
+
+/**
+ * Takes a hazard out of play by swapping it with the last one in play
+ **/
+void remove_hazard(int index) {
+	num_hazards--;
+	sprite_id removed = hazards[index];
+	hazards[index] = hazards[num_hazards];
+	hazards[num_hazards] = removed;
 }
 
 /**
- * Create the fuel station sprite. Will choose a random side of the road and make it appear a 
- * random distance above the screen
+ * Create the fuel station sprite. It waits below the screen until the world places it
  **/
 void setup_fuel_station() {
 	int station_width = 0;
 	int station_height = 0;
 	char* station_image = get_fuel_station_image(&station_width, &station_height);
 
-	// Put the fuel station a random distance above the screen
-	int y = 0 - station_height - FUEL_STATION_DELAY_DIST - (rand() % FUEL_STATION_VARIANCE);
-
-	// Choose the side of the road
-	int x;
-	bool left = rand() % 2;
-	if(left) {
-		x = road_x_coords[0] - station_width;
-	} else {
-		x = road_x_coords[0] + ROAD_WIDTH + 1;
-	}
-
-	fuel_station = sprite_create(x, y, station_width, station_height, station_image);
+	fuel_station = session_sprite(0, screen_height() + 1, station_width, station_height, station_image);
 	sprite_turn_to(fuel_station, 0, 1);
 }
 
 /**
- * Create a finish line a certain distance above the screen
+ * Create the finish line. It stays hidden until the world places it
  **/
 void setup_finish_line() {
 	int width = ROAD_WIDTH + 1;
 	char* image = get_finish_line_image();
 
-	// Set a certain distance above the screen
-	int y = 0 - FINISH_LINE_DIST;
-
-	finish_line = sprite_create(road_x_coords[0], y, width, 1, image);
+	finish_line = session_sprite(0, screen_height() + 1, width, 1, image);
 	sprite_turn_to(finish_line, 0, 1);
+	sprite_hide(finish_line);
 }
 
 /**
- * Create a road section of a certain type at the specified location
+ * Create the arrays that hold the road and every terrain and hazard sprite
  **/
-void add_road_section(int x, int y, int type) {
-	road[y - 1] = type;
-	road_x_coords[y - 1] = x;
-}
+void setup_obstacle_arrays() {
+	road = arena_alloc(&session, road_rows * sizeof(int));
+	road_x_coords = arena_alloc(&session, road_rows * sizeof(int));
 
-/**
- * Decides on the width and length of the road and adds the proper graphics to the array which
- * holds the road information
- **/
-void setup_road() {
-    even_stripe = true;
-    int road_x = ((screen_width() - ROAD_WIDTH - 1 + DASHBOARD_SIZE) * 0.5);
+	hazards = arena_alloc(&session, max_hazards * sizeof(sprite_id));
+	for(int i=0; i<max_hazards; i++) {
+		hazards[i] = session_sprite(0, 0, hazards_width[0], hazards_height[0], hazards_image[0]);
+	}
 
-	// Build the individual road sections
-	for(int i=0; i<road_length; i++) {
-		add_road_section(road_x, i + 1, ROAD_STRAIGHT);
+	terrain = arena_alloc(&session, max_terrain_obs * sizeof(sprite_id));
+	for(int i=0; i<max_terrain_obs; i++) {
+		terrain[i] = session_sprite(0, 0, terrain_width[0], terrain_height[0], terrain_image[0]);
 	}
 }
 
 /**
- * Initializes all of the required arrays and create the terrain, road hazards, 
- * fuel station and road
+ * Starts a new world and scrolls its rows down the screen until the first one reaches the bottom
  **/
 void setup_obs() {
-    setup_road();
+    even_stripe = true;
+	setup_obstacle_arrays();
+	num_terrain = 0;
+	num_hazards = 0;
 	setup_fuel_station();
-	setup_terrain();
-	setup_hazards();
     setup_finish_line();
+
+	setup_world();
+	for(int i=0; i<road_length+2; i++) {
+		update_obs();
+	}
 }
 
 /**
- * Allocate the required memory and create arrays which will hold all of our obstacles
+ * Decide on the size of the arrays which will hold the road and all of our obstacles
  **/
 void init_obs() {
+    // Init road
+    road_length = screen_height() - 2;	// There should be borders at the top and bottom of the screen
+	road_rows = road_length + 3;
+
+	// The generator knows how many obstacles can fit on the screen (plus the rows just above it)
+	world_gen_config config;
+	get_world_config(&config);
+	int rows = screen_height() + 1;
+	// A track knows its most obstacles in TRACK_WINDOW_ROWS rows, and a taller screen spans several
+	// such windows
+	int windows = (rows + TRACK_WINDOW_ROWS - 1) / TRACK_WINDOW_ROWS;
+
     // Init Hazards
     // Decide on maximum number of terrain obstacles that can appear
-	max_hazards = 3;
-	hazards = malloc(max_hazards * sizeof(sprite_id));
+	max_hazards = world_gen_capacity(&config, WORLD_HAZARD, rows);
+	if((world_mode == WORLD_TRACK) && ((int)race_track.header->max_hazards * windows > max_hazards)) {
+		max_hazards = race_track.header->max_hazards * windows;
+	}
 
     // Init Terrain
     // Decide on maximum number of terrain obstacles that can appear
-	max_terrain_obs = 14 + ((screen_width()-80)/5) + ((screen_height()-24)/5);
-	terrain = malloc(max_terrain_obs * sizeof(sprite_id));
-
-    // Init road
-    road_length = screen_height() - 2;	// There should be borders at the top and bottom of the screen
-	road = malloc(road_length * sizeof(int));
-	road_x_coords = malloc(road_length * sizeof(int));
+	max_terrain_obs = world_gen_capacity(&config, WORLD_TERRAIN, rows);
+	if((world_mode == WORLD_TRACK) && ((int)race_track.header->max_terrain * windows > max_terrain_obs)) {
+		max_terrain_obs = race_track.header->max_terrain * windows;
+	}
 }
 
 /**
- * Step the terrain so that it scrolls and create new terrain when the old one goes out of bounds
+ * Step the terrain so that it scrolls and take it out of play when it goes out of bounds
  **/
 void update_terrain() {
-	for(int i=0; i<max_terrain_obs; i++) {
+	// Go backwards so the terrain swapped in by a removal has already been stepped
+	for(int i=num_terrain-1; i>=0; i--) {
 		sprite_step(terrain[i]);
 
 		// Check if any terrain went out of bounds
 		if(sprite_y(terrain[i]) > screen_height()) {
-			// Create a new terrain 
-			terrain_reset(i);
+			remove_terrain(i);
 		}
 	}
 }
 
 /**
- * Step the hazards so that it scrolls and create new hazards when the old one goes out of bounds
+ * Step the hazards so that it scrolls and take them out of play when they go out of bounds
  **/
 void update_hazards() {
-	for(int i=0; i<max_hazards; i++) {
+	for(int i=num_hazards-1; i>=0; i--) {
 		sprite_step(hazards[i]);
 
 		// Check if any hazard went out of bounds
 		if(sprite_y(hazards[i]) > screen_height()) {
-			// Create a new hazard
-			hazard_reset(i);
+			remove_hazard(i);
 		}
 	}
 }
 
 /**
- * Check if the fuel station has gone off limits and resets it to the appropritate location 
- **/
-void update_fuel_station() {
-	sprite_step(fuel_station);
-
-	// Check if the fuel station went out of bounds
-	if(sprite_y(fuel_station) > screen_height()) {
-		// Reset the fuel station to a location above the screen
-		int y = 0 - sprite_height(fuel_station) - FUEL_STATION_DELAY_DIST - (rand() % FUEL_STATION_VARIANCE);
-
-		// Choose the side of the road
-		int x;
-		bool left = rand() % 2;
-		if(left) {
-			x = road_x_coords[0] - sprite_width(fuel_station);
-		} else {
-			x = road_x_coords[0] + ROAD_WIDTH + 1;
-		}
-
-		// Move the fuel station to the new location
-		sprite_move_to(fuel_station, x, y);
-
-		// Reset any terrain that might be on the way
-		for(int i=0; i<max_terrain_obs; i++) {
-			if(check_sprite_collided(fuel_station, terrain[i])) {
-				terrain_reset(i);
-			}
-		}
-	}
-}
-
-/**
- * Step through all terrain and road hazards, making sure to wrap any that go 
- * out of bounds to the top of the screen
+ * Step through all terrain and road hazards, scrolling the next row of the world in above them
  **/
 void update_obs() {
-    update_fuel_station();
+    sprite_step(fuel_station);
     sprite_step(finish_line);
     update_terrain();
     update_hazards();
+    scroll_world();
 }
 
 /**
  * Draw all of the terrain sprites
  **/
 void draw_terrain() {
-	for(int i=0; i<max_terrain_obs; i++) {
+	for(int i=0; i<num_terrain; i++) {
 		sprite_draw(terrain[i]);
 	}
 }
@@ -674,7 +965,7 @@ void draw_terrain() {
  * Draw all of the hazard sprites
  **/
 void draw_hazards() {
-	for(int i=0; i<max_hazards; i++) {
+	for(int i=0; i<num_hazards; i++) {
 		sprite_draw(hazards[i]);
 	}
 }
@@ -685,12 +976,14 @@ void draw_hazards() {
  **/
 void draw_road() {
 	for(int i=0; i<road_length; i++) {
-		draw_char(road_x_coords[i], i + 1, get_road_image(road[i]));
-		draw_char(road_x_coords[i] + ROAD_WIDTH, i + 1, get_road_image(road[i]));
+		int road_x = road_x_at(i + 1);
+		char road_image = get_road_image(road_type_at(i + 1));
+		draw_char(road_x, i + 1, road_image);
+		draw_char(road_x + ROAD_WIDTH, i + 1, road_image);
 		if(((i+1) % 2 == 0) && (even_stripe)) {
-			draw_char(road_x_coords[i] + (ROAD_WIDTH * 0.5), i + 1, get_road_image(road[i]));
+			draw_char(road_x + (ROAD_WIDTH * 0.5), i + 1, road_image);
 		} else if(((i+1) % 2 != 0) && !even_stripe) {
-			draw_char(road_x_coords[i] + (ROAD_WIDTH * 0.5), i + 1, get_road_image(road[i]));
+			draw_char(road_x + (ROAD_WIDTH * 0.5), i + 1, road_image);
 		}
 	}
 }
@@ -729,7 +1022,7 @@ bool check_sprite_collided(sprite_id sprite1, sprite_id sprite2) {
  **/
 bool check_collision(sprite_id sprite) {
 	// Iterate through the terrain to see if there was a collision
-	for(int i=0; i<max_terrain_obs; i++) {
+	for(int i=0; i<num_terrain; i++) {
 		// We don't want to check if it is colliding with itself
 		if(!sprites_equal(sprite, terrain[i])) {
 			if(check_sprite_collided(sprite,terrain[i])) {
@@ -739,7 +1032,7 @@ bool check_collision(sprite_id sprite) {
 	}
 
 	// Iterate through the hazards to see if there was a collision
-	for(int i=0; i<max_hazards; i++) {
+	for(int i=0; i<num_hazards; i++) {
 		// We don't want to check if it is colliding with itself
 		if(!sprites_equal(sprite, hazards[i])) {
 			if(check_sprite_collided(sprite,hazards[i])) {
@@ -758,95 +1051,189 @@ bool check_collision(sprite_id sprite) {
 
 /** -------------------------- HIGH SCORE ----------------------------- **/
 /**
- * Gets all recorded highscores in our highscore file and writes them to the proper arrays
- * Reference used: https://www.cs.bu.edu/teaching/c/file-io/intro/
+ * Gets all recorded highscores. They come from the leaderboard daemon if it is running, otherwise
+ * our index is brought up to date with the highscore files (only the scores posted since the last
+ * time are read, unless the files were compacted in the meantime)
  **/
 void get_hscores() {
-    FILE *hscore_file = fopen("highscores", "r");
+    int rank;
+    hscore_daemon = lb_connect() && lb_rank(1, &rank, &hscore_daemon_total);
 
-    // Fill the whole scores table with 0s
-    for(int i=0; i<MAX_SCORES; i++) {
-        hscore_scores[i] = 0;
-    }
-
-    // We only want the top 100 scores, so don't record anything else if we're above that number
-    int counter = 0;
-
-    // Get the highscore data if the file exists
-    if(hscore_file != NULL) {
-        // The data we want from each line
-        char* name = malloc(sizeof(char) * (MAX_NAME_SIZE+1));
-        int score;
-
-        // Read the score and names from the file. Stop reading if reached EOF or found data that doesn't 
-        // match the "name score" format
-        while(fscanf(hscore_file, "%s %d", name, &score) == 2) {
-            if(counter < MAX_SCORES) {
-                strcpy(hscore_names[counter], name);
-                hscore_scores[counter] = score;
-                counter++;
+    if(hscore_daemon) {
+        hscore_saved = (hscore_daemon_total > 0);
+    } else {
+        if(hscores.head == NULL) {
+            hscore_index_init(&hscores);
+        }
+        hscore_saved = hscore_index_sync(&hscores);
+        hscore_table = &hscores;
+
+        // Rank against the game master as the score to beat. The index is emptied whenever there
+        // are no highscore files, so he is kept apart from it rather than inserted again every game
+        if(!hscore_saved && (hscores.count == 0)) {
+            if(hscore_fallback.head == NULL) {
+                hscore_index_init(&hscore_fallback);
+                hscore_index_insert(&hscore_fallback, "GameMaster", 1000, 0);
             }
+            hscore_table = &hscore_fallback;
         }
+    }
 
-        free(name);
-    } else {
-        // Add the game master as the score to beat
-        hscore_scores[counter] = 1000;
-        strcpy(hscore_names[counter], "GameMaster");
-        counter++;
+    // The page on screen may be out of date now
+    hscore_page_rank = 0;
+}
+
+/**
+ * Gets the number of highscores that have been recorded
+ **/
+int count_hscores() {
+    return hscore_daemon ? hscore_daemon_total : hscore_table->count;
+}
+
+/**
+ * Gets the rank a score would be given in the highscore table
+ **/
+int rank_hscore(int new_score) {
+    int rank;
+    int total;
+    if(hscore_daemon && lb_rank(new_score, &rank, &total)) {
+        return rank;
     }
 
-    fclose(hscore_file);
-    sort_scores();
+    return hscore_index_rank(hscore_table, new_score);
 }
 
 /**
- * Saves all of the high score data from the arrays to a highscore file
+ * Posts a score to the leaderboard daemon, or appends it to the highscore log if the daemon isn't
+ * running. The log is only ever appended to, so games finishing at the same time can't overwrite 
+ * each other's scores
  **/
-void save_scores() {
-    FILE *hscore_file = fopen("highscores", "w");
+bool post_score(char *name, int new_score, int *rank, int *total) {
+    if(hscore_daemon && lb_submit(name, new_score, rank, total)) {
+        return true;
+    }
 
-    for(int i=0; i<MAX_SCORES; i++) {
-        if((hscore_names[i] != NULL) && (hscore_scores[i] > 0)) {
-            fprintf(hscore_file, "%s %d\n", hscore_names[i], hscore_scores[i]);
-        }
+    // Rank the score against the index before it is added to it
+    *rank = hscore_index_rank(hscore_table, new_score);
+    *total = hscore_table->count + 1;
+    return hscore_store_append(name, new_score, NULL);
+}
+
+/**
+ * Saves the player's new highscore, records the rank it was given and brings the table up to date
+ **/
+void save_score(char *name) {
+    // The game master only exists in memory until the first score is saved. It is saved straight
+    // to the highscore files under a fixed id, as any other game finding them empty saves it too
+    if(!hscore_saved) {
+        hscore_entry seed = { "GameMaster", 1000, HSCORE_SEED_ID };
+        hscore_store_append_batch(&seed, 1, NULL);
+        hscore_saved = true;
     }
 
-    fclose(hscore_file);
+    post_score(name, score, &player_rank, &ranked_total);
+    get_hscores();
 }
 
 /**
- * Reads the arrays containing the highscores and prints the information to the user
+ * Makes sure the page of highscores starting at the given rank is in hscore_page
  **/
-void draw_hscores() {
-    // Decide how many highscores we can actually draw
+void fetch_hscore_page(int first_rank, int num_scores) {
+    if((hscore_page_rank == first_rank) && (hscore_page_count >= num_scores)) {
+        return;
+    }
+
+    hscore_page_count = 0;
+    if(!hscore_daemon || !lb_top(first_rank - 1, num_scores, hscore_page, &hscore_page_count)) {
+        hscore_page_count = hscore_index_page(hscore_table, first_rank, num_scores, hscore_page);
+    }
+
+    // Show the game master if nothing has been saved yet
+    if((hscore_page_count == 0) && (first_rank == 1) && !hscore_saved) {
+        strcpy(hscore_page[0].name, "GameMaster");
+        hscore_page[0].score = 1000;
+        hscore_page_count = 1;
+    }
+
+    hscore_page_rank = first_rank;
+}
+
+/**
+ * Gets the number of highscores that fit on the highscore screen
+ **/
+int hscores_per_page() {
     int min_y = 4;
     int max_y = screen_height() - 3;
     int num_scores = max_y - min_y;
-    
+
     // Keep the number of scores to 100 max
     if(num_scores > MAX_SCORES) {
         num_scores = MAX_SCORES;
     }
+    return num_scores;
+}
+
+/**
+ * Moves the page of highscores shown by the given number of ranks, keeping it within the table
+ **/
+void scroll_hscores(int ranks) {
+    int last_first_rank = count_hscores() - hscores_per_page() + 1;
+
+    hscore_first_rank += ranks;
+    if(hscore_first_rank > last_first_rank) {
+        hscore_first_rank = last_first_rank;
+    }
+    if(hscore_first_rank < 1) {
+        hscore_first_rank = 1;
+    }
+}
+
+/**
+ * Shows the page of highscores around the player's rank (or the top of the table if the player
+ * didn't get a highscore)
+ **/
+void show_hscores_around_player() {
+    hscore_first_rank = 1;
+    if(player_rank > 0) {
+        scroll_hscores(player_rank - 1 - (hscores_per_page() / 2));
+    }
+}
+
+/**
+ * Draws a page of the highscore table, starting at hscore_first_rank
+ **/
+void draw_hscores() {
+    // Decide how many highscores we can actually draw
+    int min_y = 4;
+    int num_scores = hscores_per_page();
+    fetch_hscore_page(hscore_first_rank, num_scores);
+    if(num_scores > hscore_page_count) {
+        num_scores = hscore_page_count;
+    }
+
+    // The rank column has to fit the largest rank on this page
+    int rank_width = 1;
+    for(int last_rank = hscore_first_rank + num_scores - 1; last_rank >= 10; last_rank /= 10) {
+        rank_width++;
+    }
 
     // The current y position where we will be drawing
     int y = min_y;
     // Decide on how much space we'll use to pad the table on the sides
-    // The hscore number will never be above 100, the names should not be above 11 and the score 
-    // caps at 999999 (6 digits) and we add 3 for column padding (making total be 13 + MAX_NAME_SIZE)
-    int space = (screen_width()/2) - ((13 + MAX_NAME_SIZE)/2) - 1;
-    // Get the highscores from the arrays and draw them to the screen
+    // The names should not be above 11 and the score caps at 999999 (6 digits) and we add 3 for 
+    // column padding (making total be 10 + MAX_NAME_SIZE + the width of the rank)
+    int space = (screen_width()/2) - ((10 + MAX_NAME_SIZE + rank_width)/2) - 1;
+    // Get the highscores from the page and draw them to the screen
     for(int i=0; i<num_scores; i++) {
         // Draw the highscore number
-        draw_int(space + 2, y, i+1);
+        draw_int(space + 2, y, hscore_first_rank + i);
         // Draw the name if it exists
-        if(hscore_names[i] != NULL) {
-            char *name = (char *)hscore_names[i];
-            draw_string(space + 6, y, name);
+        if(hscore_page[i].name[0] != '\0') {
+            draw_string(space + rank_width + 3, y, hscore_page[i].name);
         }
         // Draw the score if it exists
-        if(hscore_scores[i] > 0) {
-            draw_int(space + 19, y, hscore_scores[i]);
+        if(hscore_page[i].score > 0) {
+            draw_int(space + rank_width + 4 + MAX_NAME_SIZE, y, hscore_page[i].score);
         }
         // Move down a line
         y++;
@@ -854,102 +1241,731 @@ void draw_hscores() {
 }
 
 /**
- * Check if the current score is a new highscore
+ * Adds the run that just finished to the run history and works out how it compares with the 
+ * earlier runs
  **/
-bool check_new_hscore() {
-    int index = 0;
-    int old_score = 0;
-
-    // Transverse the score array and get the lowest score (the one at the bottom)
-    for(int i=0; i<MAX_SCORES; i++) {
-        if(hscore_scores[i] > 0) {
-            old_score = hscore_scores[i];
-            index = i;
-        }
-    }
+void record_run() {
+	run_record run;
+	run.stats[RUN_SCORE] = score;
+	run.stats[RUN_DISTANCE] = distance_travelled;
+	run.stats[RUN_TIME] = (get_current_time() - game_start_time) * 1000;
+	run.stats[RUN_COLLISIONS] = collisions;
+
+	run_history_append(&run, &run_stats);
+}
 
+/**
+ * Check if the current score is a new highscore (makes it into the top MAX_SCORES)
+ **/
+bool check_new_hscore() {
     // If score is 0, we don't have a high score
     if(score == 0) {
         return false;
     }
 
-    // Check if we have a new highscore
-    if((score > old_score) || (index < (MAX_SCORES-1))) {
-        return true;
-    } else {
-        return false;
-    }
+    return rank_hscore(score) <= MAX_SCORES;
+}
+
+/** ---------------------------- GHOSTS ------------------------------- **/
+/**
+ * Gets the name of the file holding the ghosts of the current world. Endurance races have no
+ * ghosts, as their road depends on how quickly it was generated. Returns false if there is no file
+ **/
+bool ghost_file(char *path, size_t size) {
+	if(world_mode == WORLD_TRACK) {
+		// A track with too long a name has nowhere to keep its ghosts
+		return snprintf(path, size, "%s/%s.ghost", GHOST_DIR, track_name) < (int)size;
+	} else if(world_mode == WORLD_PROCEDURAL) {
+		snprintf(path, size, "%s/seed-%u.ghost", GHOST_DIR, race_seed);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Brings out the best ghost of the world and starts recording the new run. Resumed and practice
+ * races aren't recorded, as they don't play out from start to finish in one go, and don't have
+ * ghosts either
+ **/
+void start_ghosts(bool resumed) {
+	ghost_close(&rival);
+	recording_ghost = false;
+
+	char path[256];
+	if(resumed || practice || !ghost_file(path, sizeof(path))) {
+		return;
+	}
+	// The ghost starts level with the player, with as much of the world on the screen
+	ghost_open(&rival, path);
+	rival.rows = world_rows;
+	ghost_record_start(&run_trace, sprite_x(player));
+	recording_ghost = true;
+	traced_rows = world_rows;
+}
+
+/**
+ * Moves the ghost on a frame, and adds the frame to the trace of this run
+ **/
+void update_ghosts() {
+	ghost_step(&rival);
+	if(recording_ghost) {
+		recording_ghost = ghost_record(&run_trace, sprite_x(player), world_rows != traced_rows);
+		traced_rows = world_rows;
+	}
+}
+
+/**
+ * Adds this run to the ghosts of its world
+ **/
+void save_ghost() {
+	char path[256];
+	if(recording_ghost && ghost_file(path, sizeof(path))) {
+		mkdir(GHOST_DIR, 0755);
+		ghost_save(&run_trace, path, score);
+	}
+	recording_ghost = false;
+	ghost_close(&rival);
+}
+
+/**
+ * Draws the ghost's car where it would be beside the player, with every part of the car that 
+ * isn't blank drawn as GHOST_CHAR. It is drawn first so everything else shows through it
+ **/
+void draw_ghost() {
+	if(!rival.playing) {
+		return;
+	}
+
+	char *image = get_car_image();
+	int y = sprite_y(player) - (rival.rows - world_rows);
+	for(int row=0; row<PLAYER_HEIGHT; row++) {
+		for(int column=0; column<PLAYER_WIDTH; column++) {
+			int x = rival.x + column;
+			if((image[(row * PLAYER_WIDTH) + column] != ' ') && (y + row > 0) && (y + row < screen_height() - 1)
+					&& (x > dashboard_x) && (x < screen_width() - 1)) {
+				draw_char(x, y + row, GHOST_CHAR);
+			}
+		}
+	}
+}
+
+/** --------------------------- SNAPSHOTS ----------------------------- **/
+/**
+ * Everything about a game that isn't in the session arena. A snapshot file holds the contents of 
+ * the session arena, then the state of the world generator, then this
+ **/
+typedef struct game_snapshot {
+	uint32_t magic;
+	uint32_t version;
+	// The sizes of the parts of the file before this
+	uint32_t arena_bytes;
+	uint32_t generator_bytes;
+	// A game can only be resumed on the same size of screen and in the same kind of world
+	int32_t screen_width;
+	int32_t screen_height;
+	int32_t world_mode;
+	uint32_t track_rows;
+	int32_t max_terrain_obs;
+	int32_t max_hazards;
+	int32_t road_rows;
+	// When the snapshot was taken, so the timers can carry on from where they were
+	double saved_at;
+	double game_start_time;
+	int32_t speed;
+	int32_t speed_ctr;
+	int32_t fuel;
+	int32_t car_condition;
+	int32_t distance_counter;
+	int32_t distance_travelled;
+	int32_t score;
+	int32_t collisions;
+	int32_t dashboard_x;
+	bool refuelling;
+	bool even_stripe;
+	int32_t world_rows;
+	world_row last_row;
+	int32_t num_terrain;
+	int32_t num_hazards;
+	// Where the session's sprites, timers and arrays are, as offsets into the session arena
+	uint32_t player;
+	uint32_t fuel_station;
+	uint32_t finish_line;
+	uint32_t speed_timer;
+	uint32_t refuel_timer;
+	uint32_t terrain;
+	uint32_t hazards;
+	uint32_t road;
+	uint32_t road_x_coords;
+} game_snapshot;
+
+/**
+ * Numbers every image a sprite can show, so a sprite can be saved without the address of its image.
+ * Returns -1 for an image that isn't known
+ **/
+int image_number(char *image) {
+	int width;
+	int height;
+	if(image == get_car_image()) {
+		return 0;
+	} else if(image == get_fuel_station_image(&width, &height)) {
+		return 1;
+	} else if(image == get_finish_line_image()) {
+		return 2;
+	}
+	for(int i=0; i<NUM_TERRAIN_TYPES; i++) {
+		if(image == terrain_image[i]) {
+			return 3 + i;
+		}
+	}
+	for(int i=0; i<NUM_HAZARD_TYPES; i++) {
+		if(image == hazards_image[i]) {
+			return 3 + NUM_TERRAIN_TYPES + i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Gets the image given a number by image_number
+ **/
+char *numbered_image(int number) {
+	int width;
+	int height;
+	if(number == 0) {
+		return get_car_image();
+	} else if(number == 1) {
+		return get_fuel_station_image(&width, &height);
+	} else if(number == 2) {
+		return get_finish_line_image();
+	} else if((number >= 3) && (number < 3 + NUM_TERRAIN_TYPES)) {
+		return terrain_image[number - 3];
+	} else if((number >= 3 + NUM_TERRAIN_TYPES) && (number < 3 + NUM_TERRAIN_TYPES + NUM_HAZARD_TYPES)) {
+		return hazards_image[number - 3 - NUM_TERRAIN_TYPES];
+	}
+	return get_car_image();
+}
+
+/**
+ * Converts an address in the session arena to an offset, and back again
+ **/
+uint32_t session_offset(void *address) {
+	return (char *)address - (char *)session.first->data;
+}
+void *session_address(uint32_t offset) {
+	return (char *)session.first->data + offset;
+}
+
+/**
+ * Replaces the image of a sprite in a copy of the session arena with its number
+ **/
+void pack_sprite(char *copy, sprite_id sprite) {
+	Sprite *packed = (Sprite *)(copy + session_offset(sprite));
+	packed->bitmap = (char *)(intptr_t)image_number(sprite->bitmap);
+}
+
+/**
+ * Replaces every pointer in a copy of the session arena with something that means the same thing 
+ * in another game: pointers into the arena become offsets and images become their numbers
+ **/
+void pack_session(char *copy) {
+	pack_sprite(copy, player);
+	pack_sprite(copy, fuel_station);
+	pack_sprite(copy, finish_line);
+
+	sprite_id *packed_terrain = (sprite_id *)(copy + session_offset(terrain));
+	for(int i=0; i<max_terrain_obs; i++) {
+		pack_sprite(copy, terrain[i]);
+		packed_terrain[i] = (sprite_id)(uintptr_t)session_offset(terrain[i]);
+	}
+	sprite_id *packed_hazards = (sprite_id *)(copy + session_offset(hazards));
+	for(int i=0; i<max_hazards; i++) {
+		pack_sprite(copy, hazards[i]);
+		packed_hazards[i] = (sprite_id)(uintptr_t)session_offset(hazards[i]);
+	}
+}
+
+/**
+ * Turns the pointers packed by pack_session back into pointers, once the session arena has been
+ * loaded and the globals point back into it
+ **/
+void unpack_session() {
+	player->bitmap = numbered_image((intptr_t)player->bitmap);
+	fuel_station->bitmap = numbered_image((intptr_t)fuel_station->bitmap);
+	finish_line->bitmap = numbered_image((intptr_t)finish_line->bitmap);
+	for(int i=0; i<max_terrain_obs; i++) {
+		terrain[i] = session_address((uintptr_t)terrain[i]);
+		terrain[i]->bitmap = numbered_image((intptr_t)terrain[i]->bitmap);
+	}
+	for(int i=0; i<max_hazards; i++) {
+		hazards[i] = session_address((uintptr_t)hazards[i]);
+		hazards[i]->bitmap = numbered_image((intptr_t)hazards[i]->bitmap);
+	}
+}
+
+/**
+ * The size of a snapshot of the game in progress. Endurance races can't be saved, as part of their
+ * world is still being generated in the background, so their snapshots are 0 bytes
+ **/
+size_t snapshot_size() {
+	size_t arena_bytes;
+	size_t arena_size;
+	if((world_mode == WORLD_ENDURANCE) || (arena_contents(&session, &arena_bytes, &arena_size) == NULL)) {
+		return 0;
+	}
+
+	size_t generator_bytes = (world_mode == WORLD_PROCEDURAL) ? world_gen_state_size(&world_generator) : 0;
+	return arena_bytes + generator_bytes + sizeof(game_snapshot);
+}
+
+/**
+ * Takes a snapshot of the game in progress, which must fit in snapshot_size() bytes
+ **/
+void take_snapshot(char *file) {
+	size_t arena_bytes;
+	size_t arena_size;
+	char *contents = arena_contents(&session, &arena_bytes, &arena_size);
+	size_t generator_bytes = (world_mode == WORLD_PROCEDURAL) ? world_gen_state_size(&world_generator) : 0;
+
+	// The sprites' images are in the game itself, so they are saved by number
+	memcpy(file, contents, arena_bytes);
+	pack_session(file);
+	if(generator_bytes > 0) {
+		world_gen_save(&world_generator, file + arena_bytes);
+	}
+
+	game_snapshot *snapshot = (game_snapshot *)(file + arena_bytes + generator_bytes);
+	memset(snapshot, 0, sizeof(game_snapshot));
+	snapshot->magic = SNAPSHOT_MAGIC;
+	snapshot->version = SNAPSHOT_VERSION;
+	snapshot->arena_bytes = arena_bytes;
+	snapshot->generator_bytes = generator_bytes;
+	snapshot->screen_width = screen_width();
+	snapshot->screen_height = screen_height();
+	snapshot->world_mode = world_mode;
+	snapshot->track_rows = (world_mode == WORLD_TRACK) ? race_track.header->num_rows : 0;
+	snapshot->max_terrain_obs = max_terrain_obs;
+	snapshot->max_hazards = max_hazards;
+	snapshot->road_rows = road_rows;
+	snapshot->saved_at = get_current_time();
+	snapshot->game_start_time = game_start_time;
+	snapshot->speed = speed;
+	snapshot->speed_ctr = speed_ctr;
+	snapshot->fuel = fuel;
+	snapshot->car_condition = car_condition;
+	snapshot->distance_counter = distance_counter;
+	snapshot->distance_travelled = distance_travelled;
+	snapshot->score = score;
+	snapshot->collisions = collisions;
+	snapshot->dashboard_x = dashboard_x;
+	snapshot->refuelling = refuelling;
+	snapshot->even_stripe = even_stripe;
+	snapshot->world_rows = world_rows;
+	snapshot->last_row = last_row;
+	snapshot->num_terrain = num_terrain;
+	snapshot->num_hazards = num_hazards;
+	snapshot->player = session_offset(player);
+	snapshot->fuel_station = session_offset(fuel_station);
+	snapshot->finish_line = session_offset(finish_line);
+	snapshot->speed_timer = session_offset(speed_timer);
+	snapshot->refuel_timer = session_offset(refuel_timer);
+	snapshot->terrain = session_offset(terrain);
+	snapshot->hazards = session_offset(hazards);
+	snapshot->road = session_offset(road);
+	snapshot->road_x_coords = session_offset(road_x_coords);
+}
+
+/**
+ * Saves the game in progress to a file in one write. Returns false if the game couldn't be saved
+ **/
+bool save_snapshot(const char *path) {
+	size_t length = snapshot_size();
+	char *file = (length > 0) ? zdk_malloc(length) : NULL;
+	if(file == NULL) {
+		return false;
+	}
+	take_snapshot(file);
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	bool saved = (fd >= 0) && (write(fd, file, length) == (ssize_t)length);
+	if(fd >= 0) {
+		saved = (close(fd) == 0) && saved;
+	}
+	zdk_free(file);
+	return saved;
+}
+
+/**
+ * Checks if the player has just been told the race can't be saved, so quitting again quits anyway
+ **/
+bool unsaved_quit_pending() {
+	return (unsaved_quit_time > 0) && (get_current_time() - unsaved_quit_time < UNSAVED_QUIT_TIME);
+}
+
+/**
+ * Checks that a snapshot was taken of a game that can be resumed here
+ **/
+bool snapshot_matches(const game_snapshot *snapshot, size_t length) {
+	size_t generator_bytes = (world_mode == WORLD_PROCEDURAL) ? world_gen_state_size(&world_generator) : 0;
+
+	return (snapshot->magic == SNAPSHOT_MAGIC) && (snapshot->version == SNAPSHOT_VERSION)
+		&& (length == snapshot->arena_bytes + snapshot->generator_bytes + sizeof(game_snapshot))
+		&& (snapshot->generator_bytes == generator_bytes)
+		&& (snapshot->screen_width == screen_width()) && (snapshot->screen_height == screen_height())
+		&& (snapshot->world_mode == world_mode)
+		&& (snapshot->track_rows == ((world_mode == WORLD_TRACK) ? race_track.header->num_rows : 0))
+		&& (snapshot->max_terrain_obs == max_terrain_obs) && (snapshot->max_hazards == max_hazards)
+		&& (snapshot->road_rows == road_rows);
+}
+
+/**
+ * Checks that an object of the given size at an offset into the session arena of a snapshot is 
+ * wholly inside it, and aligned as the arena would have allocated it
+ **/
+bool snapshot_holds(const game_snapshot *snapshot, uintptr_t offset, size_t size) {
+	return ((offset % sizeof(arena_align)) == 0) && (offset <= snapshot->arena_bytes) 
+		&& (size <= snapshot->arena_bytes - offset);
+}
+
+/**
+ * Checks that everything a snapshot's session arena is said to hold is inside it, so a damaged
+ * snapshot can't leave the game with pointers outside the arena
+ **/
+bool snapshot_valid(const game_snapshot *snapshot, const char *contents) {
+	if(!snapshot_holds(snapshot, snapshot->player, sizeof(Sprite))
+			|| !snapshot_holds(snapshot, snapshot->fuel_station, sizeof(Sprite))
+			|| !snapshot_holds(snapshot, snapshot->finish_line, sizeof(Sprite))
+			|| !snapshot_holds(snapshot, snapshot->speed_timer, sizeof(cab202_timer_t))
+			|| !snapshot_holds(snapshot, snapshot->refuel_timer, sizeof(cab202_timer_t))
+			|| !snapshot_holds(snapshot, snapshot->terrain, max_terrain_obs * sizeof(sprite_id))
+			|| !snapshot_holds(snapshot, snapshot->hazards, max_hazards * sizeof(sprite_id))
+			|| !snapshot_holds(snapshot, snapshot->road, road_rows * sizeof(int))
+			|| !snapshot_holds(snapshot, snapshot->road_x_coords, road_rows * sizeof(int))) {
+		return false;
+	}
+	if((snapshot->num_terrain < 0) || (snapshot->num_terrain > max_terrain_obs) || (snapshot->num_hazards < 0)
+			|| (snapshot->num_hazards > max_hazards) || (snapshot->last_row.num_obstacles > WORLD_MAX_ROW_OBSTACLES)) {
+		return false;
+	}
+
+	// The obstacles' sprites are packed as offsets into the arrays
+	const sprite_id *packed_terrain = (const sprite_id *)(contents + snapshot->terrain);
+	for(int i=0; i<max_terrain_obs; i++) {
+		if(!snapshot_holds(snapshot, (uintptr_t)packed_terrain[i], sizeof(Sprite))) {
+			return false;
+		}
+	}
+	const sprite_id *packed_hazards = (const sprite_id *)(contents + snapshot->hazards);
+	for(int i=0; i<max_hazards; i++) {
+		if(!snapshot_holds(snapshot, (uintptr_t)packed_hazards[i], sizeof(Sprite))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Carries on with the game in a snapshot that has been copied to the start of the session arena, 
+ * fixing up its pointers. Returns false if it isn't a snapshot of a game that can be resumed here
+ **/
+bool restore_snapshot(char *contents, size_t length) {
+	game_snapshot snapshot;
+	if(length < sizeof(game_snapshot)) {
+		return false;
+	}
+	memcpy(&snapshot, contents + length - sizeof(game_snapshot), sizeof(game_snapshot));
+	if(!snapshot_matches(&snapshot, length) || !snapshot_valid(&snapshot, contents)) {
+		return false;
+	}
+	if(snapshot.generator_bytes > 0) {
+		world_gen_load(&world_generator, contents + snapshot.arena_bytes);
+	}
+	arena_set_contents(&session, snapshot.arena_bytes);
+
+	player = session_address(snapshot.player);
+	fuel_station = session_address(snapshot.fuel_station);
+	finish_line = session_address(snapshot.finish_line);
+	speed_timer = session_address(snapshot.speed_timer);
+	refuel_timer = session_address(snapshot.refuel_timer);
+	terrain = session_address(snapshot.terrain);
+	hazards = session_address(snapshot.hazards);
+	road = session_address(snapshot.road);
+	road_x_coords = session_address(snapshot.road_x_coords);
+	unpack_session();
+
+	// Carry the timers on from where they were
+	double paused = get_current_time() - snapshot.saved_at;
+	speed_timer->reset_time += paused;
+	refuel_timer->reset_time += paused;
+	game_start_time = snapshot.game_start_time + paused;
+
+	speed = snapshot.speed;
+	speed_ctr = snapshot.speed_ctr;
+	fuel = snapshot.fuel;
+	car_condition = snapshot.car_condition;
+	distance_counter = snapshot.distance_counter;
+	distance_travelled = snapshot.distance_travelled;
+	score = snapshot.score;
+	collisions = snapshot.collisions;
+	dashboard_x = snapshot.dashboard_x;
+	refuelling = snapshot.refuelling;
+	even_stripe = snapshot.even_stripe;
+	world_rows = snapshot.world_rows;
+	last_row = snapshot.last_row;
+	num_terrain = snapshot.num_terrain;
+	num_hazards = snapshot.num_hazards;
+	game_over_loss = false;
+	player_rank = 0;
+	ranked_total = 0;
+	return true;
+}
+
+/**
+ * Resumes a game saved by save_snapshot. The file is read straight into the session arena in one 
+ * read, so its sprites, timers and arrays only need their pointers fixed up. Returns false (with 
+ * the session released) if the file isn't a snapshot of a game that can be resumed here
+ **/
+bool load_snapshot(const char *path) {
+	stop_world();
+
+	// The world generator is prepared first, so its state can be loaded straight into it
+	world_gen_config config;
+	get_world_config(&config);
+	if((world_mode == WORLD_PROCEDURAL) && !world_gen_init(&world_generator, &config)) {
+		return false;
+	}
+
+	// The race may have been saved from a bigger first block than this game's
+	int fd = open(path, O_RDONLY);
+	struct stat info;
+	if((fd < 0) || (fstat(fd, &info) != 0) || !arena_fit(&session, info.st_size)) {
+		if(fd >= 0) {
+			close(fd);
+		}
+		return false;
+	}
+	size_t used;
+	size_t size;
+	char *contents = arena_contents(&session, &used, &size);
+	if(contents == NULL) {
+		close(fd);
+		return false;
+	}
+	ssize_t length = read(fd, contents, size);
+	close(fd);
+
+	return (length > 0) && restore_snapshot(contents, length);
+}
+
+/** ---------------------------- REWIND ------------------------------- **/
+/**
+ * Starts the history of a new practice race. Every snapshot of a race is the same size, so the
+ * history is made to fit the first one
+ **/
+void setup_history() {
+	size_t length = snapshot_size();
+	if(!practice || (length == 0)) {
+		return;
+	}
+
+	if(history.entries == NULL) {
+		if(!rewind_init(&history, REWIND_BUDGET, REWIND_FRAMES, length, REWIND_KEYFRAME_FRAMES)) {
+			return;
+		}
+		history_frame = zdk_malloc(length);
+	}
+	rewind_clear(&history);
+}
+
+/**
+ * Adds the frame that has just been played to the history
+ **/
+void record_history() {
+	size_t length = snapshot_size();
+	if((history_frame == NULL) || (length == 0) || (length > history.max_state)) {
+		return;
+	}
+
+	take_snapshot(history_frame);
+	rewind_record(&history, history_frame, length);
+}
+
+/**
+ * Takes the race back to how it was REWIND_STEP_FRAMES frames ago (or as far back as the history 
+ * goes). The snapshot is rebuilt straight into the session arena
+ **/
+void rewind_race() {
+	size_t used;
+	size_t size;
+	char *contents = arena_contents(&session, &used, &size);
+	if((history_frame == NULL) || (contents == NULL) || (size < history.max_state)) {
+		return;
+	}
+
+	size_t length = rewind_back(&history, REWIND_STEP_FRAMES, contents);
+	if(length > 0) {
+		restore_snapshot(contents, length);
+	}
+}
+
+/** -------------------------- MAIN GAME ------------------------------ **/
+/**
+ * Removes all keyboard input sitting in the buffer in order to prevent unexpected commands when switching 
+ * states. Everything buffered was pressed before the switch, so it is thrown away straight away instead of
+ * waiting for the keys to be let go. Keys still on their way are thrown away once read (see debounce_key)
+ **/
+void purge_input_buffer() {
+	int key;
+	key_event thrown_away;
+	while((key = get_char()) >= 0) {
+		if(key != KEY_RESIZE) {
+			key_stream_take(&keyboard, &thrown_away);
+		}
+	}
+	transition_time = get_current_time();
+	transition_stamp = key_stream_now();
+	transition_pending = true;
+}
+
+/**
+ * Takes the stamp of a key that has just been read, so how long it takes to show can be measured 
+ * once this frame has been drawn. Resizing the window isn't a key, so has no stamp
+ **/
+int stamp_key(int key) {
+	key_event event;
+	key_arrived = -1;
+	if((key >= 0) && (key != KEY_RESIZE) && key_stream_take(&keyboard, &event)) {
+		key_arrived = event.arrived;
+		if(num_frame_keys < INPUT_BUDGET) {
+			frame_keys[num_frame_keys++] = event;
+		}
+	}
+	return key;
+}
+
+/**
+ * Stamps the frame about to be written behind with the keys read since the last frame was drawn
+ **/
+void stamp_frame_keys() {
+	for(int i=0; i<num_frame_keys; i++) {
+		zdk_output_stamp(frame_keys[i].arrived);
+	}
+}
+
+/**
+ * Publishes the screen to the render thread, stamped with the keys read since the last frame was drawn
+ **/
+void publish_frame() {
+	double stamps[INPUT_BUDGET];
+	for(int i=0; i<num_frame_keys; i++) {
+		stamps[i] = frame_keys[i].arrived;
+	}
+	renderer_publish(&screen_renderer, zdk_screen->pixels[0], screen_width(), screen_height(), stamps, num_frame_keys);
+}
+
+/**
+ * Counts how long keys took to show, once their frames have reached the terminal
+ **/
+void collect_shown_keys() {
+	double shown[INPUT_BUDGET];
+	int count;
+	while((count = zdk_output_shown(shown, INPUT_BUDGET)) > 0) {
+		for(int i=0; i<count; i++) {
+			histogram_add(&input_latency, shown[i]);
+		}
+	}
+}
+
+/**
+ * Finishes with the keys read in this frame, once it has been drawn. A frame written behind only
+ * shows them once its writer has written it (see collect_shown_keys), otherwise they show now
+ **/
+void finish_frame_keys() {
+	if(!zdk_output_running()) {
+		double shown = key_stream_now();
+		for(int i=0; i<num_frame_keys; i++) {
+			histogram_add(&input_latency, shown - frame_keys[i].arrived);
+		}
+	}
+	num_frame_keys = 0;
+	collect_shown_keys();
+}
+
+/**
+ * Counts the allocations made in this frame. When checking allocations, the game is stopped if a 
+ * frame of a race allocates without changing the screen, as by then the race should only use memory 
+ * it already has
+ **/
+void finish_frame_allocations() {
+	frame_allocations = alloc_stats_end_frame();
+	if(check_allocations && (frame_allocations > 0) && (game_state == GAME_SCREEN) && !transition_pending) {
+		trace_stop();
+		renderer_stop(&screen_renderer);
+		spectate_stop(&spectators);
+		key_stream_stop(&keyboard);
+		cleanup_screen();
+		fprintf(stderr, "%llu allocations in a frame of the race, the last at %s\n", 
+			(unsigned long long)frame_allocations, alloc_stats_totals()->last_site);
+		alloc_stats_report(stderr);
+		abort();
+	}
 }
 
 /**
- * Sorts the scores by placing the highest score at the top and the lowest at the bottom
- **/
-void sort_scores() {
-    // Sort the scores if we have more than 1 entry
-    for(int i=0; i<MAX_SCORES; i++) {
-        for(int j=i+1; j<MAX_SCORES; j++) {
-            if((hscore_names[i] != NULL) && (hscore_names[j] != NULL) && (hscore_scores[i] != 0)) {
-                if(hscore_scores[i] < hscore_scores[j]) {  
-                    // Swap the scores
-                    int tmp = hscore_scores[i];
-                    hscore_scores[i] = hscore_scores[j];
-                    hscore_scores[j] = tmp;
-                    // Swap the names
-                    char temp[11] = "";
-                    strcpy(temp, hscore_names[i]);
-                    strcpy(hscore_names[i],hscore_names[j]);
-                    strcpy(hscore_names[j],temp);
-                }
-            }
-        }
-    }
+ * Filters a key that has just been read (and stamped). A key that arrived before the screen last changed
+ * was pressed for the screen before, so it is dropped (returning -1). Keys without a stamp are kept, as 
+ * everything buffered when the screen changed was already thrown away
+ **/
+int debounce_key(int key) {
+	if((key >= 0) && (key_arrived >= 0) && (key_arrived < transition_stamp)) {
+		return -1;
+	}
+	return key;
 }
 
 /**
- * Adds the current score to the highscore arrays to a free space if there is any or by 
- * replacing the lowest score currently in the highscore table
+ * Adds how long something took to a set of stats
  **/
-void process_hscore(char *name) {
-    // Sort the scores just in case (can be removed if slowing down too much)
-    sort_scores();
-
-    int index = 0;
-
-    // Transverse the score array and get the lowest score (the one at the bottom)
-    for(int i=0; i<MAX_SCORES; i++) {
-        if(hscore_scores[i] > 0) {
-            index = i;
-        }
-    }
+void add_latency(latency_stats *stats, double seconds) {
+	stats->count++;
+	stats->total += seconds;
+	stats->last = seconds;
+	if(seconds > stats->max) {
+		stats->max = seconds;
+	}
+}
 
-    // Add to the end of the table if there is space
-    if(index < (MAX_SCORES-1)) {
-        hscore_scores[index+1] = score;
-        strcpy(hscore_names[index+1], name);
-    } else {
-        // Replace the lowest score if there is no space
-        hscore_scores[index] = score;
-        strcpy(hscore_names[index], name);
-    }
+/**
+ * Measures how long it took for the last change of screen to be drawn, once it has been
+ **/
+void finish_transition() {
+	if(transition_pending) {
+		add_latency(&transition_latency, get_current_time() - transition_time);
+		transition_pending = false;
+	}
 }
 
-/** -------------------------- MAIN GAME ------------------------------ **/
 /**
- * Removes all keyboard input sitting in the buffer in order to prevent unexpected commands when switching states
+ * Reports how long things took
  **/
-void purge_input_buffer() {
-	timer_pause(500);
-	while ( get_char() >= 0 ) { /* loop until no chars buffered */ }
+void print_latency(const char *name, const latency_stats *stats) {
+	double mean = (stats->count > 0) ? stats->total / stats->count : 0;
+	printf("%s: %d, mean %.3f ms, max %.3f ms, last %.3f ms\n", name, stats->count, mean * 1000, 
+		stats->max * 1000, stats->last * 1000);
 }
 
 /**
  * Deallocate memory assigned to some of our globals
  **/
 void free_memory() {
-	free(terrain);
-	free(hazards);
-	free(road);
-	free(road_x_coords);
+	stop_world();
+	track_close(&race_track);
+	arena_free(&session);
+	rewind_free(&history);
+	zdk_free(history_frame);
+	zdk_free(dashboard_cells);
+	ghost_close(&rival);
+	ghost_recorder_free(&run_trace);
 }
 
 /**
@@ -957,12 +1973,12 @@ void free_memory() {
  **/
 bool offroad(int x, int y, int width) {
 	// Check if to the left of the road
-	if((x+width-1) < road_x_coords[y]) {
+	if((x+width-1) < road_x_at(y)) {
 		return true;
 	}
 
 	// Check if to the right of the road
-	if(x > (road_x_coords[y]+ROAD_WIDTH-1)) {
+	if(x > (road_x_at(y)+ROAD_WIDTH-1)) {
 		return true;
 	}
 
@@ -973,11 +1989,11 @@ bool offroad(int x, int y, int width) {
  * Check if the car is offroad
  **/
 bool car_offroad() {
-	if(sprite_x(player) < road_x_coords[(int)sprite_y(player)]) {
+	if(sprite_x(player) < road_x_at(sprite_y(player))) {
 		return true;
 	}
 
-	if((sprite_x(player) + PLAYER_WIDTH - 1) > (road_x_coords[(int)sprite_y(player)] + ROAD_WIDTH)) {
+	if((sprite_x(player) + PLAYER_WIDTH - 1) > (road_x_at(sprite_y(player)) + ROAD_WIDTH)) {
 		return true;
 	}
 
@@ -1008,7 +2024,8 @@ void check_refuel() {
 
 	if(ready_to_refuel) {
 		refuelling = true;
-		refuel_timer = create_timer(3000);
+		TRACE_ASYNC_BEGIN("refuel", 1);
+		timer_reset(refuel_timer);
 		speed = 0;
 	}
 }
@@ -1030,7 +2047,10 @@ void refuel() {
 			refuelling = false;
 			fuel = MAX_FUEL;
 			speed = 1;
-			destroy_timer(refuel_timer);
+		}
+
+		if(!refuelling) {
+			TRACE_ASYNC_END("refuel", 1);
 		}
 	}
 }
@@ -1056,7 +2076,7 @@ bool in_bounds(int x, int y) {
 void reset_player_location() {
 	// Setup the car at the bottom of the screen, middle of road
 	int y = screen_height() - PLAYER_HEIGHT - 2;
-	int x = (ROAD_WIDTH / 2) + road_x_coords[y] - (PLAYER_WIDTH/2) + 1;
+	int x = (ROAD_WIDTH / 2) + road_x_at(y) - (PLAYER_WIDTH/2) + 1;
 
 	player->x = x;
 	player->y = y;
@@ -1067,8 +2087,8 @@ void reset_player_location() {
  **/
 void setup_player_car() {
 	int y = screen_height() - PLAYER_HEIGHT - 2;
-	int x = (ROAD_WIDTH / 2) + road_x_coords[y] - (PLAYER_WIDTH/2) + 1;
-	player = sprite_create(x, y, PLAYER_WIDTH, PLAYER_HEIGHT, get_car_image());
+	int x = (ROAD_WIDTH / 2) + road_x_at(y) - (PLAYER_WIDTH/2) + 1;
+	player = session_sprite(x, y, PLAYER_WIDTH, PLAYER_HEIGHT, get_car_image());
 	car_condition = 100;
 
 	// Setup fuel settings 
@@ -1081,17 +2101,32 @@ void setup_player_car() {
  */
 void setup_dashboard() {
 	dashboard_x = DASHBOARD_SIZE;
+
+	// Room to keep the dashboard (and its border) while it isn't being redrawn every frame
+	if(screen_height() > dashboard_rows) {
+		char *cells = zdk_realloc(dashboard_cells, screen_height() * (DASHBOARD_SIZE + 1));
+		if(cells != NULL) {
+			dashboard_cells = cells;
+			dashboard_rows = screen_height();
+		}
+	}
+	dashboard_saved = 0;
 }
 
 /**
  * Starts the game
  **/
 void setup_game_state() {
+	// Release everything the last game used
+	arena_reset(&session);
+
 	setup_dashboard();
 	setup_obs();
 
 	// Get all current highscores from the highscore file
 	get_hscores();
+	player_rank = 0;
+	ranked_total = 0;
 	
 	// Setup the car at the bottom of the screen
 	setup_player_car();
@@ -1106,9 +2141,19 @@ void setup_game_state() {
 	game_start_time = get_current_time();
 	distance_counter = 0;
 	distance_travelled = 0;
+	collisions = 0;
 
 	// Start the speed timer
-	speed_timer = create_timer(SPEED_INTERVAL);
+	speed_timer = session_timer(SPEED_INTERVAL);
+	refuel_timer = session_timer(3000);
+
+	// A race is saved from the first block of the session arena, so a race too big for it is set
+	// up again in a first block that fits it
+	size_t used;
+	size_t size;
+	if((arena_contents(&session, &used, &size) == NULL) && arena_fit(&session, session.stats.bytes)) {
+		setup_game_state();
+	}
 }
 
 /**
@@ -1116,12 +2161,41 @@ void setup_game_state() {
  * that state run properly
  **/
 void change_state(int new_state) {
+	TRACE_INSTANT("change_state", new_state);
 	purge_input_buffer();
+	bool resumed = false;
 
 	// Decide if we need to initiate the state before switching to it
 	switch(new_state) {
 		case GAME_SCREEN:
-			setup_game_state();
+			// A saved race is only resumed once
+			resumed = resuming && load_snapshot(SNAPSHOT_FILE);
+			if(!resumed) {
+				setup_game_state();
+			}
+			if(resuming) {
+				unlink(SNAPSHOT_FILE);
+				resuming = false;
+			}
+			setup_history();
+			start_ghosts(resumed);
+			break;
+		case GAME_OVER_SCREEN:
+			// Several things can end the game in the same update, but the run only ends once
+			if(game_state == GAME_SCREEN) {
+				// A resumed game hasn't read the highscores yet
+				if(hscores.head == NULL) {
+					get_hscores();
+				}
+				update_score();
+				new_hscore = !practice && check_new_hscore();
+				record_run();
+				save_ghost();
+				text_input_init(&name_input, MAX_NAME_SIZE - 1);
+			}
+			break;
+		case HIGHSCORE_SCREEN:
+			show_hscores_around_player();
 			break;
 		default:
 			break;
@@ -1159,12 +2233,12 @@ void handle_movement_input(int key) {
 		dx = 0;
 	}
 
-	// Create a temporary sprite to check if car will collide
-	sprite_id temp_sprite = sprite_create(sprite_x(player)+dx, sprite_y(player), PLAYER_WIDTH, PLAYER_HEIGHT, get_car_image());
-	if(check_collision(temp_sprite)) {
+	// Use a temporary sprite to check if car will collide
+	Sprite temp_sprite;
+	sprite_init(&temp_sprite, sprite_x(player)+dx, sprite_y(player), PLAYER_WIDTH, PLAYER_HEIGHT, get_car_image());
+	if(check_collision(&temp_sprite)) {
 		dx = 0;
 	}
-	sprite_destroy(temp_sprite);
 
 	// Check if car is stationary and should be allowed to move
 	if(speed > 0) {
@@ -1173,19 +2247,27 @@ void handle_movement_input(int key) {
 }
 
 /**
- * Updates the speed of the car depending on the speed change key that was pressed
+ * Moves the car the given number of columns (left if negative), one column at a time, stopping at
+ * the first one it can't move into
  **/
-void handle_speed_input(int key) {
-	// The change in speed
-	int dv = 0;
-
-	switch(key) {
-		case INPUT_ACCELERATE:
-			dv++;
-			break;
-		case INPUT_DECELERATE:
-			dv--;
+void handle_steering(int dx) {
+	int key = (dx < 0) ? INPUT_MOVE_LEFT : INPUT_MOVE_RIGHT;
+	for(int i=0; i<abs(dx); i++) {
+		int x = sprite_x(player);
+		handle_movement_input(key);
+		if(sprite_x(player) == x) {
 			break;
+		}
+	}
+}
+
+/**
+ * Changes the speed of the car by the given amount, keeping it between 0 and the fastest the car 
+ * can go where it is
+ **/
+void handle_speed_input(int dv) {
+	if(dv == 0) {
+		return;
 	}
 
 	// Decide on the max speed the car can reach
@@ -1194,32 +2276,80 @@ void handle_speed_input(int key) {
 		max_speed = MAX_SPEED_OFFROAD;
 	}
 
-	// Check if the speed will fall in bounds
-	if(((speed + dv) <= max_speed) && (speed + dv) >= 0) {
-		speed += dv;
+	speed += dv;
+	if(speed > max_speed) {
+		speed = max_speed;
+	} else if(speed < 0) {
+		speed = 0;
 	}
 }
 
 /**
- * Gets a character from the input buffer and checks if it is valid. If it is, the appropriate 
- * function will be called to handle that input.
+ * Takes every key waiting in the input buffer (up to INPUT_BUDGET of them) and handles them together.
+ * Steering and speed keys are added up, so a burst of key presses or key repeats is handled in one
+ * go instead of one key a frame
  **/ 
 void handle_input() {
-	int key = get_char();
+	int dx = 0;
+	int dv = 0;
+	int depth = 0;
 
-	// Check if there's any input waiting to be processed
-	if(key >= 0) {
-		switch(key) {
+	int key;
+	while((depth < INPUT_BUDGET) && ((key = stamp_key(get_char())) >= 0)) {
+		depth++;
+		switch(debounce_key(key)) {
 			case INPUT_MOVE_LEFT:
+				dx--;
+				break;
 			case INPUT_MOVE_RIGHT:
-				handle_movement_input(key);
+				dx++;
 				break;
 			case INPUT_ACCELERATE:
+				dv++;
+				break;
 			case INPUT_DECELERATE:
-				handle_speed_input(key);
+				dv--;
+				break;
+			case INPUT_SAVE_QUIT:
+				// Quit, keeping the race to carry on with next time. A race that can't be kept carries
+				// on, unless quit is pressed again while the player is told so
+				if(save_snapshot(SNAPSHOT_FILE) || unsaved_quit_pending()) {
+					change_state(EXIT_SCREEN);
+					return;
+				}
+				unsaved_quit_time = get_current_time();
+				break;
+			case INPUT_REWIND:
+				// The keys pressed before rewinding are rewound with everything else
+				if(practice) {
+					rewind_race();
+					dx = 0;
+					dv = 0;
+				}
+				break;
+#ifdef PROFILE
+			case INPUT_PROFILE:
+				show_profile = !show_profile;
 				break;
+#endif
 		}
 	}
+
+	input_queue.frames++;
+	input_queue.keys += depth;
+	input_queue.last_depth = depth;
+	if(depth > input_queue.max_depth) {
+		input_queue.max_depth = depth;
+	}
+	if(depth == INPUT_BUDGET) {
+		input_queue.at_budget++;
+	}
+
+	// Speed up or slow down first, as the car can only steer while it is moving
+	handle_speed_input(dv);
+	if(dx != 0) {
+		handle_steering(dx);
+	}
 }
 
 /**
@@ -1227,7 +2357,9 @@ void handle_input() {
  **/
 void update_start_screen() {
 	// If the user presses any key, start the game
-	if(get_char() >= 0) {
+	int key = debounce_key(stamp_key(get_char()));
+	if(key >= 0) {
+		resuming = (key == INPUT_RESUME) && (access(SNAPSHOT_FILE, R_OK) == 0);
 		change_state(GAME_SCREEN);
 	}
 }
@@ -1267,9 +2399,9 @@ void handle_collision() {
 	}
 	reset_player_location();
 	// Remove any hazards in the way 
-	for(int i=0; i<max_hazards; i++) {
+	for(int i=num_hazards-1; i>=0; i--) {
 		if(check_sprite_collided(player, hazards[i])) {
-			hazard_reset(i);
+			remove_hazard(i);
 		}
 	}
 }
@@ -1304,14 +2436,24 @@ void update_score() {
  * Code that updates the logic of the game relevant to the Game state
  **/
 void update_game_screen() {
+	PROFILE_BEGIN(PHASE_INPUT);
 	handle_input();
+	PROFILE_END(PHASE_INPUT);
 
 	// Decides when to update the game (if enough time has speed depending on the speed)
-	if(update_speed_ctr()) {
+	PROFILE_BEGIN(PHASE_SPEED);
+	bool moving = update_speed_ctr();
+	PROFILE_END(PHASE_SPEED);
+	if(moving) {
 		even_stripe = !even_stripe;
 		update_distance();
 		// Check if the car has collided with an obstacle
-		if(check_collision(player)) {
+		PROFILE_BEGIN(PHASE_COLLISION);
+		bool collided = check_collision(player);
+		PROFILE_END(PHASE_COLLISION);
+		if(collided) {
+			collisions++;
+			TRACE_INSTANT("collision", collisions);
 			// Check if the car has collided with a fuel station
 			if(check_sprite_collided(player,fuel_station)) {
 				game_over_loss = true;
@@ -1320,12 +2462,16 @@ void update_game_screen() {
 				handle_collision();
 			}
 		}
+		PROFILE_BEGIN(PHASE_OBSTACLES);
 		update_obs();
+		PROFILE_END(PHASE_OBSTACLES);
 		speed_ctr = 0;
 	}
 
 	// Refuel the car if all criteria are met
+	PROFILE_BEGIN(PHASE_REFUEL);
 	refuel();
+	PROFILE_END(PHASE_REFUEL);
 
 	// If the car is offroad, set its speed to the maximum offroad speed
 	if(car_offroad() && (speed > MAX_SPEED_OFFROAD)) {
@@ -1333,61 +2479,61 @@ void update_game_screen() {
 	}
 	
 	// Check if the player has won the game
-	if((sprite_y(player) + sprite_height(player)) < sprite_y(finish_line)) {
+	if(sprite_visible(finish_line) && ((sprite_y(player) + sprite_height(player)) < sprite_y(finish_line))) {
 		game_over_loss = false;
 		change_state(GAME_OVER_SCREEN);
 	}
 
-	update_score();
+	// The score is final once the game is over
+	if(game_state == GAME_SCREEN) {
+		update_score();
+	}
 
 	// Check if the player has run out of fuel
 	if(fuel <= 0) {
 		game_over_loss = true;
 		change_state(GAME_OVER_SCREEN);
 	}
+
+	// Keep every frame of a practice race so it can be rewound
+	if(practice && (game_state == GAME_SCREEN)) {
+		record_history();
+	}
+
+	if(game_state == GAME_SCREEN) {
+		update_ghosts();
+	}
 }
 
 /**
- * Updates the game over screen. Will pretty much just wait till the user presses a button to move to the Highscore 
- * screen
+ * Updates the game over screen. Takes the player's name if they got a highscore, otherwise waits till the 
+ * user presses a button to move to the Highscore screen. Keys are polled for every frame, as on every other
+ * screen, so the frame keeps being drawn and written while the player types
  **/
 void update_game_over_screen() {
-	// Check if the user has achieved a new highscore
-	if(check_new_hscore()) {
-        // Get the user's name
-        char name[MAX_NAME_SIZE] = "";
-
-        // The current letter we're in
-        int index = 0;
-        // Get the characters from the user for the name
-        bool done = false;
-        while((index < (MAX_NAME_SIZE-1)) && (!done)) {
-            char letter = get_char();
-            // Stop if the user presses ENTER
-            if(letter == 10) {
-				// If the user didn't type anything
-				if(index == 0) {
-					strcpy(name, "Anonymous");
-				}
-                done = true;
-            } else {
-                if((letter > 32) && (letter < 127)) {
-                    // Append the letter to the current name
-                    name[index] = letter;
-                    index++;
-                }
-            }
-        }
+	int key = debounce_key(stamp_key(get_char()));
+
+	// Redraw to fit the new window size
+	if(key == KEY_RESIZE) {
+		fit_screen_to_window();
+		return;
+	} else if(key < 0) {
+		return;
+	}
 
-        process_hscore(name);
-		sort_scores();
-		save_scores();
-		change_state(HIGHSCORE_SCREEN);
-    } else {
-		// Wait for the user to press a key if no game over was announced
-		if(get_char() >= 0) {
+	// Check if the user has achieved a new highscore
+	if(new_hscore) {
+		text_input_key(&name_input, key);
+		if(name_input.done) {
+			// If the user didn't type anything
+			if(name_input.length == 0) {
+				strcpy(name_input.text, "Anonymous");
+			}
+			save_score(name_input.text);
 			change_state(HIGHSCORE_SCREEN);
 		}
+	} else {
+		change_state(HIGHSCORE_SCREEN);
 	}
 }
 
@@ -1395,9 +2541,21 @@ void update_game_over_screen() {
  * Updates the highscore screen by allowing the player to either play the game again or quit
  **/
 void update_highscore_screen() {
-    char key = get_char();
+    int key = debounce_key(stamp_key(get_char()));
 
 	switch(key) {
+		case KEY_UP:
+			scroll_hscores(-1);
+			break;
+		case KEY_DOWN:
+			scroll_hscores(1);
+			break;
+		case KEY_PPAGE:
+			scroll_hscores(-hscores_per_page());
+			break;
+		case KEY_NPAGE:
+			scroll_hscores(hscores_per_page());
+			break;
 		case 'p':
 		case 'P':
 			change_state(GAME_SCREEN);
@@ -1476,11 +2634,25 @@ void draw_start_screen() {
 	y++;
 	draw_string(3, y, "Collisions reduce car condition");
 	draw_string(x, y, "w/s : Accelerate/Decelerate");
+	draw_string(x, y + 1, "q   : Save and quit");
+	if(practice) {
+		draw_string(x, y + 2, "b   : Rewind 3 seconds");
+	}
 	y++;
 	draw_string(3, y++, "Game over if car condition is 0, ");
 	draw_string(3, y++, "collides with fuel station or ");
 	draw_string(3, y++, "runs out of fuel");
 	draw_string(3, y++, "Drive with low speed next to fuel station to refuel");
+	if(world_mode == WORLD_ENDURANCE) {
+		y++;
+		draw_formatted(3, y++, "Endurance race: %d m of winding road", endurance_rows / 5);
+		if((endurance_unstreamed > 0) && !endurance_streaming) {
+			draw_string(3, y++, "(the last one was generated as it was driven, which may stutter)");
+		}
+	}
+	if(access(SNAPSHOT_FILE, R_OK) == 0) {
+		draw_center_text("Press r to resume your saved race", screen_height() - 4);
+	}
 	draw_center_text("Press any key to play...", screen_height() - 5);
 	draw_center_text("Pedro Alves - n9424342", screen_height() - 2);
 }
@@ -1540,16 +2712,100 @@ void draw_dashboard() {
 	} else if(fuel < (MAX_FUEL/4)) {
 		draw_string(2, 13, "LOW FUEL");
 	}
+
+	// How far back the race can be rewound
+	if(practice) {
+		draw_string(2, 16, "Rewind");
+		draw_int(12, 16, rewind_frames(&history) * LOOP_INTERVAL / 1000);
+	}
+
+	// How long keys take to show (the median and the slowest 1%)
+	if(show_metrics) {
+		draw_string(2, 19, "Input lag ms");
+		draw_formatted(2, 20, "%.1f / %.1f", histogram_percentile(&input_latency, 50) * 1000,
+			histogram_percentile(&input_latency, 99) * 1000);
+		draw_string(2, 21, "Allocs/frame");
+		draw_int(15, 21, frame_allocations);
+		if(pacing) {
+			draw_string(2, 22, "Drawn fps");
+			draw_int(15, 22, (int)pacer.fps);
+		}
+	}
+
+	// How many meters the ghost is ahead (or behind)
+	if(rival.playing) {
+		draw_string(2, 17, "Ghost");
+		draw_int(12, 17, (rival.rows - world_rows) / 5);
+	}
+}
+
+/**
+ * Keeps what the dashboard shows, to show it again in frames it isn't redrawn in
+ **/
+void save_dashboard() {
+	int rows = (screen_height() < dashboard_rows) ? screen_height() : dashboard_rows;
+	for(int y=0; y<rows; y++) {
+		memcpy(dashboard_cells + (y * (DASHBOARD_SIZE + 1)), zdk_screen->pixels[y], DASHBOARD_SIZE + 1);
+	}
+	dashboard_saved = rows;
+}
+
+/**
+ * Shows the dashboard as it was when it was last kept
+ **/
+void restore_dashboard() {
+	int rows = (screen_height() < dashboard_saved) ? screen_height() : dashboard_saved;
+	for(int y=0; y<rows; y++) {
+		memcpy(zdk_screen->pixels[y], dashboard_cells + (y * (DASHBOARD_SIZE + 1)), DASHBOARD_SIZE + 1);
+	}
+}
+
+#ifdef PROFILE
+/**
+ * Draws the mean and longest time each phase of a frame took over the last second, in the top
+ * right corner of the screen
+ **/
+void draw_profile() {
+	int x = screen_width() - 38;
+	draw_formatted(x, 1, "%-17s %8s %8s", "last second (us)", "mean", "max");
+	for(int i=0; i<NUM_PHASES; i++) {
+		const profile_times *times = profile_get(i);
+		double mean = (times->last_count > 0) ? (double)times->last_total_ns / times->last_count : 0;
+		draw_formatted(x, i + 2, "%-17s %8.1f %8.1f", profile_name(i), mean / 1000, times->last_max_ns / 1000.0);
+	}
 }
+#endif
 
 /**
  * Draw the game screen
  **/
 void draw_game_screen() {
-	draw_dashboard();
+	PROFILE_BEGIN(PHASE_DASHBOARD);
+	if(!pacing || (dashboard_saved == 0) || frame_pacer_dashboard(&pacer)) {
+		draw_dashboard();
+		save_dashboard();
+	} else {
+		restore_dashboard();
+	}
+	PROFILE_END(PHASE_DASHBOARD);
+	draw_ghost();
+	PROFILE_BEGIN(PHASE_DRAW_OBSTACLES);
 	draw_obs();
+	PROFILE_END(PHASE_DRAW_OBSTACLES);
 
+	PROFILE_BEGIN(PHASE_DRAW_PLAYER);
 	sprite_draw(player);
+	PROFILE_END(PHASE_DRAW_PLAYER);
+
+	if(unsaved_quit_pending()) {
+		draw_center_text("This race can't be saved. Press q again to quit without it", screen_height() / 2);
+	}
+
+#ifdef PROFILE
+	if(show_profile) {
+		draw_profile();
+	}
+#endif
 }
 
 /**
@@ -1564,9 +2820,18 @@ void draw_game_over_screen() {
 	char score_text[50];
 	sprintf(score_text, "Your score was: %d", score);
 	draw_center_text(score_text, (screen_height() / 2) + 1);
-	if(check_new_hscore()) {
+	// Show how this run compares with every earlier run
+	if(run_stats.runs > 0) {
+		char stats_text[100];
+		sprintf(stats_text, "Percentile - score: %.0f  distance: %.0f  time: %.0f  collisions: %.0f",
+			run_stats.percentiles[RUN_SCORE], run_stats.percentiles[RUN_DISTANCE],
+			run_stats.percentiles[RUN_TIME], run_stats.percentiles[RUN_COLLISIONS]);
+		draw_center_text(stats_text, (screen_height() / 2) + 2);
+	}
+	if(new_hscore) {
 		draw_center_text("High Score!!", (screen_height() / 2) + 4);
 		draw_center_text("Type your name and press Enter", (screen_height() / 2) + 5);
+		text_input_draw(&name_input, "Name: ", (screen_height() / 2) + 7);
 	} else {
 		draw_center_text("Press any key to continue", screen_height()-2);
 	}
@@ -1577,7 +2842,14 @@ void draw_game_over_screen() {
  **/
 void draw_highscore_screen() {
     draw_center_text("HIGHSCORES", 2);
+    draw_center_text("Up/Down/PgUp/PgDn to scroll", 3);
     draw_hscores();
+    // Show where the player's new score placed
+    if(player_rank > 0) {
+        char rank_text[50];
+        sprintf(rank_text, "Your rank: %d of %d", player_rank, ranked_total);
+        draw_center_text(rank_text, screen_height() - 3);
+    }
 	draw_center_text("(P)lay again , (S)tart screen, (Q)uit", screen_height() - 2);
 }
 
@@ -1605,17 +2877,429 @@ void draw() {
 			break;
 	}
 
+	draw_borders();
+	PROFILE_BEGIN(PHASE_SHOW_SCREEN);
+	if(pipelined) {
+		TRACE_BEGIN("publish");
+		publish_frame();
+		TRACE_END("publish");
+	} else {
+		TRACE_BEGIN("show_screen");
+		stamp_frame_keys();
+		show_screen();
+		TRACE_END("show_screen");
+	}
+	if(spectated) {
+		spectate_frame(&spectators, zdk_screen->pixels[0], screen_width(), screen_height());
+	}
+	PROFILE_END(PHASE_SHOW_SCREEN);
+}
+
+/**
+ * Plays the start of a game over and over without a screen, as pressing "Play again" would, then 
+ * reports how the memory in use changed after the first game. Returns false if it grew at all
+ **/
+bool soak_restarts(int restarts) {
+	struct mallinfo2 first_heap = { 0 };
+	arena_stats first_session = { 0 };
+	for(int i=0; i<=restarts; i++) {
+		setup_game_state();
+		for(int frame=0; frame<100; frame++) {
+			handle_movement_input((frame % 2) ? INPUT_MOVE_LEFT : INPUT_MOVE_RIGHT);
+			update_obs();
+			check_collision(player);
+			refuel();
+			draw_game_screen();
+		}
+
+		if(i == 0) {
+			first_heap = mallinfo2();
+			first_session = session.stats;
+		}
+	}
+
+	struct mallinfo2 heap = mallinfo2();
+	printf("%d restarts\n", restarts);
+	printf("session arena: %zu blocks (%zu bytes), %zu allocations (%zu bytes) per game, %zu resets\n",
+		session.stats.blocks, session.stats.block_bytes, session.stats.allocations, session.stats.bytes, session.stats.resets);
+	ssize_t block_growth = (ssize_t)(session.stats.blocks - first_session.blocks);
+	ssize_t heap_growth = (ssize_t)(heap.uordblks - first_heap.uordblks);
+	printf("growth since the first game: %zd arena blocks, %zd heap bytes in use\n", block_growth, heap_growth);
+	if((block_growth != 0) || (heap_growth != 0)) {
+		printf("FAIL: memory grew across restarts\n");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * The two frames the benchmark of show_screen switches between, and the one on screen
+ **/
+char *bench_frames[2];
+int bench_frame;
+
+void bench_show_screen_same() {
+	show_screen();
+}
+
+void bench_show_screen_changed() {
+	bench_frame = !bench_frame;
+	memcpy(zdk_screen->pixels[0], bench_frames[bench_frame], screen_width() * screen_height());
+	show_screen();
+}
+
+void bench_clear_screen() {
+	clear_screen();
+}
+
+void bench_sprite_draw() {
+	sprite_draw(player);
+}
+
+void bench_draw_line() {
+	draw_line(0, 0, screen_width() - 1, screen_height() - 1, BORDER_CHAR);
+}
+
+void bench_draw_string() {
+	draw_string(DASHBOARD_SIZE + 2, screen_height() / 2, "The road to Zombie Mountain");
+}
+
+void bench_check_collision() {
+	check_collision(player);
+}
+
+void bench_update_obs() {
+	update_obs();
+}
+
+/**
+ * Everything a frame of a race does when the world moves, apart from reading keys and changing screen
+ **/
+void bench_game_tick() {
+	update_distance();
+	check_collision(player);
+	update_obs();
+	refuel();
+	clear_screen();
+	draw_game_screen();
 	draw_borders();
 	show_screen();
 }
 
+/**
+ * Calls a benchmark until it has taken at least BENCH_TIME seconds, doubling the number of calls each 
+ * try, then prints how long a call took as a line of CSV
+ **/
+void run_benchmark(const char *name, void (*benchmark)(), int obstacles) {
+	long calls = 1;
+	double elapsed;
+	while(true) {
+		double start = get_current_time();
+		for(long i=0; i<calls; i++) {
+			benchmark();
+		}
+		elapsed = get_current_time() - start;
+		if(elapsed >= BENCH_TIME) {
+			break;
+		}
+		calls *= 2;
+	}
+	printf("%s,%d,%d,%d,%ld,%.1f\n", name, screen_width(), screen_height(), obstacles, calls, (elapsed / calls) * 1e9);
+}
+
+/**
+ * Times the drawing functions of the ZDK and the parts of a frame without a screen, on screens from 
+ * 80x24 up to 1000x300 (each with as many obstacles as fit on it). The results are printed as CSV, 
+ * one line per benchmark and screen size, so they can be compared across commits
+ **/
+void run_benchmarks() {
+	const int sizes[NUM_BENCH_SIZES][2] = { { 80, 24 }, { 160, 48 }, { 320, 96 }, { 640, 192 }, { 1000, 300 } };
+	if(!fixed_seed) {
+		race_seed = BENCH_SEED;
+		fixed_seed = true;
+	}
+
+	printf("benchmark,width,height,obstacles,calls,ns_per_call\n");
+	for(int i=0; i<NUM_BENCH_SIZES; i++) {
+		override_screen_size(sizes[i][0], sizes[i][1]);
+		init_obs();
+		setup_game_state();
+		int obstacles = num_terrain + num_hazards;
+
+		// Two frames of the race one step apart
+		size_t frame_size = screen_width() * screen_height();
+		for(int frame=0; frame<2; frame++) {
+			clear_screen();
+			draw_game_screen();
+			bench_frames[frame] = zdk_malloc(frame_size);
+			memcpy(bench_frames[frame], zdk_screen->pixels[0], frame_size);
+			update_obs();
+		}
+
+		run_benchmark("show_screen_same", bench_show_screen_same, obstacles);
+		run_benchmark("show_screen_changed", bench_show_screen_changed, obstacles);
+		run_benchmark("clear_screen", bench_clear_screen, obstacles);
+		run_benchmark("sprite_draw", bench_sprite_draw, obstacles);
+		run_benchmark("draw_line", bench_draw_line, obstacles);
+		run_benchmark("draw_string", bench_draw_string, obstacles);
+		run_benchmark("check_collision", bench_check_collision, obstacles);
+		run_benchmark("update_obs", bench_update_obs, obstacles);
+		run_benchmark("game_tick", bench_game_tick, obstacles);
+
+		zdk_free(bench_frames[0]);
+		zdk_free(bench_frames[1]);
+	}
+}
+
+/** -------------------------- GOLDEN FRAMES ------------------------- **/
+// The script being played, where its golden frames are, and the directory it is played in
+golden_script golden;
+char golden_path[PATH_MAX];
+char golden_directory[PATH_MAX];
+// The keys of each frame are written to a pipe that the ZDK reads as its input
+int golden_input[2];
+// The frames drawn, in the ZDK's screen-cast format
+char *golden_frames;
+size_t golden_frames_length;
+
+/**
+ * Gets ready to play a script: its golden frames are the file next to it ending in .frames, and it is 
+ * played on the virtual clock in a new directory, with the screen cast to memory
+ **/
+bool setup_golden(const char *script_path) {
+	if(!golden_load(&golden, script_path)) {
+		return false;
+	}
+
+	// The golden frames are found before moving to another directory
+	if(realpath(script_path, golden_path) == NULL) {
+		return false;
+	}
+	char *extension = strrchr(golden_path, '.');
+	if((extension != NULL) && (strchr(extension, '/') == NULL)) {
+		*extension = '\0';
+	}
+	strncat(golden_path, ".frames", sizeof(golden_path) - strlen(golden_path) - 1);
+
+	if(!golden_sandbox(golden_directory, sizeof(golden_directory))) {
+		fprintf(stderr, "%s: can't make a directory to play in\n", script_path);
+		return false;
+	}
+	if(pipe(golden_input) != 0) {
+		return false;
+	}
+	fcntl(golden_input[0], F_SETFL, O_NONBLOCK);
+	zdk_input_stream = fdopen(golden_input[0], "r");
+	zdk_save_stream = open_memstream(&golden_frames, &golden_frames_length);
+
+	golden_clock_start(GOLDEN_START_TIME);
+	race_seed = golden.seed;
+	fixed_seed = true;
+	return (zdk_input_stream != NULL) && (zdk_save_stream != NULL);
+}
+
+/**
+ * Plays the script a frame at a time, moving the virtual clock on by a frame each time, until it runs 
+ * out of frames or the game exits. Then checks the frames drawn against the golden frames, and the 
+ * longest frames against the budgets. Frames that change screen aren't held to the budgets, as 
+ * starting a race is expected to take longer. Returns false if any check failed
+ *
+ * The frames are written behind to /dev/null, to count the bytes show_screen() writes for each
+ **/
+bool run_golden() {
+	int sink = open("/dev/null", O_WRONLY);
+	if((sink < 0) || !zdk_output_start(sink, screen_width(), screen_height())) {
+		fprintf(stderr, "can't write the frames behind\n");
+		return false;
+	}
+	zdk_output_link link;
+	double max_update = 0;
+	double max_draw = 0;
+	int max_flush = 0;
+	int over_budget = 0;
+	int frame;
+	for(frame=0; (frame < golden.frames) && (game_state != EXIT_SCREEN); frame++) {
+		const char *keys = golden_keys(&golden, frame);
+		if(write(golden_input[1], keys, strlen(keys)) < 0) {
+			break;
+		}
+		clearerr(zdk_input_stream);
+
+		uint64_t start = profile_now();
+		update();
+		uint64_t updated = profile_now();
+		draw();
+		uint64_t drawn = profile_now();
+
+		// Each frame is written before the next is drawn, so none is superseded and the bytes are 
+		// the same on every run
+		zdk_output_measure(&link);
+		int flushed = (int)link.last_bytes;
+		while(link.pending > 0) {
+			usleep(100);
+			zdk_output_measure(&link);
+		}
+
+		if(!transition_pending) {
+			double update_ms = (updated - start) / 1e6;
+			double draw_ms = (drawn - updated) / 1e6;
+			max_update = (update_ms > max_update) ? update_ms : max_update;
+			max_draw = (draw_ms > max_draw) ? draw_ms : max_draw;
+			max_flush = (flushed > max_flush) ? flushed : max_flush;
+			if(((golden.update_budget_ms > 0) && (update_ms > golden.update_budget_ms))
+					|| ((golden.draw_budget_ms > 0) && (draw_ms > golden.draw_budget_ms))
+					|| ((golden.flush_budget > 0) && (flushed > golden.flush_budget))) {
+				if(over_budget == 0) {
+					fprintf(stderr, "frame %d over budget: update %.3f ms, draw %.3f ms, %d bytes flushed\n", 
+						frame, update_ms, draw_ms, flushed);
+				}
+				over_budget++;
+			}
+		}
+		finish_transition();
+		finish_frame_keys();
+		golden_clock_advance(LOOP_INTERVAL);
+	}
+	zdk_output_stop();
+	close(sink);
+
+	fflush(zdk_save_stream);
+	bool same = golden_compare(golden_frames, golden_frames_length, golden_path, stderr);
+	fclose(zdk_save_stream);
+	zdk_save_stream = NULL;
+	free(golden_frames);
+
+	printf("%d frames: update max %.3f ms (budget %.3f), draw max %.3f ms (budget %.3f), flush max %d bytes (budget %d), "
+		"%d frames over budget, frames %s\n", frame, max_update, golden.update_budget_ms, max_draw, golden.draw_budget_ms, 
+		max_flush, golden.flush_budget, over_budget, same ? "match" : "differ");
+
+	fclose(zdk_input_stream);
+	zdk_input_stream = NULL;
+	close(golden_input[1]);
+	golden_sandbox_remove(golden_directory);
+	golden_free(&golden);
+	return same && (over_budget == 0);
+}
+
 /**
  * The entry point to the program
  **/
-int main( void ) {
+int main(int argc, char *argv[]) {
+	// An endurance race is given as its length in meters (the distance stat), which is 1/5 of the
+	// number of rows
+	// Every race can be on the same world by giving its seed, to race against its ghosts
+	// Metrics report how long things took (and what was allocated) when the game exits, and a trace
+	// records a timeline of every frame to a file
+	// Checking allocations stops the game if a race allocates in the middle of it
+	// Frames are drawn by a thread of their own, unless they are to be drawn serially in the game
+	// loop
+	// The race can be published under a name for spectators to watch
+	// A practice race can be rewound (except in endurance races, which can't be saved)
+	// A soak test restarts the game many times without a screen to check that restarting doesn't
+	// leak memory
+	// The benchmarks time the drawing and the frame on screens of many sizes without a screen
+	// A golden-frame run plays a script of keys without a screen and checks what it draws against 
+	// the frames drawn by an earlier run, and how long its frames took against budgets
+	int soak = 0;
+	bool benchmarks = false;
+	const char *golden_script_path = NULL;
+	const char *trace_path = NULL;
+	const char *spectate_name = NULL;
+	int option;
+	while((option = getopt(argc, argv, "e:t:s:pr:mT:abg:Sw:")) != -1) {
+		if((option == 'e') && (atoi(optarg) > 0)) {
+			world_mode = WORLD_ENDURANCE;
+			endurance_rows = atoi(optarg) * 5;
+		} else if(option == 't') {
+			if(!track_open(&race_track, optarg)) {
+				fprintf(stderr, "%s: %s is not a track file\n", argv[0], optarg);
+				return 1;
+			}
+			world_mode = WORLD_TRACK;
+			const char *base_name = strrchr(optarg, '/') ? strrchr(optarg, '/') + 1 : optarg;
+			snprintf(track_name, sizeof(track_name), "%s", base_name);
+			if(strrchr(track_name, '.') != NULL) {
+				*strrchr(track_name, '.') = '\0';
+			}
+		} else if(option == 'p') {
+			practice = true;
+		} else if(option == 'm') {
+			show_metrics = true;
+		} else if(option == 'a') {
+			check_allocations = true;
+		} else if(option == 'S') {
+			serial_drawing = true;
+		} else if(option == 'w') {
+			spectate_name = optarg;
+		} else if(option == 'T') {
+			trace_path = optarg;
+		} else if(option == 'r') {
+			race_seed = strtoul(optarg, NULL, 10);
+			fixed_seed = true;
+		} else if(option == 'g') {
+			golden_script_path = optarg;
+			zdk_suppress_output = true;
+		} else if(option == 'b') {
+			benchmarks = true;
+			zdk_suppress_output = true;
+		} else if((option == 's') && (atoi(optarg) > 0)) {
+			soak = atoi(optarg);
+			zdk_suppress_output = true;
+		} else {
+			fprintf(stderr, "Usage: %s [-e meters | -t track] [-r seed] [-p] [-m] [-a] [-S] [-T trace.json] [-w name] [-s restarts | -b | -g script]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if((golden_script_path != NULL) && !setup_golden(golden_script_path)) {
+		return 1;
+	}
+
+	// Count every allocation from here on, including the screen's
+	if(show_metrics || check_allocations) {
+		alloc_stats_start();
+	}
+
 	// Setup the ZDK screen. Alwas do this first
+	// Frames are written to the terminal behind the game, so a slow terminal never holds it up
+	zdk_write_behind = true;
 	setup_screen();
 
+	// An authored track has its obstacles at fixed columns, so the screen has to be wide enough
+	if((world_mode == WORLD_TRACK) && ((int)race_track.header->width > screen_width())) {
+		cleanup_screen();
+		fprintf(stderr, "%s: the screen must be at least %u columns wide for this track\n", argv[0], race_track.header->width);
+		return 1;
+	}
+
+	if(spectate_name != NULL) {
+		spectated = spectate_start(&spectators, spectate_name);
+		if(!spectated) {
+			cleanup_screen();
+			fprintf(stderr, "%s: can't publish the race for spectators as %s\n", argv[0], spectate_name);
+			return 1;
+		}
+	}
+
+	if((trace_path != NULL) && !trace_start(trace_path)) {
+		cleanup_screen();
+		fprintf(stderr, "%s: can't write a trace to %s\n", argv[0], trace_path);
+		return 1;
+	}
+
+	// Stamp keys as they arrive, to measure how long they take to show
+	if(!zdk_suppress_output) {
+		key_stream_start(&keyboard);
+	}
+
+	if(zdk_output_running() && !serial_drawing) {
+		pipelined = renderer_start(&screen_renderer, screen_width(), screen_height());
+	}
+	if(zdk_output_running()) {
+		pacing = true;
+		frame_pacer_init(&pacer, 1000.0 / LOOP_INTERVAL, get_current_time());
+	}
+
 	// Setup all of the images to be used on the sprites
 	imagemngr_init();
 
@@ -1629,18 +3313,121 @@ int main( void ) {
 	timer_id loop_timer = create_timer(LOOP_INTERVAL);
 
 	// Setup the obstacle arrays 
+	arena_init(&session, SESSION_ARENA_SIZE);
 	init_obs();
 
+	if(benchmarks || (soak > 0) || (golden_script_path != NULL)) {
+		int status = 0;
+		if(benchmarks) {
+			run_benchmarks();
+		} else if(golden_script_path != NULL) {
+			status = run_golden() ? 0 : 1;
+		} else {
+			status = soak_restarts(soak) ? 0 : 1;
+		}
+		trace_stop();
+		spectate_stop(&spectators);
+		key_stream_stop(&keyboard);
+		cleanup_screen();
+		free_memory();
+		return status;
+	}
+
 	// Start the main game loop
 	while(game_state != EXIT_SCREEN) {
+		PROFILE_BEGIN(PHASE_FRAME);
+		TRACE_BEGIN("update");
 		update();
-		draw();
-
-		// Wait for a bit in order to not go above 20fps
+		TRACE_END("update");
+		// The race is only drawn as often as the terminal can take it, but every other screen is
+		// drawn, as it hardly changes
+		bool drawn = !pacing || frame_pacer_draw(&pacer, transition_pending || (game_state != GAME_SCREEN), 
+			get_current_time());
+		TRACE_BEGIN("draw");
+		if(drawn) {
+			draw();
+		} else {
+			TRACE_INSTANT("frame_dropped", pacer.interval);
+		}
+		TRACE_END("draw");
+		PROFILE_END(PHASE_FRAME);
+		finish_frame_allocations();
+		finish_transition();
+		// Keys only show once a frame is drawn
+		if(drawn) {
+			finish_frame_keys();
+		}
+#ifdef PROFILE
+		profile_end_frame();
+#endif
+
+		// Sleep for the rest of the frame in order to not go above 60fps, so a screen that is only
+		// waiting for keys (such as the name entry) costs no CPU between them
+		TRACE_BEGIN("wait");
+		double frame_left = loop_timer->reset_time + (loop_timer->milliseconds / 1000.0) - get_current_time();
+		if(frame_left > 0) {
+			usleep(frame_left * 1e6);
+		}
 		while(!timer_expired(loop_timer)) { }	
+		TRACE_END("wait");
 	}
 
+	trace_stop();
+	renderer_stop(&screen_renderer);
+	spectate_stop(&spectators);
+	key_stream_stop(&keyboard);
 	cleanup_screen();
+	destroy_timer(loop_timer);
 	free_memory();
+
+#ifdef PROFILE
+	profile_report(stdout);
+#endif
+	if(endurance_unstreamed > 0) {
+		fprintf(stderr, "%s: the background generator couldn't be started, so %d endurance race(s) were generated "
+			"as they were driven\n", argv[0], endurance_unstreamed);
+	}
+	// The last frames were only written as the screen was cleaned up
+	collect_shown_keys();
+	if(show_metrics) {
+		print_latency("screen changes", &transition_latency);
+		printf("input queue: %d keys in %d frames, mean depth %.3f, max depth %d, %d frames at the budget\n",
+			input_queue.keys, input_queue.frames, (input_queue.frames > 0) ? (double)input_queue.keys / input_queue.frames : 0,
+			input_queue.max_depth, input_queue.at_budget);
+		printf("input to display: %llu keys, min %.3f ms, median %.3f ms, p99 %.3f ms, max %.3f ms, %u without a stamp\n",
+			(unsigned long long)input_latency.count, input_latency.min * 1000, histogram_percentile(&input_latency, 50) * 1000,
+			histogram_percentile(&input_latency, 99) * 1000, input_latency.max * 1000, keyboard.dropped);
+		const alloc_totals *allocated = alloc_stats_totals();
+		printf("allocations: %llu (%llu bytes), %llu frees, %llu of %llu frames allocated, at most %llu in one frame\n",
+			(unsigned long long)allocated->allocations, (unsigned long long)allocated->bytes, (unsigned long long)allocated->frees,
+			(unsigned long long)allocated->frames_allocating, (unsigned long long)allocated->frames,
+			(unsigned long long)allocated->max_frame_allocations);
+		alloc_stats_report(stdout);
+		if(pipelined) {
+			printf("renderer: %llu frames published, %llu drawn, %llu skipped\n", (unsigned long long)screen_renderer.published,
+				(unsigned long long)screen_renderer.rendered, (unsigned long long)screen_renderer.skipped);
+		}
+		if(pacing) {
+			printf("pacing: %llu frames, %llu drawn, %llu dropped to pace the terminal, %llu dropped for its backlog, "
+				"drawn fps min %.1f, longest interval %d frames\n", (unsigned long long)pacer.frames, 
+				(unsigned long long)pacer.drawn, (unsigned long long)pacer.paced, (unsigned long long)pacer.backlogged,
+				pacer.min_fps, pacer.max_interval);
+		}
+		if(spectated) {
+			printf("spectators: %llu frames published as %s, %llu keyframes, %llu bytes, %llu too big to publish\n",
+				(unsigned long long)spectators.frames, spectate_name, (unsigned long long)spectators.keyframes,
+				(unsigned long long)spectators.bytes, (unsigned long long)spectators.too_big);
+		}
+		const zdk_output_stats *output = zdk_output_totals();
+		if(output->frames > 0) {
+			printf("output: %llu frames queued, %llu written (%llu bytes), %llu superseded (%llu bytes), longest write %.3f ms\n",
+				output->frames, output->written, output->bytes_written, output->superseded, output->bytes_superseded,
+				output->longest_write * 1000);
+		}
+		if(trace_path != NULL) {
+			printf("trace: %llu events written to %s, %llu dropped\n", (unsigned long long)trace_written(), trace_path,
+				(unsigned long long)trace_dropped());
+		}
+	}
 	return 0;
 }
\ No newline at end of file
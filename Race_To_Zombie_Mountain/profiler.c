@@ -0,0 +1,250 @@
+/**
+ * profiler.c
+ *
+ * Per phase frame times. See profiler.h.
+ **/
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "profiler.h"
+
+static profile_times phases[NUM_PHASES];
+static uint64_t second_start;
+
+// The counters are opened as one group, so they are all read with one system call. Each counter's
+// place in what is read, or -1 if it couldn't be opened
+static bool counters_tried;
+static int counter_group = -1;
+static int counter_slot[NUM_COUNTERS] = { -1, -1, -1, -1 };
+static int counters_opened;
+static int counter_error;
+
+static const uint64_t counter_configs[NUM_COUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+static const char *phase_names[NUM_PHASES] = {
+	"handle_input",
+	"update_speed_ctr",
+	"update_obs",
+	"check_collision",
+	"refuel",
+	"draw_dashboard",
+	"draw_obs",
+	"sprite_draw",
+	"show_screen",
+	"whole frame",
+};
+
+uint64_t profile_now() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+/**
+ * Finds the bucket of a time: which doubling it is in, then which step of that doubling
+ **/
+static int profile_bucket(uint64_t ns) {
+	if(ns < PROFILE_STEPS) {
+		return ns;
+	}
+	int doubling = 63 - __builtin_clzll(ns);
+	int step = (ns >> (doubling - 2)) & (PROFILE_STEPS - 1);
+	return (doubling * PROFILE_STEPS) + step;
+}
+
+/**
+ * The shortest time in a bucket
+ **/
+static uint64_t profile_bucket_start(int bucket) {
+	// Times under PROFILE_STEPS nanoseconds have a bucket each, and the buckets after them are unused
+	if(bucket < PROFILE_STEPS) {
+		return bucket;
+	} else if(bucket < 2 * PROFILE_STEPS) {
+		return PROFILE_STEPS;
+	} else if(bucket >= PROFILE_BUCKETS) {
+		return UINT64_MAX;
+	}
+	int doubling = bucket / PROFILE_STEPS;
+	uint64_t step = bucket % PROFILE_STEPS;
+	return ((uint64_t)PROFILE_STEPS + step) << (doubling - 2);
+}
+
+/**
+ * Opens the counters for the calling thread, counting only the game's own code
+ **/
+static void profile_open_counters() {
+	counters_tried = true;
+	for(int i=0; i<NUM_COUNTERS; i++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = counter_configs[i];
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.disabled = (counter_group < 0);
+
+		int fd = syscall(SYS_perf_event_open, &attr, 0, -1, counter_group, 0);
+		if(fd < 0) {
+			counter_error = errno;
+			continue;
+		}
+		if(counter_group < 0) {
+			counter_group = fd;
+		}
+		counter_slot[i] = counters_opened++;
+	}
+
+	if(counter_group >= 0) {
+		ioctl(counter_group, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+}
+
+void profile_mark_now(profile_mark *mark) {
+	if(!counters_tried) {
+		profile_open_counters();
+	}
+
+	// What a group read gives: the number of counters, then each of their values
+	uint64_t values[1 + NUM_COUNTERS];
+	if((counter_group >= 0) && (read(counter_group, values, sizeof(values)) > 0)) {
+		for(int i=0; i<NUM_COUNTERS; i++) {
+			mark->counts[i] = (counter_slot[i] >= 0) ? values[1 + counter_slot[i]] : 0;
+		}
+	} else {
+		memset(mark->counts, 0, sizeof(mark->counts));
+	}
+	mark->ns = profile_now();
+}
+
+void profile_add_since(profile_phase phase, const profile_mark *start) {
+	profile_mark end;
+	profile_mark_now(&end);
+	profile_add(phase, end.ns - start->ns);
+	for(int i=0; i<NUM_COUNTERS; i++) {
+		phases[phase].counts[i] += end.counts[i] - start->counts[i];
+	}
+}
+
+bool profile_has_counter(profile_counter counter) {
+	return counter_slot[counter] >= 0;
+}
+
+void profile_add(profile_phase phase, uint64_t ns) {
+	profile_times *times = &phases[phase];
+	times->buckets[profile_bucket(ns)]++;
+	times->count++;
+	times->total_ns += ns;
+	if(ns > times->max_ns) {
+		times->max_ns = ns;
+	}
+
+	times->second_count++;
+	times->second_total_ns += ns;
+	if(ns > times->second_max_ns) {
+		times->second_max_ns = ns;
+	}
+}
+
+void profile_end_frame() {
+	uint64_t now = profile_now();
+	if(second_start == 0) {
+		second_start = now;
+	}
+	if(now - second_start < 1000000000) {
+		return;
+	}
+
+	for(int i=0; i<NUM_PHASES; i++) {
+		profile_times *times = &phases[i];
+		times->last_count = times->second_count;
+		times->last_total_ns = times->second_total_ns;
+		times->last_max_ns = times->second_max_ns;
+		times->second_count = 0;
+		times->second_total_ns = 0;
+		times->second_max_ns = 0;
+	}
+	second_start = now;
+}
+
+const profile_times *profile_get(profile_phase phase) {
+	return &phases[phase];
+}
+
+const char *profile_name(profile_phase phase) {
+	return phase_names[phase];
+}
+
+uint64_t profile_percentile(profile_phase phase, double percent) {
+	const profile_times *times = &phases[phase];
+	if(times->count == 0) {
+		return 0;
+	}
+
+	uint64_t rank = (percent / 100.0) * times->count + 0.5;
+	if(rank < 1) {
+		rank = 1;
+	}
+	uint64_t seen = 0;
+	for(int i=0; i<PROFILE_BUCKETS; i++) {
+		seen += times->buckets[i];
+		if(seen >= rank) {
+			// Report the middle of the bucket, but never more than the longest time seen
+			uint64_t middle = (profile_bucket_start(i) + profile_bucket_start(i + 1)) / 2;
+			return (middle < times->max_ns) ? middle : times->max_ns;
+		}
+	}
+	return times->max_ns;
+}
+
+void profile_report(FILE *file) {
+	fprintf(file, "%-18s %10s %10s %10s %10s %10s\n", "phase (us)", "count", "mean", "median", "p99", "max");
+	for(int i=0; i<NUM_PHASES; i++) {
+		const profile_times *times = &phases[i];
+		double mean = (times->count > 0) ? (double)times->total_ns / times->count : 0;
+		fprintf(file, "%-18s %10llu %10.2f %10.2f %10.2f %10.2f\n", phase_names[i], (unsigned long long)times->count,
+			mean / 1000, profile_percentile(i, 50) / 1000.0, profile_percentile(i, 99) / 1000.0, times->max_ns / 1000.0);
+	}
+
+	if(!counters_tried) {
+		return;
+	} else if(counters_opened == 0) {
+		fprintf(file, "hardware counters unavailable (%s), times only\n", strerror(counter_error));
+		return;
+	}
+
+	// The counters are given per frame, so a phase that doesn't run every frame is still comparable
+	uint64_t frames = phases[PHASE_FRAME].count;
+	fprintf(file, "\n%-18s %10s %12s %12s %12s %12s\n", "phase (per frame)", "IPC", "cycles", "instructions",
+		"cache misses", "branch misses");
+	for(int i=0; i<NUM_PHASES; i++) {
+		const profile_times *times = &phases[i];
+		fprintf(file, "%-18s", phase_names[i]);
+		if(profile_has_counter(COUNTER_CYCLES) && profile_has_counter(COUNTER_INSTRUCTIONS) && (times->counts[COUNTER_CYCLES] > 0)) {
+			fprintf(file, " %10.2f", (double)times->counts[COUNTER_INSTRUCTIONS] / times->counts[COUNTER_CYCLES]);
+		} else {
+			fprintf(file, " %10s", "-");
+		}
+		for(int c=0; c<NUM_COUNTERS; c++) {
+			if(profile_has_counter(c) && (frames > 0)) {
+				fprintf(file, " %12.1f", (double)times->counts[c] / frames);
+			} else {
+				fprintf(file, " %12s", "-");
+			}
+		}
+		fputc('\n', file);
+	}
+	if(counters_opened < NUM_COUNTERS) {
+		fprintf(file, "some hardware counters unavailable (%s)\n", strerror(counter_error));
+	}
+}
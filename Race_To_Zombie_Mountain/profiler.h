@@ -0,0 +1,146 @@
+/**
+ * profiler.h
+ *
+ * Times the phases of each frame, to find out where a frame's time goes. Build with PROFILE
+ * defined (make PROFILE=1) to turn it on. Otherwise PROFILE_BEGIN and PROFILE_END are empty, so
+ * the game is built exactly as if they weren't there.
+ *
+ * Each phase counts its times in a histogram with PROFILE_STEPS buckets for every doubling of time,
+ * from a nanosecond up, so every time from a nanosecond to centuries fits in a fixed number of
+ * buckets and nothing is ever allocated. The profiler also keeps the totals of the last whole
+ * second, for showing while the game runs.
+ *
+ * Building with PROFILE=counters also reads the processor's counters of cycles, instructions, cache
+ * misses and branch misses around each phase, through the kernel's perf events. Each read is a
+ * system call, so the times of short phases grow by about a microsecond. Where the counters can't be
+ * opened (such as in most containers), only the times are kept.
+ **/
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * The phases of a frame
+ **/
+typedef enum profile_phase {
+	PHASE_INPUT,
+	PHASE_SPEED,
+	PHASE_OBSTACLES,
+	PHASE_COLLISION,
+	PHASE_REFUEL,
+	PHASE_DASHBOARD,
+	PHASE_DRAW_OBSTACLES,
+	PHASE_DRAW_PLAYER,
+	PHASE_SHOW_SCREEN,
+	PHASE_FRAME,
+	NUM_PHASES
+} profile_phase;
+
+/**
+ * The hardware counters read around each phase
+ **/
+typedef enum profile_counter {
+	COUNTER_CYCLES,
+	COUNTER_INSTRUCTIONS,
+	COUNTER_CACHE_MISSES,
+	COUNTER_BRANCH_MISSES,
+	NUM_COUNTERS
+} profile_counter;
+
+/**
+ * The time and the counters at the start of a phase
+ **/
+typedef struct profile_mark {
+	uint64_t ns;
+	uint64_t counts[NUM_COUNTERS];
+} profile_mark;
+
+// The buckets for each doubling of time, and the number of buckets
+#define PROFILE_STEPS		4
+#define PROFILE_BUCKETS		(64 * PROFILE_STEPS)
+
+/**
+ * The times of one phase
+ **/
+typedef struct profile_times {
+	uint32_t buckets[PROFILE_BUCKETS];
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	// This second so far, and the last whole second
+	uint64_t second_count;
+	uint64_t second_total_ns;
+	uint64_t second_max_ns;
+	uint64_t last_count;
+	uint64_t last_total_ns;
+	uint64_t last_max_ns;
+	// The counters added up over every time the phase ran
+	uint64_t counts[NUM_COUNTERS];
+} profile_times;
+
+#if defined(PROFILE) && defined(PROFILE_COUNTERS)
+#define PROFILE_BEGIN(phase)	profile_mark profile_start_##phase; profile_mark_now(&profile_start_##phase)
+#define PROFILE_END(phase)		profile_add_since(phase, &profile_start_##phase)
+#elif defined(PROFILE)
+#define PROFILE_BEGIN(phase)	uint64_t profile_start_##phase = profile_now()
+#define PROFILE_END(phase)		profile_add(phase, profile_now() - profile_start_##phase)
+#else
+#define PROFILE_BEGIN(phase)
+#define PROFILE_END(phase)
+#endif
+
+/**
+ * The time in nanoseconds.
+ **/
+uint64_t profile_now();
+
+/**
+ * Counts a time taken by a phase.
+ **/
+void profile_add(profile_phase phase, uint64_t ns);
+
+/**
+ * Reads the time and the counters. The counters are opened the first time, on the thread that
+ * calls this.
+ **/
+void profile_mark_now(profile_mark *mark);
+
+/**
+ * Counts the time and the counters of a phase since its mark.
+ **/
+void profile_add_since(profile_phase phase, const profile_mark *start);
+
+/**
+ * Whether a counter could be opened.
+ **/
+bool profile_has_counter(profile_counter counter);
+
+/**
+ * Ends a frame, starting a new second of times once the last one is over.
+ **/
+void profile_end_frame();
+
+/**
+ * Gets the times of a phase.
+ **/
+const profile_times *profile_get(profile_phase phase);
+
+/**
+ * Gets the name of a phase.
+ **/
+const char *profile_name(profile_phase phase);
+
+/**
+ * Finds the time, in nanoseconds, that the given percentage of a phase's times are no longer than.
+ **/
+uint64_t profile_percentile(profile_phase phase, double percent);
+
+/**
+ * Prints a table of the times of every phase, and of the counters if any were read.
+ **/
+void profile_report(FILE *file);
+
+#endif
@@ -0,0 +1,128 @@
+/**
+ * renderer.c
+ *
+ * Frames drawn in the background. See renderer.h.
+ **/
+#include <string.h>
+#include "cab202_alloc.h"
+#include "cab202_output.h"
+#include "renderer.h"
+
+/**
+ * Takes the ready buffer if it holds a new frame, giving back the one that has been drawn
+ **/
+static bool renderer_take(renderer *renderer) {
+	if((__atomic_load_n(&renderer->ready, __ATOMIC_ACQUIRE) & RENDER_NEW_FRAME) == 0) {
+		return false;
+	}
+	unsigned int ready = __atomic_exchange_n(&renderer->ready, renderer->front, __ATOMIC_ACQ_REL);
+	renderer->front = ready & ~RENDER_NEW_FRAME;
+	return true;
+}
+
+/**
+ * Body of the render thread
+ **/
+static void *renderer_run(void *argument) {
+	renderer *renderer = argument;
+	while(true) {
+		pthread_mutex_lock(&renderer->lock);
+		while(((__atomic_load_n(&renderer->ready, __ATOMIC_ACQUIRE) & RENDER_NEW_FRAME) == 0) && !renderer->stopping) {
+			pthread_cond_wait(&renderer->published_frame, &renderer->lock);
+		}
+		bool stopping = renderer->stopping;
+		pthread_mutex_unlock(&renderer->lock);
+
+		if(renderer_take(renderer)) {
+			render_frame *frame = &renderer->frames[renderer->front];
+			for(int i=0; i<frame->num_stamps; i++) {
+				zdk_output_stamp(frame->stamps[i]);
+			}
+			zdk_output_frame(frame->cells, frame->width, frame->height);
+			renderer->rendered++;
+		} else if(stopping) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+bool renderer_start(renderer *renderer, int width, int height) {
+	memset(renderer, 0, sizeof(*renderer));
+	for(int i=0; i<3; i++) {
+		renderer->frames[i].capacity = (size_t)width * height;
+		renderer->frames[i].cells = zdk_malloc(renderer->frames[i].capacity);
+		if(renderer->frames[i].cells == NULL) {
+			renderer_stop(renderer);
+			return false;
+		}
+	}
+	renderer->back = 0;
+	renderer->ready = 1;
+	renderer->front = 2;
+
+	pthread_mutex_init(&renderer->lock, NULL);
+	pthread_cond_init(&renderer->published_frame, NULL);
+	if(pthread_create(&renderer->thread, NULL, renderer_run, renderer) != 0) {
+		pthread_cond_destroy(&renderer->published_frame);
+		pthread_mutex_destroy(&renderer->lock);
+		renderer_stop(renderer);
+		return false;
+	}
+	renderer->running = true;
+	return true;
+}
+
+void renderer_publish(renderer *renderer, const char *cells, int width, int height, const double *stamps,
+		int num_stamps) {
+	// The game's buffer is its own, so it can be made bigger without the render thread knowing
+	render_frame *frame = &renderer->frames[renderer->back];
+	size_t size = (size_t)width * height;
+	if(size > frame->capacity) {
+		char *bigger = zdk_realloc(frame->cells, size);
+		if(bigger == NULL) {
+			return;
+		}
+		frame->cells = bigger;
+		frame->capacity = size;
+	}
+	memcpy(frame->cells, cells, size);
+	frame->width = width;
+	frame->height = height;
+	for(int i=0; (i < num_stamps) && (frame->num_stamps < ZDK_OUTPUT_STAMPS); i++) {
+		frame->stamps[frame->num_stamps++] = stamps[i];
+	}
+
+	unsigned int ready = __atomic_exchange_n(&renderer->ready, renderer->back | RENDER_NEW_FRAME, __ATOMIC_ACQ_REL);
+	renderer->back = ready & ~RENDER_NEW_FRAME;
+	renderer->published++;
+	// A skipped frame keeps its stamps for the next frame published, as that is the one that shows 
+	// them. A drawn one has already handed them on
+	if(ready & RENDER_NEW_FRAME) {
+		renderer->skipped++;
+	} else {
+		renderer->frames[renderer->back].num_stamps = 0;
+	}
+
+	pthread_mutex_lock(&renderer->lock);
+	pthread_cond_signal(&renderer->published_frame);
+	pthread_mutex_unlock(&renderer->lock);
+}
+
+void renderer_stop(renderer *renderer) {
+	if(renderer->running) {
+		pthread_mutex_lock(&renderer->lock);
+		renderer->stopping = true;
+		pthread_cond_signal(&renderer->published_frame);
+		pthread_mutex_unlock(&renderer->lock);
+		pthread_join(renderer->thread, NULL);
+		pthread_cond_destroy(&renderer->published_frame);
+		pthread_mutex_destroy(&renderer->lock);
+		renderer->running = false;
+	}
+
+	for(int i=0; i<3; i++) {
+		zdk_free(renderer->frames[i].cells);
+		renderer->frames[i].cells = NULL;
+	}
+}
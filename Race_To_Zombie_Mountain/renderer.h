@@ -0,0 +1,79 @@
+/**
+ * renderer.h
+ *
+ * Draws frames on a thread of its own, so drawing them never holds up the game.
+ *
+ * The game composes each frame in the ZDK's screen as usual, then publishes a copy of it. Frames
+ * are passed through three buffers: the game fills one, the render thread draws another, and
+ * the third holds the newest frame that is ready. Publishing swaps the game's buffer with the ready
+ * one, and the render thread swaps the ready one with its own, so neither side ever waits for the
+ * other and the render thread always gets the newest frame. Frames published while the render
+ * thread was busy are skipped.
+ *
+ * The render thread hands each frame to the ZDK's write-behind output (see cab202_output.h), which
+ * works out the bytes that change the terminal to it on the render thread and queues them for its
+ * own writer thread, so not even the render thread waits for the terminal.
+ **/
+#ifndef RENDERER_H_
+#define RENDERER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "cab202_output.h"
+
+// Set on the index of the ready buffer when it holds a frame the render thread hasn't taken yet
+#define RENDER_NEW_FRAME	4
+
+/**
+ * One of the three buffers, with the stamps of what it shows (see zdk_output_stamp)
+ **/
+typedef struct render_frame {
+	int width;
+	int height;
+	char *cells;
+	size_t capacity;
+	double stamps[ZDK_OUTPUT_STAMPS];
+	int num_stamps;
+} render_frame;
+
+typedef struct renderer {
+	render_frame frames[3];
+	// The buffer the game fills, the one that is ready (with RENDER_NEW_FRAME when it is new), and
+	// the one being drawn
+	int back;
+	unsigned int ready;
+	int front;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t published_frame;
+	bool running;
+	bool stopping;
+
+	// Frames published, drawn and skipped
+	uint64_t published;
+	uint64_t rendered;
+	uint64_t skipped;
+} renderer;
+
+/**
+ * Starts drawing frames of the given size through the ZDK's write-behind output, which must have
+ * been started. Returns false if the thread couldn't be started.
+ **/
+bool renderer_start(renderer *renderer, int width, int height);
+
+/**
+ * Publishes a copy of a frame to be drawn, stamped with when the things it shows happened. The 
+ * stamps of a frame that is skipped are passed on to the next one. Never waits for the render thread.
+ **/
+void renderer_publish(renderer *renderer, const char *cells, int width, int height, const double *stamps,
+	int num_stamps);
+
+/**
+ * Draws the last frame published and stops the thread.
+ **/
+void renderer_stop(renderer *renderer);
+
+#endif
@@ -0,0 +1,261 @@
+/**
+ * rewind.c
+ *
+ * A fixed size, delta compressed history of a game's state. See rewind.h.
+ *
+ * A delta is a list of spans, each of which is the number of bytes left as they were since the
+ * last span, the number of bytes that changed, and then the changed bytes themselves.
+ **/
+#include <stdlib.h>
+#include <string.h>
+#include "cab202_alloc.h"
+#include "rewind.h"
+
+// The size of the start of a span (the bytes skipped and the bytes changed)
+#define SPAN_HEADER	(2 * sizeof(uint16_t))
+
+bool rewind_init(rewind_buffer *history, size_t budget, int max_frames, size_t max_state, int keyframe_frames) {
+	memset(history, 0, sizeof(*history));
+
+	// Everything the history uses comes out of the budget: the entries, the last state, room for a
+	// delta, and then the frames themselves, which must at least hold one keyframe
+	size_t entries_size = max_frames * sizeof(rewind_entry);
+	if((max_frames <= 0) || (max_state == 0) || (budget < entries_size + (3 * max_state))) {
+		return false;
+	}
+	uint8_t *memory = zdk_malloc(budget);
+	if(memory == NULL) {
+		return false;
+	}
+
+	history->entries = (rewind_entry *)memory;
+	history->max_entries = max_frames;
+	history->last = memory + entries_size;
+	history->delta = history->last + max_state;
+	history->max_state = max_state;
+	history->data = history->delta + max_state;
+	history->size = budget - entries_size - (2 * max_state);
+	history->keyframe_frames = (keyframe_frames > 0) ? keyframe_frames : 1;
+	return true;
+}
+
+void rewind_clear(rewind_buffer *history) {
+	history->head = 0;
+	history->first = 0;
+	history->count = 0;
+	history->last_length = 0;
+	history->since_keyframe = 0;
+}
+
+/**
+ * Gets the entry of a frame, numbered from the oldest
+ **/
+static rewind_entry *rewind_entry_at(const rewind_buffer *history, int frame) {
+	return &history->entries[(history->first + frame) % history->max_entries];
+}
+
+/**
+ * Drops the oldest keyframe along with the deltas that depend on it, so the oldest frame left is
+ * always a keyframe
+ **/
+static void rewind_drop(rewind_buffer *history) {
+	do {
+		history->first = (history->first + 1) % history->max_entries;
+		history->count--;
+	} while((history->count > 0) && !rewind_entry_at(history, 0)->keyframe);
+}
+
+/**
+ * Finds where a frame of the given length can go, dropping the oldest frames until there is room.
+ * The frames are kept whole, so a frame that won't fit before the end of the ring goes at its start
+ **/
+static uint32_t rewind_room(rewind_buffer *history, size_t length) {
+	while(history->count > 0) {
+		// The oldest frame is a keyframe, which is never empty, so the frames run from its start
+		// round to the head
+		size_t tail = rewind_entry_at(history, 0)->offset;
+		if(history->head > tail) {
+			if(history->head + length <= history->size) {
+				return history->head;
+			} else if(length <= tail) {
+				return 0;
+			}
+		} else if(history->head + length <= tail) {
+			return history->head;
+		}
+		rewind_drop(history);
+	}
+
+	history->head = 0;
+	return 0;
+}
+
+/**
+ * Writes the spans that turn one state into another. Gives up and returns the length of the state
+ * if the delta wouldn't be any smaller than the state itself
+ **/
+static size_t rewind_encode(const uint8_t *old, const uint8_t *new, size_t length, uint8_t *delta) {
+	size_t written = 0;
+	size_t last_end = 0;
+	size_t i = 0;
+	while(i < length) {
+		// Most of the state doesn't change, so skip over it a word at a time
+		uint64_t old_word;
+		uint64_t new_word;
+		while(i + sizeof(uint64_t) <= length) {
+			memcpy(&old_word, old + i, sizeof(uint64_t));
+			memcpy(&new_word, new + i, sizeof(uint64_t));
+			if(old_word != new_word) {
+				break;
+			}
+			i += sizeof(uint64_t);
+		}
+		while((i < length) && (old[i] == new[i])) {
+			i++;
+		}
+		if(i == length) {
+			break;
+		}
+
+		// A span carries on over any gap too short to be worth starting a new span for
+		size_t start = i;
+		size_t end = i + 1;
+		for(i++; (i < length) && (i - start < UINT16_MAX); i++) {
+			if(old[i] != new[i]) {
+				end = i + 1;
+			} else if(i - end >= SPAN_HEADER) {
+				break;
+			}
+		}
+		i = end;
+
+		size_t skip = start - last_end;
+		uint16_t span[2];
+		while(skip > UINT16_MAX) {
+			if(written + SPAN_HEADER >= length) {
+				return length;
+			}
+			span[0] = UINT16_MAX;
+			span[1] = 0;
+			memcpy(delta + written, span, SPAN_HEADER);
+			written += SPAN_HEADER;
+			skip -= UINT16_MAX;
+		}
+		if(written + SPAN_HEADER + (end - start) >= length) {
+			return length;
+		}
+		span[0] = skip;
+		span[1] = end - start;
+		memcpy(delta + written, span, SPAN_HEADER);
+		memcpy(delta + written + SPAN_HEADER, new + start, end - start);
+		written += SPAN_HEADER + (end - start);
+		last_end = end;
+	}
+	return written;
+}
+
+/**
+ * Applies the spans written by rewind_encode to a state
+ **/
+static void rewind_apply(const uint8_t *delta, size_t length, uint8_t *state) {
+	size_t at = 0;
+	size_t i = 0;
+	while(i < length) {
+		uint16_t span[2];
+		memcpy(span, delta + i, SPAN_HEADER);
+		i += SPAN_HEADER;
+		at += span[0];
+		memcpy(state + at, delta + i, span[1]);
+		at += span[1];
+		i += span[1];
+	}
+}
+
+bool rewind_record(rewind_buffer *history, const void *state, size_t length) {
+	if((length == 0) || (length > history->max_state)) {
+		rewind_clear(history);
+		return false;
+	}
+
+	bool keyframe = (history->count == 0) || (length != history->last_length)
+		|| (history->since_keyframe + 1 >= history->keyframe_frames);
+	const uint8_t *frame = state;
+	size_t frame_length = length;
+	if(!keyframe) {
+		frame_length = rewind_encode(history->last, state, length, history->delta);
+		frame = history->delta;
+		keyframe = (frame_length == length);
+	}
+	if(keyframe) {
+		frame = state;
+		frame_length = length;
+	}
+
+	if(history->count == history->max_entries) {
+		rewind_drop(history);
+	}
+	uint32_t offset = rewind_room(history, frame_length);
+	// Making room can drop the frames a delta was taken against, in which case keep the whole state
+	if(!keyframe && (history->count == 0)) {
+		keyframe = true;
+		frame = state;
+		frame_length = length;
+		offset = rewind_room(history, frame_length);
+	}
+
+	memcpy(history->data + offset, frame, frame_length);
+	rewind_entry *entry = rewind_entry_at(history, history->count);
+	entry->offset = offset;
+	entry->length = frame_length;
+	entry->state_length = length;
+	entry->keyframe = keyframe;
+	history->count++;
+	history->head = offset + frame_length;
+	history->since_keyframe = keyframe ? 0 : history->since_keyframe + 1;
+
+	memcpy(history->last, state, length);
+	history->last_length = length;
+	return true;
+}
+
+int rewind_frames(const rewind_buffer *history) {
+	return (history->count > 0) ? history->count - 1 : 0;
+}
+
+size_t rewind_back(rewind_buffer *history, int frames, void *state) {
+	if(history->count == 0) {
+		return 0;
+	}
+	if(frames > history->count - 1) {
+		frames = history->count - 1;
+	} else if(frames < 0) {
+		frames = 0;
+	}
+
+	// Start from the keyframe before the frame and apply every delta up to it
+	int target = history->count - 1 - frames;
+	int key = target;
+	while(!rewind_entry_at(history, key)->keyframe) {
+		key--;
+	}
+	rewind_entry *entry = rewind_entry_at(history, key);
+	size_t length = entry->state_length;
+	memcpy(state, history->data + entry->offset, length);
+	for(int i=key+1; i<=target; i++) {
+		entry = rewind_entry_at(history, i);
+		rewind_apply(history->data + entry->offset, entry->length, state);
+	}
+
+	// The frames after it won't happen now
+	history->count = target + 1;
+	history->head = entry->offset + entry->length;
+	history->since_keyframe = target - key;
+	memcpy(history->last, state, length);
+	history->last_length = length;
+	return length;
+}
+
+void rewind_free(rewind_buffer *history) {
+	zdk_free(history->entries);
+	memset(history, 0, sizeof(*history));
+}
@@ -0,0 +1,94 @@
+/**
+ * rewind.h
+ *
+ * A history of a game's state, one entry for every frame, that can be stepped back through.
+ *
+ * Only a few bytes of the state change from one frame to the next, so most frames are kept as a
+ * delta: the runs of bytes that changed since the frame before, and where they are. Every so often
+ * (and whenever a delta would be no smaller) the whole state is kept instead, as a keyframe. A
+ * frame is found again by copying the keyframe before it and applying the deltas that follow.
+ *
+ * All of the memory the history uses is allocated when it is prepared, and never grows. The entries
+ * are kept in a ring: once it is full, the oldest keyframe and the deltas that depend on it are
+ * dropped to make room for new frames.
+ **/
+#ifndef REWIND_H_
+#define REWIND_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Where a frame is kept in the history
+ **/
+typedef struct rewind_entry {
+	uint32_t offset;
+	uint32_t length;
+	// The size of the state, which only a keyframe can change
+	uint32_t state_length;
+	bool keyframe;
+} rewind_entry;
+
+/**
+ * The history of a game
+ **/
+typedef struct rewind_buffer {
+	// The frames, kept one after the other in a ring of bytes
+	uint8_t *data;
+	size_t size;
+	// Where the next frame goes
+	size_t head;
+	// The entry for each frame, oldest first, also in a ring
+	rewind_entry *entries;
+	int max_entries;
+	int first;
+	int count;
+	// The state of the newest frame, which the next delta is taken against
+	uint8_t *last;
+	size_t last_length;
+	// Room to build a delta in
+	uint8_t *delta;
+	size_t max_state;
+	// How often a keyframe is kept, and the number of frames since the last one
+	int keyframe_frames;
+	int since_keyframe;
+} rewind_buffer;
+
+/**
+ * Prepares an empty history that uses the given number of bytes in total, and can hold states of up
+ * to max_state bytes. A keyframe is kept at least every keyframe_frames frames, and at most
+ * max_frames frames are kept. Returns false if the budget is too small or out of memory.
+ **/
+bool rewind_init(rewind_buffer *history, size_t budget, int max_frames, size_t max_state, int keyframe_frames);
+
+/**
+ * Forgets every frame.
+ **/
+void rewind_clear(rewind_buffer *history);
+
+/**
+ * Adds the state of a new frame to the history. Returns false (forgetting every frame) if the
+ * state is larger than the history can hold.
+ **/
+bool rewind_record(rewind_buffer *history, const void *state, size_t length);
+
+/**
+ * The number of frames in the history that can be stepped back through.
+ **/
+int rewind_frames(const rewind_buffer *history);
+
+/**
+ * Rebuilds the state of the given number of frames before the newest one (or of the oldest frame,
+ * if there aren't that many), and forgets every frame after it. The state is written to the given
+ * memory, which must hold max_state bytes. Returns the size of the state, or 0 if the history is
+ * empty.
+ **/
+size_t rewind_back(rewind_buffer *history, int frames, void *state);
+
+/**
+ * Gives the history's memory back to the system.
+ **/
+void rewind_free(rewind_buffer *history);
+
+#endif
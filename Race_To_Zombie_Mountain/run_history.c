@@ -0,0 +1,204 @@
+/**
+ * run_history.c
+ *
+ * Columnar history of finished runs with a quantile sketch per statistic. See run_history.h.
+ **/
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include "run_history.h"
+
+// Identifies a history file, and the version of its layout
+#define RUN_HISTORY_MAGIC	0x48525a52
+#define RUN_HISTORY_VERSION	1
+
+/**
+ * The start of the history file. The blocks of columns follow straight after it
+ **/
+typedef struct run_history_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t block_size;
+	uint32_t num_stats;
+	// The number of complete runs in the file. Only updated once a run's columns are written
+	uint64_t runs;
+	run_sketch sketches[RUN_NUM_STATS];
+} run_history_header;
+
+// The size of a block of columns in the file
+#define RUN_HISTORY_BLOCK_BYTES	(RUN_NUM_STATS * RUN_HISTORY_BLOCK_SIZE * sizeof(int32_t))
+
+/**
+ * The offset in the file of one statistic of the run with the given number
+ **/
+static off_t run_history_offset(uint64_t run, int stat) {
+	uint64_t block = run / RUN_HISTORY_BLOCK_SIZE;
+	uint64_t slot = run % RUN_HISTORY_BLOCK_SIZE;
+
+	return sizeof(run_history_header) + (block * RUN_HISTORY_BLOCK_BYTES)
+		+ (((stat * RUN_HISTORY_BLOCK_SIZE) + slot) * sizeof(int32_t));
+}
+
+/**
+ * Reads the header, or prepares a new one if the file is empty. Returns false if the file isn't a
+ * history file we understand
+ **/
+static bool run_history_read_header(int fd, run_history_header *header) {
+	ssize_t length = pread(fd, header, sizeof(run_history_header), 0);
+	if(length == 0) {
+		memset(header, 0, sizeof(run_history_header));
+		header->magic = RUN_HISTORY_MAGIC;
+		header->version = RUN_HISTORY_VERSION;
+		header->block_size = RUN_HISTORY_BLOCK_SIZE;
+		header->num_stats = RUN_NUM_STATS;
+		return true;
+	}
+
+	return (length == sizeof(run_history_header)) && (header->magic == RUN_HISTORY_MAGIC)
+		&& (header->version == RUN_HISTORY_VERSION) && (header->block_size == RUN_HISTORY_BLOCK_SIZE)
+		&& (header->num_stats == RUN_NUM_STATS);
+}
+
+/**
+ * The bucket a positive value is counted in
+ **/
+static int run_sketch_bucket(int32_t value) {
+	static double log_gamma = 0;
+	if(log_gamma == 0) {
+		log_gamma = log1p(RUN_SKETCH_ACCURACY);
+	}
+
+	int bucket = (int)ceil(log(value) / log_gamma);
+	if(bucket < 0) {
+		bucket = 0;
+	} else if(bucket >= RUN_SKETCH_BUCKETS) {
+		bucket = RUN_SKETCH_BUCKETS - 1;
+	}
+	return bucket;
+}
+
+void run_sketch_add(run_sketch *sketch, int32_t value) {
+	if(value <= 0) {
+		sketch->zero++;
+	} else {
+		sketch->buckets[run_sketch_bucket(value)]++;
+	}
+	sketch->count++;
+}
+
+double run_sketch_percentile(const run_sketch *sketch, int32_t value) {
+	if(sketch->count == 0) {
+		return 0;
+	}
+
+	double below;
+	if(value <= 0) {
+		below = sketch->zero / 2.0;
+	} else {
+		int bucket = run_sketch_bucket(value);
+		below = sketch->zero + (sketch->buckets[bucket] / 2.0);
+		for(int i=0; i<bucket; i++) {
+			below += sketch->buckets[i];
+		}
+	}
+
+	return (100.0 * below) / sketch->count;
+}
+
+/**
+ * Writes the whole buffer at the given offset, retrying on short writes
+ **/
+static bool run_history_write_at(int fd, const void *buffer, size_t length, off_t offset) {
+	const char *bytes = buffer;
+	while(length > 0) {
+		ssize_t written = pwrite(fd, bytes, length, offset);
+		if(written <= 0) {
+			return false;
+		}
+		bytes += written;
+		length -= written;
+		offset += written;
+	}
+	return true;
+}
+
+bool run_history_append(const run_record *run, run_percentiles *percentiles) {
+	percentiles->runs = 0;
+
+	int fd = open(RUN_HISTORY_FILE, O_RDWR | O_CREAT, 0644);
+	if(fd < 0) {
+		return false;
+	}
+	if(flock(fd, LOCK_EX) != 0) {
+		close(fd);
+		return false;
+	}
+
+	run_history_header header;
+	bool ok = run_history_read_header(fd, &header);
+
+	if(ok) {
+		// Compare the run with the earlier ones before adding it to the sketches
+		percentiles->runs = header.runs;
+		for(int i=0; i<RUN_NUM_STATS; i++) {
+			percentiles->percentiles[i] = run_sketch_percentile(&header.sketches[i], run->stats[i]);
+			run_sketch_add(&header.sketches[i], run->stats[i]);
+		}
+
+		// Write the run's columns first, so a crash part way through leaves the header describing
+		// only complete runs
+		for(int i=0; ok && i<RUN_NUM_STATS; i++) {
+			ok = run_history_write_at(fd, &run->stats[i], sizeof(int32_t), run_history_offset(header.runs, i));
+		}
+		header.runs++;
+		ok = ok && run_history_write_at(fd, &header, sizeof(header), 0);
+	}
+
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	if(!ok) {
+		percentiles->runs = 0;
+	}
+	return ok;
+}
+
+int run_history_read_column(int stat, int32_t *values, int max_values) {
+	if((stat < 0) || (stat >= RUN_NUM_STATS)) {
+		return 0;
+	}
+
+	int fd = open(RUN_HISTORY_FILE, O_RDONLY);
+	if(fd < 0) {
+		return -1;
+	}
+	flock(fd, LOCK_SH);
+
+	run_history_header header;
+	int count = 0;
+	if(run_history_read_header(fd, &header)) {
+		if(header.runs < (uint64_t)max_values) {
+			max_values = header.runs;
+		}
+
+		// Each block holds the statistic for its runs in one contiguous run of values
+		while(count < max_values) {
+			int in_block = RUN_HISTORY_BLOCK_SIZE - (count % RUN_HISTORY_BLOCK_SIZE);
+			if(in_block > max_values - count) {
+				in_block = max_values - count;
+			}
+
+			size_t length = in_block * sizeof(int32_t);
+			if(pread(fd, values + count, length, run_history_offset(count, stat)) != (ssize_t)length) {
+				break;
+			}
+			count += in_block;
+		}
+	}
+
+	flock(fd, LOCK_UN);
+	close(fd);
+	return count;
+}
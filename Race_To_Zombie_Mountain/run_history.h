@@ -0,0 +1,94 @@
+/**
+ * run_history.h
+ *
+ * A history of every finished run, kept so a run can be compared with everyone else's.
+ *
+ * The history file is columnar: runs are grouped into blocks of RUN_HISTORY_BLOCK_SIZE, and each
+ * block stores every run's score, then every run's distance, and so on, so a single statistic can
+ * be read for all runs without touching the others.
+ *
+ * The file starts with a header that holds a streaming quantile sketch for each statistic. The
+ * sketches are updated whenever a run is appended, so the percentile of a value can be found in
+ * constant time however long the history gets. Each sketch is a histogram over logarithmically
+ * sized buckets, so a value's percentile is exact to within RUN_SKETCH_ACCURACY of the value.
+ *
+ * The file is written in the machine's own byte order and is locked while a run is appended, so
+ * several games can share it.
+ **/
+#ifndef RUN_HISTORY_H_
+#define RUN_HISTORY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The file every finished run is appended to
+#define RUN_HISTORY_FILE	"runs.history"
+
+// The number of runs grouped into each block of columns
+#define RUN_HISTORY_BLOCK_SIZE	256
+
+// Each sketch bucket covers values up to (1 + RUN_SKETCH_ACCURACY) times larger than the last
+#define RUN_SKETCH_ACCURACY	0.02
+// Enough buckets to cover values up to about 6e8 (over a week in milliseconds)
+#define RUN_SKETCH_BUCKETS	1024
+
+/**
+ * The statistics kept for each run. They are also the columns of the history file
+ **/
+#define RUN_SCORE		0
+#define RUN_DISTANCE	1
+#define RUN_TIME		2
+#define RUN_COLLISIONS	3
+#define RUN_NUM_STATS	4
+
+/**
+ * A finished run. The time is in milliseconds
+ **/
+typedef struct run_record {
+	int32_t stats[RUN_NUM_STATS];
+} run_record;
+
+/**
+ * A quantile sketch over one statistic. Values of 0 or below are all counted in the zero bucket
+ **/
+typedef struct run_sketch {
+	uint64_t count;
+	uint32_t zero;
+	uint32_t buckets[RUN_SKETCH_BUCKETS];
+} run_sketch;
+
+/**
+ * How a run compares with the runs that came before it. Each percentile is the percentage of
+ * earlier runs with a lower value (with ties counted as half)
+ **/
+typedef struct run_percentiles {
+	// The number of earlier runs (the percentiles are meaningless if this is 0)
+	uint64_t runs;
+	double percentiles[RUN_NUM_STATS];
+} run_percentiles;
+
+/**
+ * Appends a run to the history file, creating it if needed, and works out how the run compares
+ * with every run appended before it. Returns false if the history couldn't be updated, in which
+ * case the percentiles are left with no runs.
+ **/
+bool run_history_append(const run_record *run, run_percentiles *percentiles);
+
+/**
+ * Reads up to max_values values of a single statistic, oldest run first, into values. Returns the
+ * number of values read, or -1 if there is no history file.
+ **/
+int run_history_read_column(int stat, int32_t *values, int max_values);
+
+/**
+ * Adds a value to a sketch.
+ **/
+void run_sketch_add(run_sketch *sketch, int32_t value);
+
+/**
+ * Returns the percentage of the values in the sketch that are lower than the given value, with
+ * values equal to it counted as half.
+ **/
+double run_sketch_percentile(const run_sketch *sketch, int32_t value);
+
+#endif
@@ -0,0 +1,189 @@
+/**
+ * spawner.c
+ *
+ * Row by row blue noise placement of obstacles. See spawner.h.
+ **/
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "cab202_alloc.h"
+#include "spawner.h"
+
+/**
+ * Returns a random number (xorshift32)
+ **/
+static unsigned int spawner_random(spawner *spawner) {
+	spawner->seed ^= spawner->seed << 13;
+	spawner->seed ^= spawner->seed >> 17;
+	spawner->seed ^= spawner->seed << 5;
+	return spawner->seed;
+}
+
+/**
+ * Returns a random number between 0 and 1
+ **/
+static double spawner_random_unit(spawner *spawner) {
+	return spawner_random(spawner) / ((double)UINT_MAX + 1.0);
+}
+
+bool spawner_init(spawner *spawner, int width, int gap, unsigned int seed) {
+	memset(spawner, 0, sizeof(*spawner));
+
+	spawner->top_rows = zdk_malloc(width * sizeof(int));
+	if(spawner->top_rows == NULL) {
+		return false;
+	}
+	// Nothing has been placed yet, so every column is clear well below the first row
+	for(int i=0; i<width; i++) {
+		spawner->top_rows[i] = INT_MIN / 2;
+	}
+
+	spawner->width = width;
+	spawner->gap = gap;
+	// xorshift gets stuck on 0
+	spawner->seed = (seed == 0) ? 1 : seed;
+	return true;
+}
+
+void spawner_free(spawner *spawner) {
+	zdk_free(spawner->top_rows);
+	spawner->top_rows = NULL;
+}
+
+int spawner_add_lane(spawner *spawner, int min_x, int max_x, double density, int num_types, const int *widths, const int *heights) {
+	if(spawner->num_lanes == SPAWN_MAX_LANES) {
+		return -1;
+	}
+
+	spawn_lane *lane = &spawner->lanes[spawner->num_lanes];
+	lane->min_x = (min_x < 0) ? 0 : min_x;
+	lane->max_x = (max_x > spawner->width) ? spawner->width : max_x;
+	lane->density = density;
+	lane->credit = 0;
+	lane->num_types = num_types;
+	lane->widths = widths;
+	lane->heights = heights;
+
+	return spawner->num_lanes++;
+}
+
+void spawner_set_density(spawner *spawner, int lane, double density) {
+	spawner->lanes[lane].density = density;
+}
+
+void spawner_set_lane(spawner *spawner, int lane, int min_x, int max_x) {
+	spawner->lanes[lane].min_x = (min_x < 0) ? 0 : min_x;
+	spawner->lanes[lane].max_x = (max_x > spawner->width) ? spawner->width : max_x;
+}
+
+void spawner_reserve(spawner *spawner, int x, int width, int rows_ahead, int height) {
+	spawner->reservation.active = true;
+	spawner->reservation.x = x;
+	spawner->reservation.width = width;
+	spawner->reservation.first_row = spawner->row + rows_ahead;
+	spawner->reservation.height = height;
+}
+
+/**
+ * Checks if an obstacle can be placed at the given position of the next row without coming
+ * within the gap of any other obstacle or the reservation
+ **/
+static bool spawner_fits(const spawner *spawner, int x, int width, int height) {
+	int gap = spawner->gap;
+	int first_x = (x - gap < 0) ? 0 : (x - gap);
+	int last_x = (x + width + gap > spawner->width) ? spawner->width : (x + width + gap);
+
+	// Every obstacle in the columns around this one must end more than the gap below this row
+	for(int i=first_x; i<last_x; i++) {
+		if(spawner->top_rows[i] >= spawner->row - gap) {
+			return false;
+		}
+	}
+
+	const spawn_reservation *reserved = &spawner->reservation;
+	if(reserved->active) {
+		bool columns_overlap = (x < reserved->x + reserved->width + gap) && (reserved->x < x + width + gap);
+		bool rows_overlap = (spawner->row < reserved->first_row + reserved->height + gap) && (reserved->first_row < spawner->row + height + gap);
+		if(columns_overlap && rows_overlap) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int spawner_next_row(spawner *spawner, spawn_placement *placements, int max_placements) {
+	int count = 0;
+
+	for(int i=0; i<spawner->num_lanes; i++) {
+		spawn_lane *lane = &spawner->lanes[i];
+		int lane_width = lane->max_x - lane->min_x;
+		if((lane_width <= 0) || (lane->num_types == 0)) {
+			continue;
+		}
+
+		lane->credit += (lane->density * lane_width) / 100.0;
+		if(lane->credit > SPAWN_MAX_CREDIT) {
+			lane->credit = SPAWN_MAX_CREDIT;
+		}
+
+		// Less than a whole obstacle owed is placed early with the matching chance, so obstacles
+		// don't turn up at regular intervals. The lane then owes less than nothing for a while
+		bool early = (lane->credit < 1.0) && (spawner_random_unit(spawner) < lane->credit);
+		for(int attempt=0; (attempt < SPAWN_MAX_ATTEMPTS) && (count < max_placements); attempt++) {
+			if((lane->credit < 1.0) && !early) {
+				break;
+			}
+
+			int type = spawner_random(spawner) % lane->num_types;
+			int width = lane->widths[type];
+			int height = lane->heights[type];
+			if(width > lane_width) {
+				continue;
+			}
+			int x = lane->min_x + (spawner_random(spawner) % (lane_width - width + 1));
+
+			if(!spawner_fits(spawner, x, width, height)) {
+				continue;
+			}
+
+			for(int j=x; j<x+width; j++) {
+				spawner->top_rows[j] = spawner->row + height - 1;
+			}
+			placements[count].lane = i;
+			placements[count].type = type;
+			placements[count].x = x;
+			placements[count].width = width;
+			placements[count].height = height;
+			count++;
+
+			lane->credit -= 1.0;
+			early = false;
+		}
+	}
+
+	spawner->row++;
+	return count;
+}
+
+int spawner_capacity(int width, int rows, int gap, int num_types, const int *widths, const int *heights) {
+	if((width <= 0) || (num_types == 0)) {
+		return 0;
+	}
+
+	// Obstacles plus the gap above and to the right of them never overlap, so the number that fit
+	// is limited by the smallest of these areas
+	int min_area = INT_MAX;
+	int max_height = 0;
+	for(int i=0; i<num_types; i++) {
+		int area = (widths[i] + gap) * (heights[i] + gap);
+		if(area < min_area) {
+			min_area = area;
+		}
+		if(heights[i] > max_height) {
+			max_height = heights[i];
+		}
+	}
+
+	return (((width + gap) * (rows + max_height + gap)) / min_area) + 1;
+}
@@ -0,0 +1,128 @@
+/**
+ * spawner.h
+ *
+ * Decides where obstacles appear as the world scrolls, one row at a time.
+ *
+ * The world is split into lanes (the verges on either side of the road and the road itself),
+ * each with its own set of obstacle sizes and density. Every new row, each lane is given credit
+ * for the obstacles it should hold on average, and a bounded number of random positions are
+ * tried to spend it. A position is only taken if the obstacle would be at least the spawner's gap
+ * away from every other obstacle, which spreads the obstacles out evenly without lining them up
+ * (Poisson-disk, or blue noise, sampling).
+ *
+ * The spawner only remembers, for each column, the highest row an obstacle covers, so checking a
+ * position costs the width of the obstacle and the work done for a row is bounded by a constant.
+ *
+ * Rows are numbered upwards from 0, in the order they scroll into the world. An obstacle placed
+ * in a row has its bottom edge in that row.
+ **/
+#ifndef SPAWNER_H_
+#define SPAWNER_H_
+
+#include <stdbool.h>
+
+// The most lanes a spawner can have
+#define SPAWN_MAX_LANES		4
+// The most positions tried in each lane for each row
+#define SPAWN_MAX_ATTEMPTS	8
+// The most obstacles a lane can be owed. Stops a crowded lane saving up a burst of obstacles
+#define SPAWN_MAX_CREDIT	2.0
+
+/**
+ * A strip of columns that obstacles are placed in. Obstacles are placed entirely within
+ * [min_x, max_x). The density is the average number of obstacles for every 100 cells
+ **/
+typedef struct spawn_lane {
+	int min_x;
+	int max_x;
+	double density;
+	double credit;
+	int num_types;
+	const int *widths;
+	const int *heights;
+} spawn_lane;
+
+/**
+ * An obstacle the spawner has placed in the newest row
+ **/
+typedef struct spawn_placement {
+	int lane;
+	int type;
+	int x;
+	int width;
+	int height;
+} spawn_placement;
+
+/**
+ * An area that obstacles must keep clear of, such as a fuel station that is on its way
+ **/
+typedef struct spawn_reservation {
+	bool active;
+	int x;
+	int width;
+	int first_row;
+	int height;
+} spawn_reservation;
+
+/**
+ * The state of the spawner
+ **/
+typedef struct spawner {
+	int width;
+	// The highest row covered by an obstacle in each column
+	int *top_rows;
+	// The number of the next row to be placed
+	int row;
+	int gap;
+	unsigned int seed;
+	spawn_lane lanes[SPAWN_MAX_LANES];
+	int num_lanes;
+	spawn_reservation reservation;
+} spawner;
+
+/**
+ * Prepares a spawner for a world of the given width, with no lanes. Obstacles are kept at least
+ * gap cells apart. Returns false if out of memory.
+ **/
+bool spawner_init(spawner *spawner, int width, int gap, unsigned int seed);
+
+/**
+ * Releases the memory held by the spawner.
+ **/
+void spawner_free(spawner *spawner);
+
+/**
+ * Adds a lane of obstacles, which can be any of the given sizes. Returns the number of the
+ * lane, or -1 if the spawner has no room for more lanes.
+ **/
+int spawner_add_lane(spawner *spawner, int min_x, int max_x, double density, int num_types, const int *widths, const int *heights);
+
+/**
+ * Changes the density of a lane.
+ **/
+void spawner_set_density(spawner *spawner, int lane, double density);
+
+/**
+ * Moves a lane, such as when the road bends.
+ **/
+void spawner_set_lane(spawner *spawner, int lane, int min_x, int max_x);
+
+/**
+ * Keeps obstacles clear of an area starting the given number of rows after the next row to be
+ * placed. Replaces any earlier reservation.
+ **/
+void spawner_reserve(spawner *spawner, int x, int width, int rows_ahead, int height);
+
+/**
+ * Places the obstacles for the next row. Up to max_placements are written to placements and the
+ * number written is returned.
+ **/
+int spawner_next_row(spawner *spawner, spawn_placement *placements, int max_placements);
+
+/**
+ * Returns the most obstacles of the given sizes that can overlap the given number of consecutive 
+ * rows of a strip of columns, when they are kept at least gap cells apart.
+ **/
+int spawner_capacity(int width, int rows, int gap, int num_types, const int *widths, const int *heights);
+
+#endif
@@ -0,0 +1,201 @@
+/**
+ * spectate.c
+ *
+ * Frames published for spectators. See spectate.h.
+ **/
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cab202_alloc.h"
+#include "spectate.h"
+
+// Unchanged cells fewer than this between two changed ones are published again, as that is
+// smaller than starting another run
+#define SPECTATE_GAP	((int)sizeof(spectate_run))
+
+bool spectate_start(spectate *spectate, const char *name) {
+	memset(spectate, 0, sizeof(*spectate));
+	if((strlen(name) > SPECTATE_MAX_NAME) || (strchr(name, '/') != NULL)) {
+		return false;
+	}
+	snprintf(spectate->name, sizeof(spectate->name), SPECTATE_NAME_FORMAT, name);
+
+	// Start again from nothing, so spectators of an earlier game can't be confused by this one
+	shm_unlink(spectate->name);
+	int fd = shm_open(spectate->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if(fd < 0) {
+		return false;
+	}
+	// Readable by everyone, whatever the umask
+	fchmod(fd, 0644);
+	if(ftruncate(fd, SPECTATE_SHM_SIZE) != 0) {
+		close(fd);
+		shm_unlink(spectate->name);
+		return false;
+	}
+	void *memory = mmap(NULL, SPECTATE_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(memory == MAP_FAILED) {
+		shm_unlink(spectate->name);
+		return false;
+	}
+
+	spectate->header = memory;
+	spectate->ring = (char *)memory + sizeof(spectate_header);
+	spectate->header->version = SPECTATE_VERSION;
+	spectate->header->keyframe = SPECTATE_NO_KEYFRAME;
+	// Spectators only trust the memory once it is all set up
+	__atomic_store_n(&spectate->header->magic, SPECTATE_MAGIC, __ATOMIC_RELEASE);
+	return true;
+}
+
+/**
+ * Makes sure there is room for a frame of the given size, and for the largest record it can make
+ **/
+static bool spectate_fit(spectate *spectate, int width, int height) {
+	size_t cells = (size_t)width * height;
+	if(cells > spectate->last_capacity) {
+		char *last = zdk_realloc(spectate->last, cells);
+		if(last == NULL) {
+			return false;
+		}
+		spectate->last = last;
+		spectate->last_capacity = cells;
+	}
+	size_t size = sizeof(spectate_record) + cells + SPECTATE_ALIGN;
+	if(size > spectate->record_capacity) {
+		char *record = zdk_realloc(spectate->record, size);
+		if(record == NULL) {
+			return false;
+		}
+		spectate->record = record;
+		spectate->record_capacity = size;
+	}
+	return true;
+}
+
+/**
+ * Puts together the runs of cells that changed since the last frame, after the record. Returns
+ * false if they wouldn't be smaller than a keyframe
+ **/
+static bool spectate_delta(spectate *spectate, spectate_record *record, const char *cells, int width, int height,
+		size_t *size) {
+	size_t keyframe = (size_t)width * height;
+	char *at = spectate->record + sizeof(spectate_record);
+	size_t length = 0;
+	int runs = 0;
+	for(int y=0; y<height; y++) {
+		const char *row = cells + ((size_t)y * width);
+		const char *last = spectate->last + ((size_t)y * width);
+		int x = 0;
+		while(x < width) {
+			if(row[x] == last[x]) {
+				x++;
+				continue;
+			}
+			int end = x + 1;
+			for(int next=end; (next < width) && (next < end + SPECTATE_GAP); next++) {
+				if(row[next] != last[next]) {
+					end = next + 1;
+				}
+			}
+
+			spectate_run run = { x, y, end - x };
+			if((runs == UINT16_MAX) || (length + sizeof(run) + run.length >= keyframe)) {
+				return false;
+			}
+			memcpy(at + length, &run, sizeof(run));
+			memcpy(at + length + sizeof(run), row + x, run.length);
+			length += sizeof(run) + run.length;
+			runs++;
+			x = end;
+		}
+	}
+	record->runs = runs;
+	*size = length;
+	return true;
+}
+
+/**
+ * Copies bytes into the ring at a position, wrapping around its end
+ **/
+static void spectate_write(spectate *spectate, uint64_t position, const char *bytes, size_t length) {
+	size_t offset = position % SPECTATE_RING_SIZE;
+	size_t first = (length < SPECTATE_RING_SIZE - offset) ? length : SPECTATE_RING_SIZE - offset;
+	memcpy(spectate->ring + offset, bytes, first);
+	memcpy(spectate->ring, bytes + first, length - first);
+}
+
+void spectate_frame(spectate *spectate, const char *cells, int width, int height) {
+	if((spectate->header == NULL) || !spectate_fit(spectate, width, height)) {
+		return;
+	}
+
+	spectate_record record = { 0 };
+	record.frame = spectate->frames;
+	record.width = width;
+	record.height = height;
+	size_t payload;
+	bool resized = (width != spectate->last_width) || (height != spectate->last_height);
+	if(!resized && (spectate->since_keyframe + 1 < SPECTATE_KEYFRAME_FRAMES)
+			&& spectate_delta(spectate, &record, cells, width, height, &payload)) {
+		// Nothing changed, so there is nothing to publish
+		if(record.runs == 0) {
+			return;
+		}
+		record.kind = SPECTATE_DELTA;
+	} else {
+		record.kind = SPECTATE_KEYFRAME;
+		record.runs = 0;
+		payload = (size_t)width * height;
+		memcpy(spectate->record + sizeof(spectate_record), cells, payload);
+	}
+
+	size_t length = (sizeof(spectate_record) + payload + SPECTATE_ALIGN - 1) & ~(size_t)(SPECTATE_ALIGN - 1);
+	if(length > SPECTATE_MAX_RECORD) {
+		spectate->too_big++;
+		return;
+	}
+	record.length = length;
+	memcpy(spectate->record, &record, sizeof(record));
+
+	// Claim the bytes before overwriting them, so a spectator still copying them can tell
+	spectate_header *header = spectate->header;
+	uint64_t position = header->written;
+	__atomic_store_n(&header->reserved, position + length, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	spectate_write(spectate, position, spectate->record, length);
+	__atomic_store_n(&header->written, position + length, __ATOMIC_RELEASE);
+	if(record.kind == SPECTATE_KEYFRAME) {
+		__atomic_store_n(&header->keyframe, position, __ATOMIC_RELEASE);
+		spectate->since_keyframe = 0;
+		spectate->keyframes++;
+	} else {
+		spectate->since_keyframe++;
+	}
+	__atomic_store_n(&header->frames, spectate->frames + 1, __ATOMIC_RELEASE);
+
+	memcpy(spectate->last, cells, (size_t)width * height);
+	spectate->last_width = width;
+	spectate->last_height = height;
+	spectate->frames++;
+	spectate->bytes += length;
+}
+
+void spectate_stop(spectate *spectate) {
+	if(spectate->header != NULL) {
+		__atomic_store_n(&spectate->header->finished, 1, __ATOMIC_RELEASE);
+		munmap(spectate->header, SPECTATE_SHM_SIZE);
+		shm_unlink(spectate->name);
+		spectate->header = NULL;
+	}
+	zdk_free(spectate->last);
+	zdk_free(spectate->record);
+	spectate->last = NULL;
+	spectate->record = NULL;
+	spectate->last_capacity = 0;
+	spectate->record_capacity = 0;
+}
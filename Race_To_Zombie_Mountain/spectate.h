@@ -0,0 +1,52 @@
+/**
+ * spectate.h
+ *
+ * Publishes the frames the game draws into shared memory, for spectators to watch the race in
+ * their own terminals (see spectate_proto.h for how, and spectator.c for the spectators).
+ **/
+#ifndef SPECTATE_H_
+#define SPECTATE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "spectate_proto.h"
+
+typedef struct spectate {
+	char name[SPECTATE_MAX_NAME + 8];
+	spectate_header *header;
+	char *ring;
+
+	// The last frame published, and the record being put together
+	char *last;
+	size_t last_capacity;
+	int last_width;
+	int last_height;
+	char *record;
+	size_t record_capacity;
+	int since_keyframe;
+
+	// Frames published, keyframes among them, bytes published, and frames too big to publish
+	uint64_t frames;
+	uint64_t keyframes;
+	uint64_t bytes;
+	uint64_t too_big;
+} spectate;
+
+/**
+ * Creates the shared memory for the given name (replacing any left by an earlier game), readable
+ * by every local user. Returns false if it couldn't be.
+ **/
+bool spectate_start(spectate *spectate, const char *name);
+
+/**
+ * Publishes a frame of the given size, as a delta from the frame before it or as a keyframe.
+ **/
+void spectate_frame(spectate *spectate, const char *cells, int width, int height);
+
+/**
+ * Tells spectators the race is over, and removes the shared memory (spectators keep theirs).
+ **/
+void spectate_stop(spectate *spectate);
+
+#endif
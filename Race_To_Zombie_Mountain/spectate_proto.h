@@ -0,0 +1,88 @@
+/**
+ * spectate_proto.h
+ *
+ * The shared memory through which spectators watch a race (see spectate.h and spectator.c). The
+ * game publishes every frame it draws into a ring of records in the memory, and spectators map it
+ * read-only and follow the ring at their own pace. The game never knows they are there, so it does
+ * the same work however many are watching.
+ *
+ * A record is a keyframe (every cell of the screen) or a delta (the runs of cells that changed
+ * since the record before it). A keyframe is published every SPECTATE_KEYFRAME_FRAMES frames, and
+ * whenever the screen changes size. Positions in the ring count every byte ever published, so the
+ * record at position p is at offset p % SPECTATE_RING_SIZE, and may wrap around its end.
+ *
+ * The game moves reserved on before it writes a record and written on once it has. A spectator that
+ * copies a record and then finds reserved more than SPECTATE_RING_SIZE past where it started knows
+ * the record was overwritten while it copied. A spectator that is lapped like this, or that finds a
+ * keyframe newer than what it has read, skips to the latest keyframe.
+ *
+ * All fields are in the host's byte order, as both ends always run on the same machine.
+ **/
+#ifndef SPECTATE_PROTO_H_
+#define SPECTATE_PROTO_H_
+
+#include <stdint.h>
+
+// The shared memory is named after the name given to the race
+#define SPECTATE_NAME_FORMAT	"/race-%s"
+#define SPECTATE_MAX_NAME		64
+
+#define SPECTATE_MAGIC			0x52414345
+#define SPECTATE_VERSION		1
+
+// The size of the ring, and the largest record that can be published in it
+#define SPECTATE_RING_SIZE		(4 * 1024 * 1024)
+#define SPECTATE_MAX_RECORD		(SPECTATE_RING_SIZE / 4)
+
+#define SPECTATE_KEYFRAME_FRAMES	60
+
+// Records start on multiples of this
+#define SPECTATE_ALIGN			8
+
+// The position of the latest keyframe before there has been one
+#define SPECTATE_NO_KEYFRAME	UINT64_MAX
+
+enum spectate_kind {
+	SPECTATE_KEYFRAME = 1,
+	SPECTATE_DELTA = 2
+};
+
+/**
+ * The start of the shared memory. The ring follows it
+ **/
+typedef struct spectate_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t reserved;
+	uint64_t written;
+	uint64_t keyframe;
+	uint64_t frames;
+	// Set once the game has stopped publishing
+	uint32_t finished;
+	uint32_t padding;
+} spectate_header;
+
+/**
+ * A record. A keyframe is followed by width * height cells, a row after another. A delta is
+ * followed by its runs, each a spectate_run and then its cells
+ **/
+typedef struct spectate_record {
+	// Of the whole record, padded to SPECTATE_ALIGN
+	uint32_t length;
+	uint16_t kind;
+	uint16_t runs;
+	uint64_t frame;
+	uint16_t width;
+	uint16_t height;
+	uint32_t padding;
+} spectate_record;
+
+typedef struct spectate_run {
+	uint16_t x;
+	uint16_t y;
+	uint16_t length;
+} __attribute__((packed)) spectate_run;
+
+#define SPECTATE_SHM_SIZE		(sizeof(spectate_header) + SPECTATE_RING_SIZE)
+
+#endif
@@ -0,0 +1,228 @@
+/**
+ * spectator.c
+ *
+ * Watches a race published by a game started with -w <name>, in a terminal of its own (see
+ * spectate_proto.h). The shared memory is only read, so any number of spectators can watch
+ * without the game doing any more work, and none of them can get in its way. A spectator that falls
+ * behind skips to the latest keyframe. The top left of the race is shown if the terminal is smaller
+ * than the game's.
+ *
+ * Press q to stop watching.
+ *
+ * Usage: spectator <name>
+ **/
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cab202_graphics.h"
+#include "cab202_timers.h"
+#include "spectate_proto.h"
+
+// How often the ring is looked at, in milliseconds
+#define WATCH_INTERVAL	16
+
+static const spectate_header *header;
+static const char *ring;
+
+// The race as the spectator sees it, and whether it has had a keyframe to start from
+static char *race;
+static int race_width;
+static int race_height;
+static bool synced;
+
+// The next record to read, and one being read
+static uint64_t position;
+static char *record;
+
+// Records shown, and times the spectator skipped ahead to a keyframe
+static uint64_t watched;
+static uint64_t skipped;
+
+/**
+ * Copies bytes out of the ring at a position, wrapping around its end
+ **/
+static void ring_read(uint64_t at, void *bytes, size_t length) {
+	size_t offset = at % SPECTATE_RING_SIZE;
+	size_t first = (length < SPECTATE_RING_SIZE - offset) ? length : SPECTATE_RING_SIZE - offset;
+	memcpy(bytes, ring + offset, first);
+	memcpy((char *)bytes + first, ring, length - first);
+}
+
+/**
+ * Whether the game has claimed the bytes at a position since they were copied
+ **/
+static bool overwritten(uint64_t at) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&header->reserved, __ATOMIC_RELAXED) - at > SPECTATE_RING_SIZE;
+}
+
+/**
+ * Maps the shared memory of the named race
+ **/
+static bool attach(const char *name) {
+	char path[SPECTATE_MAX_NAME + 8];
+	snprintf(path, sizeof(path), SPECTATE_NAME_FORMAT, name);
+	int fd = shm_open(path, O_RDONLY, 0);
+	if(fd < 0) {
+		perror(path);
+		return false;
+	}
+	struct stat info;
+	if((fstat(fd, &info) != 0) || (info.st_size < (off_t)SPECTATE_SHM_SIZE)) {
+		fprintf(stderr, "%s: not a race\n", path);
+		close(fd);
+		return false;
+	}
+	void *memory = mmap(NULL, SPECTATE_SHM_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(memory == MAP_FAILED) {
+		perror(path);
+		return false;
+	}
+
+	header = memory;
+	ring = (const char *)memory + sizeof(spectate_header);
+	if((__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SPECTATE_MAGIC) || (header->version != SPECTATE_VERSION)) {
+		fprintf(stderr, "%s: not a race this spectator can watch\n", path);
+		return false;
+	}
+	record = malloc(SPECTATE_MAX_RECORD);
+	return record != NULL;
+}
+
+/**
+ * Applies a record that has been copied out of the ring. Returns false if it makes no sense
+ **/
+static bool apply(const spectate_record *info) {
+	const char *at = record + sizeof(spectate_record);
+	size_t payload = info->length - sizeof(spectate_record);
+	size_t cells = (size_t)info->width * info->height;
+	if(info->kind == SPECTATE_KEYFRAME) {
+		if(cells > payload) {
+			return false;
+		}
+		if((info->width != race_width) || (info->height != race_height)) {
+			char *resized = realloc(race, cells);
+			if(resized == NULL) {
+				return false;
+			}
+			race = resized;
+			race_width = info->width;
+			race_height = info->height;
+		}
+		memcpy(race, at, cells);
+		synced = true;
+		return true;
+	}
+
+	// A delta only makes sense on the frame before it
+	if(!synced || (info->kind != SPECTATE_DELTA) || (info->width != race_width) || (info->height != race_height)) {
+		return false;
+	}
+	const char *end = at + payload;
+	for(int i=0; i<info->runs; i++) {
+		spectate_run run;
+		if(at + sizeof(run) > end) {
+			return false;
+		}
+		memcpy(&run, at, sizeof(run));
+		at += sizeof(run);
+		if((at + run.length > end) || (run.y >= race_height) || (run.x + run.length > race_width)) {
+			return false;
+		}
+		memcpy(race + ((size_t)run.y * race_width) + run.x, at, run.length);
+		at += run.length;
+	}
+	return true;
+}
+
+/**
+ * Reads every record published since the last look, starting from the latest keyframe if it is
+ * newer than them (or they have been overwritten)
+ **/
+static void follow() {
+	uint64_t written = __atomic_load_n(&header->written, __ATOMIC_ACQUIRE);
+	uint64_t keyframe = __atomic_load_n(&header->keyframe, __ATOMIC_ACQUIRE);
+	if(keyframe == SPECTATE_NO_KEYFRAME) {
+		return;
+	}
+	if(!synced || (keyframe > position) || (written - position > SPECTATE_RING_SIZE)) {
+		if(synced && (keyframe > position)) {
+			skipped++;
+		}
+		position = keyframe;
+		synced = false;
+	}
+
+	while(position < written) {
+		spectate_record next;
+		ring_read(position, &next, sizeof(next));
+		if(overwritten(position) || (next.length < sizeof(next)) || (next.length > SPECTATE_MAX_RECORD)) {
+			synced = false;
+			return;
+		}
+		ring_read(position, record, next.length);
+		if(overwritten(position)) {
+			synced = false;
+			return;
+		}
+		if(!apply(&next)) {
+			synced = false;
+			return;
+		}
+		position += next.length;
+		watched++;
+	}
+}
+
+/**
+ * Draws the race as far as it fits
+ **/
+static void draw_race() {
+	clear_screen();
+	for(int y=0; (y < race_height) && (y < screen_height()); y++) {
+		for(int x=0; (x < race_width) && (x < screen_width()); x++) {
+			draw_char(x, y, race[((size_t)y * race_width) + x]);
+		}
+	}
+	show_screen();
+}
+
+int main(int argc, char *argv[]) {
+	if(argc != 2) {
+		fprintf(stderr, "usage: %s <name>\n", argv[0]);
+		return 2;
+	}
+	if(!attach(argv[1])) {
+		return 1;
+	}
+
+	// A slow terminal skips frames rather than holding up the spectator
+	zdk_write_behind = true;
+	setup_screen();
+	bool finished = false;
+	while(get_char() != 'q') {
+		follow();
+		if(synced) {
+			draw_race();
+		}
+
+		// Once the game has stopped and everything it published has been shown
+		bool stopped = __atomic_load_n(&header->finished, __ATOMIC_ACQUIRE);
+		if(stopped && (position == __atomic_load_n(&header->written, __ATOMIC_ACQUIRE))) {
+			finished = true;
+			break;
+		}
+		timer_pause(WATCH_INTERVAL);
+	}
+	cleanup_screen();
+
+	printf("%s: watched %llu frames, skipped ahead %llu times%s\n", argv[1],
+		(unsigned long long)watched, (unsigned long long)skipped, finished ? ", the race is over" : "");
+	return 0;
+}
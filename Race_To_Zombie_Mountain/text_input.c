@@ -0,0 +1,61 @@
+/**
+ * text_input.c
+ *
+ * Single line text box driven by the game loop. See text_input.h.
+ **/
+#include <string.h>
+#include <curses.h>
+#include "cab202_graphics.h"
+#include "text_input.h"
+
+// The character drawn where the next character will be typed
+#define TEXT_INPUT_CURSOR	'_'
+
+void text_input_init(text_input *input, int max_length) {
+	memset(input, 0, sizeof(text_input));
+	input->max_length = (max_length < TEXT_INPUT_MAX_LENGTH) ? max_length : TEXT_INPUT_MAX_LENGTH;
+}
+
+bool text_input_key(text_input *input, int key) {
+	if(input->done) {
+		return false;
+	}
+
+	switch(key) {
+		case '\n':
+		case '\r':
+		case KEY_ENTER:
+			input->done = true;
+			return true;
+		case KEY_BACKSPACE:
+		case 127:
+		case '\b':
+			if(input->length > 0) {
+				input->text[--input->length] = '\0';
+			}
+			return true;
+		default:
+			break;
+	}
+
+	// Spaces aren't allowed as the text is stored as a single word
+	if((key > ' ') && (key < 127) && (input->length < input->max_length)) {
+		input->text[input->length++] = key;
+		input->text[input->length] = '\0';
+		return true;
+	}
+
+	return false;
+}
+
+void text_input_draw(const text_input *input, const char *label, int y) {
+	int label_length = strlen(label);
+	// Leave room for the longest text so the box doesn't move while typing
+	int x = (screen_width() - (label_length + input->max_length + 1)) / 2;
+
+	draw_string(x, y, (char *)label);
+	draw_string(x + label_length, y, (char *)input->text);
+	if(!input->done) {
+		draw_char(x + label_length + input->length, y, TEXT_INPUT_CURSOR);
+	}
+}
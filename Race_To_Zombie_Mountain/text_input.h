@@ -0,0 +1,44 @@
+/**
+ * text_input.h
+ *
+ * A single line text box. It is fed key presses by the game loop one at a time and draws the
+ * text typed so far along with a cursor, so it never has to wait for input itself.
+ **/
+#ifndef TEXT_INPUT_H_
+#define TEXT_INPUT_H_
+
+#include <stdbool.h>
+
+// The longest text any text box can hold
+#define TEXT_INPUT_MAX_LENGTH	64
+
+/**
+ * The state of a text box
+ **/
+typedef struct text_input {
+	char text[TEXT_INPUT_MAX_LENGTH+1];
+	int length;
+	int max_length;
+	// Set once Enter has been pressed
+	bool done;
+} text_input;
+
+/**
+ * Empties the text box and sets the most characters that can be typed into it.
+ **/
+void text_input_init(text_input *input, int max_length);
+
+/**
+ * Handles a key press. Printable characters (other than spaces) are added to the end of the
+ * text, backspace removes the last character and Enter finishes the input. Returns true if the
+ * key was used.
+ **/
+bool text_input_key(text_input *input, int key);
+
+/**
+ * Draws the text typed so far, followed by a cursor while the input isn't finished, centered
+ * horizontally on the given row after the given label.
+ **/
+void text_input_draw(const text_input *input, const char *label, int y);
+
+#endif
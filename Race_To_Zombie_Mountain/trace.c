@@ -0,0 +1,145 @@
+/**
+ * trace.c
+ *
+ * The timeline of the game, written by a background thread. See trace.h.
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "cab202_alloc.h"
+#include "trace.h"
+
+// How long the thread sleeps between emptying the ring, in milliseconds
+#define TRACE_WRITE_INTERVAL	10
+
+bool trace_enabled;
+
+static trace_event *ring;
+static unsigned int head;
+static unsigned int tail;
+static uint64_t dropped;
+static uint64_t written;
+static uint64_t start_ns;
+static FILE *file;
+static pthread_t writer;
+static bool writing;
+
+/**
+ * The time in nanoseconds
+ **/
+static uint64_t trace_now() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+void trace_add(const char *name, char phase, int32_t value) {
+	unsigned int at = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+	unsigned int next = (at + 1) % TRACE_RING_SIZE;
+	if(next == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) {
+		dropped++;
+		return;
+	}
+
+	ring[at].name = name;
+	ring[at].time_ns = trace_now();
+	ring[at].phase = phase;
+	ring[at].value = value;
+	// Publish the event before the thread can see it
+	__atomic_store_n(&tail, next, __ATOMIC_RELEASE);
+}
+
+/**
+ * Writes every event in the ring to the file
+ **/
+static void trace_write_events() {
+	unsigned int at = __atomic_load_n(&head, __ATOMIC_RELAXED);
+	unsigned int end = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+	for(; at != end; at = (at + 1) % TRACE_RING_SIZE) {
+		const trace_event *event = &ring[at];
+		fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"game\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":1",
+			(written > 0) ? "," : "", event->name, event->phase, (event->time_ns - start_ns) / 1000.0);
+		if((event->phase == 'b') || (event->phase == 'e')) {
+			fprintf(file, ",\"id\":%d", event->value);
+		} else if(event->phase == 'i') {
+			fprintf(file, ",\"s\":\"t\",\"args\":{\"value\":%d}", event->value);
+		}
+		fputc('}', file);
+		written++;
+		// Hand the slot back as soon as it has been written
+		__atomic_store_n(&head, (at + 1) % TRACE_RING_SIZE, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * Body of the writer thread
+ **/
+static void *trace_run(void *argument) {
+	(void)argument;
+	struct timespec interval = { 0, TRACE_WRITE_INTERVAL * 1000000 };
+	while(__atomic_load_n(&writing, __ATOMIC_ACQUIRE)) {
+		trace_write_events();
+		nanosleep(&interval, NULL);
+	}
+	return NULL;
+}
+
+bool trace_start(const char *path) {
+	ring = zdk_malloc(TRACE_RING_SIZE * sizeof(trace_event));
+	file = fopen(path, "w");
+	if((ring == NULL) || (file == NULL)) {
+		zdk_free(ring);
+		ring = NULL;
+		if(file != NULL) {
+			fclose(file);
+			file = NULL;
+		}
+		return false;
+	}
+
+	head = 0;
+	tail = 0;
+	dropped = 0;
+	written = 0;
+	start_ns = trace_now();
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+
+	writing = true;
+	if(pthread_create(&writer, NULL, trace_run, NULL) != 0) {
+		writing = false;
+		fclose(file);
+		file = NULL;
+		zdk_free(ring);
+		ring = NULL;
+		return false;
+	}
+	trace_enabled = true;
+	return true;
+}
+
+void trace_stop() {
+	if(!trace_enabled) {
+		return;
+	}
+
+	trace_enabled = false;
+	__atomic_store_n(&writing, false, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+
+	// Nothing else adds events now, so write whatever the thread didn't get to
+	trace_write_events();
+	fputs("\n]}\n", file);
+	fclose(file);
+	file = NULL;
+	zdk_free(ring);
+	ring = NULL;
+}
+
+uint64_t trace_written() {
+	return written;
+}
+
+uint64_t trace_dropped() {
+	return dropped;
+}
@@ -0,0 +1,62 @@
+/**
+ * trace.h
+ *
+ * Records a timeline of what the game does, which can be opened in a trace viewer (such as
+ * chrome://tracing or Perfetto) as a Chrome trace-event JSON file.
+ *
+ * The game only stamps each event and puts it in a fixed size ring, which never allocates or
+ * waits. A background thread takes the events out of the ring and writes them to the file. If the
+ * thread ever falls so far behind that the ring is full, new events are dropped and counted.
+ **/
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The number of events the ring holds
+#define TRACE_RING_SIZE	(1 << 16)
+
+/**
+ * An event, as it is kept in the ring. The name must be a string that lives as long as the program
+ **/
+typedef struct trace_event {
+	const char *name;
+	uint64_t time_ns;
+	// The kind of event, as a trace-event phase: B and E begin and end a span, b and e begin and end
+	// a span that can overlap others (numbered by value), and i marks a moment
+	char phase;
+	int32_t value;
+} trace_event;
+
+// Whether events are being recorded
+extern bool trace_enabled;
+
+#define TRACE_BEGIN(name)			do { if(trace_enabled) { trace_add(name, 'B', 0); } } while(0)
+#define TRACE_END(name)				do { if(trace_enabled) { trace_add(name, 'E', 0); } } while(0)
+#define TRACE_ASYNC_BEGIN(name, id)	do { if(trace_enabled) { trace_add(name, 'b', id); } } while(0)
+#define TRACE_ASYNC_END(name, id)	do { if(trace_enabled) { trace_add(name, 'e', id); } } while(0)
+#define TRACE_INSTANT(name, value)	do { if(trace_enabled) { trace_add(name, 'i', value); } } while(0)
+
+/**
+ * Starts recording events to a file. Returns false if the file or the thread couldn't be made.
+ **/
+bool trace_start(const char *path);
+
+/**
+ * Adds an event to the ring. Use the TRACE_ macros, which skip this when not tracing.
+ **/
+void trace_add(const char *name, char phase, int32_t value);
+
+/**
+ * Writes every event left in the ring, finishes the file and stops the thread.
+ **/
+void trace_stop();
+
+/**
+ * The number of events written, and the number dropped because the ring was full.
+ **/
+uint64_t trace_written();
+uint64_t trace_dropped();
+
+#endif
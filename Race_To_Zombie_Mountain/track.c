@@ -0,0 +1,144 @@
+/**
+ * track.c
+ *
+ * Memory-mapped authored tracks. See track.h.
+ **/
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "track.h"
+
+size_t track_file_size(uint32_t num_rows, uint32_t num_obstacles) {
+	return sizeof(track_header) + (((size_t)num_rows + 1) * sizeof(track_index_entry))
+		+ ((size_t)num_obstacles * sizeof(world_obstacle));
+}
+
+bool track_open(track *track, const char *path) {
+	memset(track, 0, sizeof(*track));
+	track->fd = open(path, O_RDONLY);
+	if(track->fd < 0) {
+		return false;
+	}
+
+	struct stat info;
+	if((fstat(track->fd, &info) != 0) || (info.st_size < (off_t)sizeof(track_header))) {
+		close(track->fd);
+		return false;
+	}
+
+	track->length = info.st_size;
+	track->map = mmap(NULL, track->length, PROT_READ, MAP_PRIVATE, track->fd, 0);
+	if(track->map == MAP_FAILED) {
+		close(track->fd);
+		track->map = NULL;
+		return false;
+	}
+	// The rows are read in order, so let the kernel read ahead
+	madvise(track->map, track->length, MADV_SEQUENTIAL);
+
+	// Only the header is checked here, so opening a track doesn't read the whole file. Each row is
+	// checked as it is read. The peak obstacle counts size the game's sprites, so they can't be more
+	// than TRACK_WINDOW_ROWS rows can hold
+	track->header = (const track_header *)track->map;
+	const uint32_t most_in_window = TRACK_WINDOW_ROWS * WORLD_MAX_ROW_OBSTACLES;
+	if((track->header->magic != TRACK_MAGIC) || (track->header->version != TRACK_VERSION)
+			|| (track->length != track_file_size(track->header->num_rows, track->header->num_obstacles))
+			|| (track->header->max_terrain > most_in_window) || (track->header->max_hazards > most_in_window)) {
+		track_close(track);
+		return false;
+	}
+
+	track->index = (const track_index_entry *)(track->map + sizeof(track_header));
+	track->obstacles = (const world_obstacle *)(track->index + track->header->num_rows + 1);
+	return true;
+}
+
+void track_close(track *track) {
+	if(track->map != NULL) {
+		munmap(track->map, track->length);
+		close(track->fd);
+	}
+	memset(track, 0, sizeof(*track));
+}
+
+bool track_read_row(track *track, int row, world_row *world_row) {
+	if((track->map == NULL) || (row < 0) || ((uint32_t)row >= track->header->num_rows)) {
+		return false;
+	}
+
+	// The road has to be one the game can draw, on the track
+	const track_index_entry *entry = &track->index[row];
+	if((entry->road_type != WORLD_ROAD_STRAIGHT) || (entry->road_x < 0) || ((uint32_t)entry->road_x >= track->header->width)) {
+		return false;
+	}
+
+	uint32_t first = entry->first_obstacle;
+	uint32_t last = entry[1].first_obstacle;
+	if((first > last) || (last > track->header->num_obstacles) || (last - first > WORLD_MAX_ROW_OBSTACLES)) {
+		return false;
+	}
+
+	// The game looks up each obstacle's image by its kind and type, and it must be on the track
+	const world_obstacle *obstacles = &track->obstacles[first];
+	for(uint32_t i=0; i<last - first; i++) {
+		int types = (obstacles[i].kind == WORLD_TERRAIN) ? WORLD_TERRAIN_TYPES
+			: (obstacles[i].kind == WORLD_HAZARD) ? WORLD_HAZARD_TYPES : 0;
+		if((obstacles[i].type >= types) || (obstacles[i].x < 0) || ((uint32_t)obstacles[i].x >= track->header->width)) {
+			return false;
+		}
+	}
+
+	world_row->road_x = entry->road_x;
+	world_row->road_type = entry->road_type;
+	world_row->flags = entry->flags;
+	world_row->num_obstacles = last - first;
+	memcpy(world_row->obstacles, obstacles, (last - first) * sizeof(world_obstacle));
+	return true;
+}
+
+/**
+ * Gives back the whole pages of the file between what was last given back and the given offset
+ **/
+static void track_release_to(track *track, size_t *released, size_t offset) {
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	offset -= offset % page_size;
+	if(offset > *released) {
+		madvise(track->map + *released, offset - *released, MADV_DONTNEED);
+		*released = offset;
+	}
+}
+
+void track_release(track *track, int row) {
+	if((track->map == NULL) || (row <= 0)) {
+		return;
+	}
+	if((uint32_t)row > track->header->num_rows) {
+		row = track->header->num_rows;
+	}
+
+	uint32_t first_obstacle = track->index[row].first_obstacle;
+	if(first_obstacle > track->header->num_obstacles) {
+		first_obstacle = track->header->num_obstacles;
+	}
+
+	uint8_t *index_end = (uint8_t *)&track->index[row];
+	uint8_t *obstacles_end = (uint8_t *)&track->obstacles[first_obstacle];
+	track_release_to(track, &track->index_released, index_end - track->map);
+	if(track->obstacles_released == 0) {
+		track->obstacles_released = (uint8_t *)track->obstacles - track->map;
+		track->obstacles_released -= track->obstacles_released % sysconf(_SC_PAGESIZE);
+	}
+	track_release_to(track, &track->obstacles_released, obstacles_end - track->map);
+}
+
+void track_rewind(track *track) {
+	if(track->map == NULL) {
+		return;
+	}
+
+	madvise(track->map, track->length, MADV_DONTNEED);
+	track->index_released = 0;
+	track->obstacles_released = 0;
+}
@@ -0,0 +1,111 @@
+/**
+ * track.h
+ *
+ * Authored tracks, stored in a binary file that the game memory-maps and reads a row at a time.
+ * Track files are made from a text description by track_compile (see track_compile.c).
+ *
+ * A track file holds:
+ *  - a header
+ *  - an index with an entry for every row (plus one past the last row), holding the row's road
+ *    and flags and the number of the row's first obstacle
+ *  - every obstacle, in row order
+ *
+ * The obstacles of a row run from its first obstacle up to the next row's first obstacle, so any
+ * row can be found straight from its number. Only the pages of the file near the rows being read
+ * are ever loaded, and the pages of rows that have scrolled past are given back, so neither the
+ * time taken to open a track nor the memory it uses depend on its length.
+ *
+ * The file is written in the machine's own byte order.
+ **/
+#ifndef TRACK_H_
+#define TRACK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "world.h"
+
+// Identifies a track file, and the version of its layout
+#define TRACK_MAGIC		0x4b52545a
+#define TRACK_VERSION	1
+
+// The rows of the screen the peak obstacle counts in the header cover
+#define TRACK_WINDOW_ROWS	64
+
+/**
+ * The start of a track file
+ **/
+typedef struct track_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_rows;
+	uint32_t num_obstacles;
+	// The number of columns the track needs (the screen must be at least this wide)
+	uint32_t width;
+	// The most obstacles of each kind that are ever in TRACK_WINDOW_ROWS consecutive rows, so the
+	// game knows how many sprites it needs
+	uint32_t max_terrain;
+	uint32_t max_hazards;
+	uint32_t reserved;
+} track_header;
+
+/**
+ * An entry in the row index
+ **/
+typedef struct track_index_entry {
+	int16_t road_x;
+	uint8_t road_type;
+	uint8_t flags;
+	uint32_t first_obstacle;
+} track_index_entry;
+
+/**
+ * An open track
+ **/
+typedef struct track {
+	int fd;
+	uint8_t *map;
+	size_t length;
+	const track_header *header;
+	const track_index_entry *index;
+	const world_obstacle *obstacles;
+	// How much of the index and of the obstacles has been given back
+	size_t index_released;
+	size_t obstacles_released;
+} track;
+
+/**
+ * The size of a track file with the given number of rows and obstacles.
+ **/
+size_t track_file_size(uint32_t num_rows, uint32_t num_obstacles);
+
+/**
+ * Maps a track file into memory. Returns false if it can't be opened or isn't a track file, or if
+ * its header is damaged.
+ **/
+bool track_open(track *track, const char *path);
+
+/**
+ * Unmaps a track.
+ **/
+void track_close(track *track);
+
+/**
+ * Reads a row of the track. Returns false if the row is past the end of the track or is damaged,
+ * such as having a road or an obstacle of a kind or type the game doesn't have, or past the track's
+ * width.
+ **/
+bool track_read_row(track *track, int row, world_row *world_row);
+
+/**
+ * Gives back the memory holding the rows before the given one. They can still be read, but will
+ * have to be loaded from the file again.
+ **/
+void track_release(track *track, int row);
+
+/**
+ * Gives back all of the memory holding the track, ready to read it again from the start.
+ **/
+void track_rewind(track *track);
+
+#endif
@@ -0,0 +1,343 @@
+/**
+ * track_compile.c
+ *
+ * Compiles the text description of a track into a track file the game can map (see track.h).
+ *
+ * A description has one command per line. Rows are numbered upwards from 0, the row at the bottom
+ * of the screen when the race starts, and x coordinates are screen columns. The dashboard takes
+ * columns 0 to 20, so nothing may be placed there. Anything after a # is a comment.
+ *
+ *   length <rows>                     The number of rows in the track
+ *   road <row> <x>                    The left edge of the road is at x from this row onwards
+ *   terrain <row> <boulder|tree|grave> <x>
+ *   hazard <row> <spikes|triangle> <x>
+ *                                     An obstacle with its bottom left corner at (x, row)
+ *   fuel <row> <left|right>           A fuel station beside the road, with its bottom edge in row
+ *   finish <row>                      The finish line
+ *
+ * Every track needs a length, a road in row 0 and a finish line.
+ *
+ * Usage: track_compile <description> <track file>
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "track.h"
+
+// The sizes of things in the game, which must match main.c
+#define DASHBOARD_SIZE	20
+#define ROAD_WIDTH		20
+#define STATION_WIDTH	8
+
+/**
+ * An obstacle the description can name
+ **/
+typedef struct obstacle_type {
+	const char *name;
+	int kind;
+	int type;
+	int width;
+	int height;
+} obstacle_type;
+
+static const obstacle_type obstacle_types[] = {
+	{ "boulder", WORLD_TERRAIN, 0, 6, 3 },
+	{ "tree", WORLD_TERRAIN, 1, 7, 5 },
+	{ "grave", WORLD_TERRAIN, 2, 5, 4 },
+	{ "spikes", WORLD_HAZARD, 0, 7, 2 },
+	{ "triangle", WORLD_HAZARD, 1, 3, 3 },
+};
+#define NUM_OBSTACLE_TYPES	(sizeof(obstacle_types) / sizeof(obstacle_types[0]))
+
+/**
+ * An obstacle placed by the description
+ **/
+typedef struct placed_obstacle {
+	int row;
+	const obstacle_type *type;
+	int x;
+} placed_obstacle;
+
+/**
+ * Everything read from the description
+ **/
+typedef struct description {
+	int length;
+	// The road set by the description in each row, or -1 where it carries on from the row below
+	int *road_x;
+	uint8_t *flags;
+	placed_obstacle *obstacles;
+	int num_obstacles;
+	int max_obstacles;
+} description;
+
+static const char *source;
+static int line_number;
+
+/**
+ * Reports a mistake in the description and gives up
+ **/
+static void fail(const char *message) {
+	if(line_number > 0) {
+		fprintf(stderr, "%s:%d: %s\n", source, line_number, message);
+	} else {
+		fprintf(stderr, "%s: %s\n", source, message);
+	}
+	exit(1);
+}
+
+/**
+ * Checks that a row is inside the track
+ **/
+static void check_row(const description *track, int row) {
+	if(track->length == 0) {
+		fail("the length must come first");
+	}
+	if((row < 0) || (row >= track->length)) {
+		fail("row is outside the track");
+	}
+}
+
+/**
+ * Finds an obstacle by name
+ **/
+static const obstacle_type *find_type(const char *name, int kind) {
+	for(size_t i=0; i<NUM_OBSTACLE_TYPES; i++) {
+		if((obstacle_types[i].kind == kind) && (strcmp(obstacle_types[i].name, name) == 0)) {
+			return &obstacle_types[i];
+		}
+	}
+	fail("unknown obstacle");
+	return NULL;
+}
+
+/**
+ * Reads one command of the description
+ **/
+static void read_command(description *track, char *line) {
+	char command[16];
+	char name[16];
+	int row;
+	int x;
+	int count;
+
+	char *comment = strchr(line, '#');
+	if(comment != NULL) {
+		*comment = '\0';
+	}
+	if(sscanf(line, "%15s", command) != 1) {
+		return;
+	}
+
+	if(strcmp(command, "length") == 0) {
+		if((sscanf(line, "%*s %d %n", &row, &count) != 1) || (line[count] != '\0') || (row <= 0)) {
+			fail("expected: length <rows>");
+		}
+		if(track->length != 0) {
+			fail("the length is already set");
+		}
+		track->length = row;
+		track->road_x = malloc(row * sizeof(int));
+		track->flags = calloc(row, 1);
+		for(int i=0; i<row; i++) {
+			track->road_x[i] = -1;
+		}
+	} else if(strcmp(command, "road") == 0) {
+		if((sscanf(line, "%*s %d %d %n", &row, &x, &count) != 2) || (line[count] != '\0')) {
+			fail("expected: road <row> <x>");
+		}
+		check_row(track, row);
+		if(x - STATION_WIDTH <= DASHBOARD_SIZE) {
+			fail("no room for a fuel station between the dashboard and the road");
+		}
+		track->road_x[row] = x;
+	} else if((strcmp(command, "terrain") == 0) || (strcmp(command, "hazard") == 0)) {
+		if((sscanf(line, "%*s %d %15s %d %n", &row, name, &x, &count) != 3) || (line[count] != '\0')) {
+			fail("expected: terrain|hazard <row> <type> <x>");
+		}
+		check_row(track, row);
+		if(x <= DASHBOARD_SIZE) {
+			fail("obstacle is under the dashboard");
+		}
+		if(track->num_obstacles == track->max_obstacles) {
+			track->max_obstacles = (track->max_obstacles == 0) ? 256 : track->max_obstacles * 2;
+			track->obstacles = realloc(track->obstacles, track->max_obstacles * sizeof(placed_obstacle));
+		}
+		placed_obstacle *obstacle = &track->obstacles[track->num_obstacles++];
+		obstacle->row = row;
+		obstacle->type = find_type(name, (command[0] == 'h') ? WORLD_HAZARD : WORLD_TERRAIN);
+		obstacle->x = x;
+	} else if(strcmp(command, "fuel") == 0) {
+		if((sscanf(line, "%*s %d %15s %n", &row, name, &count) != 2) || (line[count] != '\0')) {
+			fail("expected: fuel <row> left|right");
+		}
+		check_row(track, row);
+		if(strcmp(name, "left") == 0) {
+			track->flags[row] |= WORLD_FUEL_LEFT;
+		} else if(strcmp(name, "right") == 0) {
+			track->flags[row] |= WORLD_FUEL_RIGHT;
+		} else {
+			fail("expected: fuel <row> left|right");
+		}
+	} else if(strcmp(command, "finish") == 0) {
+		if((sscanf(line, "%*s %d %n", &row, &count) != 1) || (line[count] != '\0')) {
+			fail("expected: finish <row>");
+		}
+		check_row(track, row);
+		track->flags[row] |= WORLD_FINISH;
+	} else {
+		fail("unknown command");
+	}
+}
+
+/**
+ * Orders obstacles by row
+ **/
+static int compare_obstacles(const void *a, const void *b) {
+	return ((const placed_obstacle *)a)->row - ((const placed_obstacle *)b)->row;
+}
+
+/**
+ * Finds the most obstacles of a kind that are ever in TRACK_WINDOW_ROWS consecutive rows
+ **/
+static uint32_t peak_obstacles(const description *track, int kind) {
+	// An obstacle from row r to row r+h-1 is in every window starting from r-TRACK_WINDOW_ROWS+1 to
+	// r+h-1, so count the windows it starts and stops being in
+	int tallest = 0;
+	for(size_t i=0; i<NUM_OBSTACLE_TYPES; i++) {
+		if(obstacle_types[i].height > tallest) {
+			tallest = obstacle_types[i].height;
+		}
+	}
+	int windows = track->length + tallest + TRACK_WINDOW_ROWS;
+	int *changes = calloc(windows + 1, sizeof(int));
+	for(int i=0; i<track->num_obstacles; i++) {
+		const placed_obstacle *obstacle = &track->obstacles[i];
+		if(obstacle->type->kind == kind) {
+			changes[obstacle->row] += 1;
+			changes[obstacle->row + obstacle->type->height + TRACK_WINDOW_ROWS - 1] -= 1;
+		}
+	}
+
+	uint32_t peak = 0;
+	int count = 0;
+	for(int i=0; i<=windows; i++) {
+		count += changes[i];
+		if((uint32_t)count > peak) {
+			peak = count;
+		}
+	}
+	free(changes);
+	return peak;
+}
+
+/**
+ * Writes the track file
+ **/
+static void write_track(const description *track, const char *path) {
+	track_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = TRACK_MAGIC;
+	header.version = TRACK_VERSION;
+	header.num_rows = track->length;
+	header.num_obstacles = track->num_obstacles;
+	header.max_terrain = peak_obstacles(track, WORLD_TERRAIN);
+	header.max_hazards = peak_obstacles(track, WORLD_HAZARD);
+
+	track_index_entry *index = calloc(track->length + 1, sizeof(track_index_entry));
+	world_obstacle *obstacles = malloc((track->num_obstacles + 1) * sizeof(world_obstacle));
+	int road_x = track->road_x[0];
+	int next = 0;
+	for(int row=0; row<=track->length; row++) {
+		index[row].first_obstacle = next;
+		if(row == track->length) {
+			break;
+		}
+
+		if(track->road_x[row] >= 0) {
+			road_x = track->road_x[row];
+		}
+		index[row].road_x = road_x;
+		index[row].road_type = WORLD_ROAD_STRAIGHT;
+		index[row].flags = track->flags[row];
+
+		// The screen has to fit the road, with a fuel station to its right
+		if((uint32_t)(road_x + ROAD_WIDTH + 1 + STATION_WIDTH) > header.width) {
+			header.width = road_x + ROAD_WIDTH + 1 + STATION_WIDTH;
+		}
+		for(; (next < track->num_obstacles) && (track->obstacles[next].row == row); next++) {
+			const placed_obstacle *placed = &track->obstacles[next];
+			if(next - index[row].first_obstacle == WORLD_MAX_ROW_OBSTACLES) {
+				fprintf(stderr, "%s: row %d has more than %d obstacles\n", source, row, WORLD_MAX_ROW_OBSTACLES);
+				exit(1);
+			}
+			obstacles[next].kind = placed->type->kind;
+			obstacles[next].type = placed->type->type;
+			obstacles[next].x = placed->x;
+			if((uint32_t)(placed->x + placed->type->width) > header.width) {
+				header.width = placed->x + placed->type->width;
+			}
+		}
+	}
+
+	FILE *file = fopen(path, "wb");
+	if((file == NULL)
+			|| (fwrite(&header, sizeof(header), 1, file) != 1)
+			|| (fwrite(index, sizeof(track_index_entry), track->length + 1, file) != (size_t)track->length + 1)
+			|| (fwrite(obstacles, sizeof(world_obstacle), track->num_obstacles, file) != (size_t)track->num_obstacles)
+			|| (fclose(file) != 0)) {
+		perror(path);
+		exit(1);
+	}
+
+	printf("%s: %d rows, %d obstacles (at most %u terrain and %u hazards on screen), %u columns wide\n",
+		path, track->length, track->num_obstacles, header.max_terrain, header.max_hazards, header.width);
+	free(index);
+	free(obstacles);
+}
+
+int main(int argc, char *argv[]) {
+	if(argc != 3) {
+		fprintf(stderr, "usage: %s <description> <track file>\n", argv[0]);
+		return 2;
+	}
+
+	source = argv[1];
+	FILE *file = fopen(source, "r");
+	if(file == NULL) {
+		perror(source);
+		return 1;
+	}
+
+	description track;
+	memset(&track, 0, sizeof(track));
+	char line[256];
+	while(fgets(line, sizeof(line), file) != NULL) {
+		line_number++;
+		read_command(&track, line);
+	}
+	fclose(file);
+
+	line_number = 0;
+	if(track.length == 0) {
+		fail("the track has no length");
+	}
+	if(track.road_x[0] < 0) {
+		fail("the track has no road in row 0");
+	}
+	bool finished = false;
+	for(int i=0; i<track.length; i++) {
+		finished = finished || (track.flags[i] & WORLD_FINISH);
+	}
+	if(!finished) {
+		fail("the track has no finish line");
+	}
+
+	qsort(track.obstacles, track.num_obstacles, sizeof(placed_obstacle), compare_obstacles);
+	write_track(&track, argv[2]);
+
+	free(track.road_x);
+	free(track.flags);
+	free(track.obstacles);
+	return 0;
+}
@@ -0,0 +1,54 @@
+/**
+ * world.h
+ *
+ * The world the car drives through, described one row at a time. Rows are numbered upwards from
+ * 0, in the order they scroll onto the screen, and the first rows fill the screen when a race
+ * starts. Whatever produces the rows (the procedural generator, the endurance mode stream or a
+ * track file) hands them to the game in this form.
+ **/
+#ifndef WORLD_H_
+#define WORLD_H_
+
+#include <stdint.h>
+
+// The most obstacles that can start in a single row
+#define WORLD_MAX_ROW_OBSTACLES	8
+
+// The kinds of obstacles (the same values the game uses for its images)
+#define WORLD_TERRAIN	0
+#define WORLD_HAZARD	1
+
+// The number of types of each kind of obstacle
+#define WORLD_TERRAIN_TYPES	3
+#define WORLD_HAZARD_TYPES	2
+
+// The types of road section
+#define WORLD_ROAD_STRAIGHT	1
+
+// Things that can appear in a row, other than obstacles
+#define WORLD_FUEL_LEFT		0x01	// A fuel station to the left of the road
+#define WORLD_FUEL_RIGHT	0x02	// A fuel station to the right of the road
+#define WORLD_FINISH		0x04	// The finish line
+
+/**
+ * An obstacle whose bottom edge is in the row
+ **/
+typedef struct world_obstacle {
+	uint8_t kind;
+	uint8_t type;
+	int16_t x;
+} world_obstacle;
+
+/**
+ * A single row of the world. A fuel station also has its bottom edge in the row
+ **/
+typedef struct world_row {
+	// The x coordinate of the left edge of the road, and the type of road section
+	int16_t road_x;
+	uint8_t road_type;
+	uint8_t flags;
+	uint8_t num_obstacles;
+	world_obstacle obstacles[WORLD_MAX_ROW_OBSTACLES];
+} world_row;
+
+#endif
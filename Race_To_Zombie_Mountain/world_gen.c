@@ -0,0 +1,202 @@
+/**
+ * world_gen.c
+ *
+ * Procedural generator of world rows. See world_gen.h.
+ **/
+#include <string.h>
+#include "world_gen.h"
+
+/**
+ * Returns a random number (xorshift32)
+ **/
+static unsigned int world_gen_random(world_gen *gen) {
+	gen->seed ^= gen->seed << 13;
+	gen->seed ^= gen->seed >> 17;
+	gen->seed ^= gen->seed << 5;
+	return gen->seed;
+}
+
+/**
+ * The tallest obstacle of any kind
+ **/
+static int world_gen_max_height(const world_gen_config *config) {
+	int max_height = 0;
+	for(int i=0; i<config->num_terrain_types; i++) {
+		if(config->terrain_heights[i] > max_height) {
+			max_height = config->terrain_heights[i];
+		}
+	}
+	for(int i=0; i<config->num_hazard_types; i++) {
+		if(config->hazard_heights[i] > max_height) {
+			max_height = config->hazard_heights[i];
+		}
+	}
+	return max_height;
+}
+
+/**
+ * Moves the spawner's lanes to either side of and onto the road
+ **/
+static void world_gen_place_lanes(world_gen *gen) {
+	const world_gen_config *config = &gen->config;
+	int margin = config->bends ? WORLD_BEND_MARGIN : 0;
+	int road_x = gen->road_x;
+
+	spawner_set_lane(&gen->spawner, gen->left_lane, config->min_x, road_x - margin);
+	spawner_set_lane(&gen->spawner, gen->right_lane, road_x + config->road_width + 1 + margin, config->max_x);
+	spawner_set_lane(&gen->spawner, gen->hazard_lane, road_x + 1 + margin, road_x + config->road_width - margin);
+}
+
+/**
+ * Picks the row of the next fuel station and which side of the road it is on
+ **/
+static void world_gen_next_station(world_gen *gen, int after_row) {
+	const world_gen_config *config = &gen->config;
+	int variance = (config->station_variance > 0) ? (world_gen_random(gen) % config->station_variance) : 0;
+
+	gen->station_row = after_row + config->station_delay + variance;
+	gen->station_flag = (world_gen_random(gen) % 2) ? WORLD_FUEL_LEFT : WORLD_FUEL_RIGHT;
+	gen->station_reserved = false;
+}
+
+bool world_gen_init(world_gen *gen, const world_gen_config *config) {
+	memset(gen, 0, sizeof(world_gen));
+	gen->config = *config;
+	gen->seed = (config->seed == 0) ? 1 : config->seed;
+
+	if(!spawner_init(&gen->spawner, config->max_x, config->gap, world_gen_random(gen))) {
+		return false;
+	}
+	gen->left_lane = spawner_add_lane(&gen->spawner, 0, 0, config->terrain_density,
+		config->num_terrain_types, config->terrain_widths, config->terrain_heights);
+	gen->right_lane = spawner_add_lane(&gen->spawner, 0, 0, config->terrain_density,
+		config->num_terrain_types, config->terrain_widths, config->terrain_heights);
+	gen->hazard_lane = spawner_add_lane(&gen->spawner, 0, 0, 0,
+		config->num_hazard_types, config->hazard_widths, config->hazard_heights);
+
+	gen->road_x = config->road_x;
+	world_gen_place_lanes(gen);
+
+	// The first fuel station appears the usual distance above the top of the screen
+	world_gen_next_station(gen, config->view_rows + 1);
+	return true;
+}
+
+void world_gen_free(world_gen *gen) {
+	spawner_free(&gen->spawner);
+}
+
+/**
+ * Lets the road wander, unless a fuel station is close by
+ **/
+static void world_gen_bend(world_gen *gen) {
+	const world_gen_config *config = &gen->config;
+	if(!config->bends || gen->station_reserved || (gen->row <= gen->straight_until)) {
+		return;
+	}
+
+	if((world_gen_random(gen) % WORLD_BEND_CHANGE) == 0) {
+		gen->bend = (int)(world_gen_random(gen) % 3) - 1;
+	}
+	if((gen->bend != 0) && (gen->row >= gen->next_bend_row) && ((world_gen_random(gen) % 2) == 0)) {
+		// Leave room on both sides for a fuel station and the widest obstacle
+		int verge = config->station_width + WORLD_BEND_MARGIN + 1;
+		int min_road_x = config->min_x + verge;
+		int max_road_x = config->max_x - config->road_width - 1 - verge;
+
+		gen->road_x += gen->bend;
+		if((gen->road_x < min_road_x) || (gen->road_x > max_road_x)) {
+			gen->road_x -= gen->bend;
+			gen->bend = -gen->bend;
+		}
+		gen->next_bend_row = gen->row + WORLD_BEND_ROWS;
+	}
+	world_gen_place_lanes(gen);
+}
+
+void world_gen_row(world_gen *gen, world_row *row) {
+	const world_gen_config *config = &gen->config;
+	memset(row, 0, sizeof(world_row));
+
+	world_gen_bend(gen);
+
+	// Keep the terrain out of the way of the next fuel station, once it is close enough that the
+	// road won't move before it arrives
+	int lookahead = world_gen_max_height(config) + config->gap + 1;
+	if(!gen->station_reserved && (gen->row >= gen->station_row - lookahead)) {
+		if(gen->station_flag == WORLD_FUEL_LEFT) {
+			gen->station_x = gen->road_x - config->station_width;
+		} else {
+			gen->station_x = gen->road_x + config->road_width + 1;
+		}
+		spawner_reserve(&gen->spawner, gen->station_x, config->station_width, gen->station_row - gen->row, config->station_height);
+		gen->station_reserved = true;
+	}
+
+	if(gen->row == config->safe_rows) {
+		spawner_set_density(&gen->spawner, gen->hazard_lane, config->hazard_density);
+	}
+
+	spawn_placement placements[WORLD_MAX_ROW_OBSTACLES];
+	int count = spawner_next_row(&gen->spawner, placements, WORLD_MAX_ROW_OBSTACLES);
+	for(int i=0; i<count; i++) {
+		row->obstacles[i].kind = (placements[i].lane == gen->hazard_lane) ? WORLD_HAZARD : WORLD_TERRAIN;
+		row->obstacles[i].type = placements[i].type;
+		row->obstacles[i].x = placements[i].x;
+	}
+	row->num_obstacles = count;
+
+	row->road_x = gen->road_x;
+	row->road_type = WORLD_ROAD_STRAIGHT;
+
+	if(gen->row == gen->station_row) {
+		row->flags |= gen->station_flag;
+		gen->straight_until = gen->row + config->station_height;
+		// The next one comes once this one has scrolled off the bottom of the screen
+		world_gen_next_station(gen, gen->row + config->view_rows + config->station_height);
+	}
+	if(gen->row == config->view_rows + config->race_rows) {
+		row->flags |= WORLD_FINISH;
+	}
+
+	gen->row++;
+}
+
+size_t world_gen_state_size(const world_gen *gen) {
+	return sizeof(world_gen) + (gen->spawner.width * sizeof(int));
+}
+
+void world_gen_save(const world_gen *gen, void *state) {
+	memcpy(state, gen, sizeof(world_gen));
+	memcpy((char *)state + sizeof(world_gen), gen->spawner.top_rows, gen->spawner.width * sizeof(int));
+}
+
+void world_gen_load(world_gen *gen, const void *state) {
+	// Keep the pointers of this generator, which are the only things that can't be saved
+	world_gen_config config = gen->config;
+	int *top_rows = gen->spawner.top_rows;
+	spawn_lane lanes[SPAWN_MAX_LANES];
+	memcpy(lanes, gen->spawner.lanes, sizeof(lanes));
+
+	memcpy(gen, state, sizeof(world_gen));
+	gen->config.terrain_widths = config.terrain_widths;
+	gen->config.terrain_heights = config.terrain_heights;
+	gen->config.hazard_widths = config.hazard_widths;
+	gen->config.hazard_heights = config.hazard_heights;
+	gen->spawner.top_rows = top_rows;
+	for(int i=0; i<SPAWN_MAX_LANES; i++) {
+		gen->spawner.lanes[i].widths = lanes[i].widths;
+		gen->spawner.lanes[i].heights = lanes[i].heights;
+	}
+	memcpy(top_rows, (const char *)state + sizeof(world_gen), gen->spawner.width * sizeof(int));
+}
+
+int world_gen_capacity(const world_gen_config *config, int kind, int rows) {
+	if(kind == WORLD_HAZARD) {
+		// A bending road can sweep its hazards across the whole world
+		int width = config->bends ? (config->max_x - config->min_x) : config->road_width;
+		return spawner_capacity(width, rows, config->gap, config->num_hazard_types, config->hazard_widths, config->hazard_heights);
+	}
+
+	return spawner_capacity(config->max_x - config->min_x, rows, config->gap, config->num_terrain_types, config->terrain_widths, config->terrain_heights);
+}
@@ -0,0 +1,131 @@
+/**
+ * world_gen.h
+ *
+ * Procedural generator of world rows. Terrain and hazards are placed by a spawner (see
+ * spawner.h), fuel stations turn up at the same spacing the game has always used and the finish
+ * line comes after the requested number of rows. The road can optionally wander from side to
+ * side, which it never does near a fuel station.
+ *
+ * A generator only ever moves forwards, so the same seed and configuration always produce the
+ * same world.
+ **/
+#ifndef WORLD_GEN_H_
+#define WORLD_GEN_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "world.h"
+#include "spawner.h"
+
+// The fewest rows between the road moving sideways while it is bending, and how often it changes 
+// direction (on average, in rows)
+#define WORLD_BEND_ROWS		4
+#define WORLD_BEND_CHANGE	40
+// The columns kept clear between the road and the obstacles beside it while it can bend. The road
+// moves at most one column every WORLD_BEND_ROWS rows, so this keeps it from bending into any
+// obstacle up to WORLD_BEND_MARGIN * WORLD_BEND_ROWS rows tall
+#define WORLD_BEND_MARGIN	2
+
+/**
+ * Everything the generator needs to know about the game
+ **/
+typedef struct world_gen_config {
+	// The columns obstacles can go in, and the width of the road
+	int min_x;
+	int max_x;
+	int road_width;
+	// The x coordinate of the left edge of the road in the first row
+	int road_x;
+	// The number of rows on the screen
+	int view_rows;
+	// The number of rows between the top of the screen when the race starts and the finish line
+	int race_rows;
+	// The number of rows at the start with no hazards, to give the player a clear run
+	int safe_rows;
+	// Whether the road can bend
+	bool bends;
+	// The average number of obstacles for every 100 cells, and the fewest cells between them
+	double terrain_density;
+	double hazard_density;
+	int gap;
+	// The sizes of every type of obstacle
+	int num_terrain_types;
+	const int *terrain_widths;
+	const int *terrain_heights;
+	int num_hazard_types;
+	const int *hazard_widths;
+	const int *hazard_heights;
+	// The size of the fuel stations, how many rows there are between them (after one has passed
+	// the bottom of the screen) and how much that varies
+	int station_width;
+	int station_height;
+	int station_delay;
+	int station_variance;
+	unsigned int seed;
+} world_gen_config;
+
+/**
+ * The state of a generator
+ **/
+typedef struct world_gen {
+	world_gen_config config;
+	spawner spawner;
+	int left_lane;
+	int right_lane;
+	int hazard_lane;
+	// The number of the next row to be generated
+	int row;
+	// Where the road is and which way it is bending (-1, 0 or 1)
+	int road_x;
+	int bend;
+	// The first row the road can next move sideways in
+	int next_bend_row;
+	// The row of the next fuel station, which side it is on (a WORLD_FUEL_* flag) and its x
+	// coordinate (once the space for it has been reserved)
+	int station_row;
+	int station_flag;
+	int station_x;
+	bool station_reserved;
+	// The road stays straight up to this row, so it doesn't bend away from a fuel station
+	int straight_until;
+	unsigned int seed;
+} world_gen;
+
+/**
+ * Prepares a generator. Returns false if out of memory.
+ **/
+bool world_gen_init(world_gen *gen, const world_gen_config *config);
+
+/**
+ * Releases the memory held by a generator.
+ **/
+void world_gen_free(world_gen *gen);
+
+/**
+ * Generates the next row.
+ **/
+void world_gen_row(world_gen *gen, world_row *row);
+
+/**
+ * Returns the number of bytes world_gen_save needs to save a generator.
+ **/
+size_t world_gen_state_size(const world_gen *gen);
+
+/**
+ * Saves everything about a generator, so it can carry on from the same row later.
+ **/
+void world_gen_save(const world_gen *gen, void *state);
+
+/**
+ * Puts a generator back into a state saved by world_gen_save. The generator must have been
+ * prepared with the same configuration, apart from the seed.
+ **/
+void world_gen_load(world_gen *gen, const void *state);
+
+/**
+ * Returns the most obstacles of the given kind that can overlap the given number of consecutive
+ * rows of a world made by a generator with this configuration.
+ **/
+int world_gen_capacity(const world_gen_config *config, int kind, int rows);
+
+#endif
@@ -0,0 +1,140 @@
+/**
+ * world_stream.c
+ *
+ * Background generation of the world in chunks for endurance races. See world_stream.h.
+ **/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "cab202_alloc.h"
+#include "world_stream.h"
+
+#define WORLD_QUEUE_SIZE	(WORLD_STREAM_CHUNKS + 1)
+
+/**
+ * Adds a chunk to a queue. Only ever called from the queue's one producer
+ **/
+static void world_queue_push(world_chunk_queue *queue, world_chunk *chunk) {
+	unsigned int tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	queue->chunks[tail] = chunk;
+	// Publish the chunk (and everything written to it) before the consumer can see it
+	__atomic_store_n(&queue->tail, (tail + 1) % WORLD_QUEUE_SIZE, __ATOMIC_RELEASE);
+}
+
+/**
+ * Takes a chunk from a queue, or returns NULL if it is empty. Only ever called from the queue's
+ * one consumer
+ **/
+static world_chunk *world_queue_pop(world_chunk_queue *queue) {
+	unsigned int head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	if(head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+
+	world_chunk *chunk = queue->chunks[head];
+	__atomic_store_n(&queue->head, (head + 1) % WORLD_QUEUE_SIZE, __ATOMIC_RELEASE);
+	return chunk;
+}
+
+/**
+ * Body of the generator thread. Refills chunks as the game hands them back
+ **/
+static void *world_stream_run(void *argument) {
+	world_stream *stream = argument;
+
+	while(true) {
+		if(sem_wait(&stream->spent_count) != 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if(!__atomic_load_n(&stream->running, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+
+		world_chunk *chunk = world_queue_pop(&stream->spent);
+		if(chunk == NULL) {
+			continue;
+		}
+
+		chunk->first_row = stream->gen->row;
+		for(int i=0; i<WORLD_CHUNK_ROWS; i++) {
+			world_gen_row(stream->gen, &chunk->rows[i]);
+		}
+		world_queue_push(&stream->ready, chunk);
+	}
+
+	return NULL;
+}
+
+bool world_stream_start(world_stream *stream, world_gen *gen) {
+	memset(stream, 0, sizeof(world_stream));
+	stream->gen = gen;
+
+	stream->chunks = zdk_malloc(WORLD_STREAM_CHUNKS * sizeof(world_chunk));
+	if(stream->chunks == NULL) {
+		return false;
+	}
+	if(sem_init(&stream->spent_count, 0, 0) != 0) {
+		zdk_free(stream->chunks);
+		return false;
+	}
+
+	// Fill the first chunk straight away, so the start of the race is ready as soon as we return.
+	// The rest start out waiting to be filled by the thread
+	stream->chunks[0].first_row = gen->row;
+	for(int i=0; i<WORLD_CHUNK_ROWS; i++) {
+		world_gen_row(gen, &stream->chunks[0].rows[i]);
+	}
+	world_queue_push(&stream->ready, &stream->chunks[0]);
+	for(int i=1; i<WORLD_STREAM_CHUNKS; i++) {
+		world_queue_push(&stream->spent, &stream->chunks[i]);
+		sem_post(&stream->spent_count);
+	}
+
+	stream->running = true;
+	if(pthread_create(&stream->thread, NULL, world_stream_run, stream) != 0) {
+		sem_destroy(&stream->spent_count);
+		zdk_free(stream->chunks);
+		stream->chunks = NULL;
+		return false;
+	}
+	return true;
+}
+
+bool world_stream_next_row(world_stream *stream, world_row *row) {
+	if((stream->current == NULL) || (stream->position == WORLD_CHUNK_ROWS)) {
+		world_chunk *next = world_queue_pop(&stream->ready);
+		if(next == NULL) {
+			stream->underruns++;
+			return false;
+		}
+
+		// Hand the chunk we've scrolled past back to be refilled
+		if(stream->current != NULL) {
+			world_queue_push(&stream->spent, stream->current);
+			sem_post(&stream->spent_count);
+		}
+		stream->current = next;
+		stream->position = 0;
+	}
+
+	*row = stream->current->rows[stream->position++];
+	return true;
+}
+
+void world_stream_stop(world_stream *stream) {
+	if(stream->chunks == NULL) {
+		return;
+	}
+
+	__atomic_store_n(&stream->running, false, __ATOMIC_RELEASE);
+	sem_post(&stream->spent_count);
+	pthread_join(stream->thread, NULL);
+
+	sem_destroy(&stream->spent_count);
+	zdk_free(stream->chunks);
+	stream->chunks = NULL;
+	stream->current = NULL;
+}
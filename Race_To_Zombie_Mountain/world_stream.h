@@ -0,0 +1,81 @@
+/**
+ * world_stream.h
+ *
+ * Streams an endless world to the game for endurance races. A background thread runs a world
+ * generator ahead of the camera, filling fixed size chunks of rows. Filled chunks are passed to
+ * the game through a lock-free single producer, single consumer queue, and the game hands each
+ * chunk back through a second queue once it has scrolled past it, so the thread can refill it.
+ *
+ * There are only ever WORLD_STREAM_CHUNKS chunks, so the memory used doesn't depend on how far
+ * the race goes. The game never waits for the thread: if it ever catches up with the generator,
+ * it is told there is no row ready yet.
+ **/
+#ifndef WORLD_STREAM_H_
+#define WORLD_STREAM_H_
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "world.h"
+#include "world_gen.h"
+
+// The number of rows in a chunk, and the number of chunks
+#define WORLD_CHUNK_ROWS	256
+#define WORLD_STREAM_CHUNKS	8
+
+/**
+ * A run of consecutive rows
+ **/
+typedef struct world_chunk {
+	int first_row;
+	world_row rows[WORLD_CHUNK_ROWS];
+} world_chunk;
+
+/**
+ * A lock-free queue of chunks with one thread adding to it and one taking from it. It has room
+ * for every chunk, so it can never be full
+ **/
+typedef struct world_chunk_queue {
+	world_chunk *chunks[WORLD_STREAM_CHUNKS + 1];
+	unsigned int head;
+	unsigned int tail;
+} world_chunk_queue;
+
+/**
+ * The state of a stream
+ **/
+typedef struct world_stream {
+	world_gen *gen;
+	pthread_t thread;
+	bool running;
+	world_chunk *chunks;
+	// Chunks filled by the thread, waiting to be used by the game
+	world_chunk_queue ready;
+	// Chunks the game has finished with, waiting to be refilled
+	world_chunk_queue spent;
+	// Counts the spent chunks, so the thread can sleep while there are none
+	sem_t spent_count;
+	// The chunk the game is reading from and the next row in it
+	world_chunk *current;
+	int position;
+	// The number of times the game asked for a row before it was ready
+	long long underruns;
+} world_stream;
+
+/**
+ * Starts a thread that fills chunks from the generator, which the thread then owns until the
+ * stream is stopped. Returns false if the stream couldn't be started.
+ **/
+bool world_stream_start(world_stream *stream, world_gen *gen);
+
+/**
+ * Gets the next row. Returns false, without waiting, if the thread hasn't generated it yet.
+ **/
+bool world_stream_next_row(world_stream *stream, world_row *row);
+
+/**
+ * Stops the thread and releases the chunks.
+ **/
+void world_stream_stop(world_stream *stream);
+
+#endif
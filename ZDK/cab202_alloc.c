@@ -0,0 +1,45 @@
+/*
+ * cab202_alloc.c
+ *
+ * Allocation through overridable hooks.
+ *
+ *	$Revision:Sun Jul 24 19:36:39 EAST 2016$
+ */
+
+#include <stdlib.h>
+#include "cab202_alloc.h"
+
+zdk_allocator * zdk_allocator_hooks = NULL;
+
+void * zdk_malloc_at( size_t size, const char * site ) {
+	if ( zdk_allocator_hooks && zdk_allocator_hooks->alloc ) {
+		return zdk_allocator_hooks->alloc( size, site );
+	}
+
+	return malloc( size );
+}
+
+void * zdk_calloc_at( size_t count, size_t size, const char * site ) {
+	if ( zdk_allocator_hooks && zdk_allocator_hooks->zalloc ) {
+		return zdk_allocator_hooks->zalloc( count, size, site );
+	}
+
+	return calloc( count, size );
+}
+
+void * zdk_realloc_at( void * memory, size_t size, const char * site ) {
+	if ( zdk_allocator_hooks && zdk_allocator_hooks->resize ) {
+		return zdk_allocator_hooks->resize( memory, size, site );
+	}
+
+	return realloc( memory, size );
+}
+
+void zdk_free_at( void * memory, const char * site ) {
+	if ( zdk_allocator_hooks && zdk_allocator_hooks->release ) {
+		zdk_allocator_hooks->release( memory, site );
+		return;
+	}
+
+	free( memory );
+}
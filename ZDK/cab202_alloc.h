@@ -0,0 +1,52 @@
+/*
+ *	cab202_alloc.h: Hooks through which the ZDK allocates and releases
+ *	memory, so that a program can count or replace the ZDK's allocations.
+ *
+ *	Every allocation names its call site ("file:line"), which a hook can
+ *	use to count allocations, frees and bytes by where they came from.
+ *	Site names are string literals, so a hook can compare them by address.
+ *
+ *	$Revision:Sun Jul 24 19:36:39 EAST 2016$
+ */
+
+#ifndef __ALLOC_H__
+#define __ALLOC_H__
+
+#include <stddef.h>
+
+/*
+ *	The functions called instead of malloc, calloc, realloc and free.
+ *	Any member may be NULL, in which case the standard function is used.
+ */
+typedef struct zdk_allocator {
+	void * ( *alloc )( size_t size, const char * site );
+	void * ( *zalloc )( size_t count, size_t size, const char * site );
+	void * ( *resize )( void * memory, size_t size, const char * site );
+	void ( *release )( void * memory, const char * site );
+} zdk_allocator;
+
+/**
+ *	The allocator in use, or NULL to use the standard functions. Set this
+ *	before setup_screen() so that every ZDK allocation goes through it.
+ */
+extern zdk_allocator * zdk_allocator_hooks;
+
+#define ZDK_STRING_(x)	#x
+#define ZDK_STRING(x)	ZDK_STRING_(x)
+#define ZDK_SITE		__FILE__ ":" ZDK_STRING(__LINE__)
+
+/**
+ *	Allocate and release memory through the hooks, naming the line they
+ *	are called from as the call site.
+ */
+#define zdk_malloc( size )				zdk_malloc_at( size, ZDK_SITE )
+#define zdk_calloc( count, size )		zdk_calloc_at( count, size, ZDK_SITE )
+#define zdk_realloc( memory, size )		zdk_realloc_at( memory, size, ZDK_SITE )
+#define zdk_free( memory )				zdk_free_at( memory, ZDK_SITE )
+
+void * zdk_malloc_at( size_t size, const char * site );
+void * zdk_calloc_at( size_t count, size_t size, const char * site );
+void * zdk_realloc_at( void * memory, size_t size, const char * site );
+void zdk_free_at( void * memory, const char * site );
+
+#endif /* __ALLOC_H__ */
@@ -17,8 +17,11 @@
 #include <signal.h>
 #include <curses.h>
 #include <assert.h>
+#include <unistd.h>
 #include "cab202_graphics.h"
 #include "cab202_timers.h"
+#include "cab202_alloc.h"
+#include "cab202_output.h"
 
 #define ABS(x)	 (((x) >= 0) ? (x) : -(x))
 #define MIN(x,y) (((x) < (y)) ? (x) : (y))
@@ -29,6 +32,7 @@
 FILE * zdk_save_stream = NULL;
 FILE * zdk_input_stream = NULL;
 bool zdk_suppress_output = false;
+bool zdk_write_behind = false;
 
 // Private helper functions.
 static void save_screen_(FILE * f);
@@ -78,6 +82,12 @@ void setup_screen(void) {
 	// Create buffers
 	fit_screen_to_window();
 
+	// Write frames behind, once curses has cleared the terminal.
+	if ( !zdk_suppress_output && zdk_write_behind ) {
+		refresh();
+		zdk_output_start( STDOUT_FILENO, zdk_screen->width, zdk_screen->height );
+	}
+
 	// Add exit procedure to cleanup the screen before the program exists.
 	// Guard to ensure cleanup_screen is added at most once, because in certain
 	// situations (e.g. AMS) this function may be called multiple times.
@@ -104,6 +114,9 @@ void ctrl_c_handler(int signal_code) {
 *	Restore the terminal to its normal operational state.
 */
 void cleanup_screen(void) {
+	// Finish writing frames before curses restores the terminal.
+	zdk_output_stop();
+
 	if ( !zdk_suppress_output ) {
 		// cleanup curses.
 		endwin();
@@ -159,11 +172,14 @@ void show_screen(void) {
 	int w = zdk_screen->width;
 	int h = zdk_screen->height;
 	bool changed = false;
+	bool behind = zdk_output_running();
 
 	for ( int y = 0; y < h; y++ ) {
 		for ( int x = 0; x < w; x++ ) {
 			if ( front_px[y][x] != back_px[y][x] ) {
-				mvaddch(y, x, front_px[y][x]);
+				if ( !behind ) {
+					mvaddch(y, x, front_px[y][x]);
+				}
 				back_px[y][x] = front_px[y][x];
 				changed = true;
 			}
@@ -171,14 +187,22 @@ void show_screen(void) {
 	}
 
 	if ( !changed ) {
+		// Anything stamped still shows behind the frames queued before it.
+		if ( behind ) {
+			zdk_output_frame(zdk_screen->pixels[0], w, h);
+		}
 		return;
 	}
 
 	// Save a screen shot, if automatic saves are enabled.
 	save_screen_(zdk_save_stream);
 
-	// Force an update of the curses display.
-	if ( !zdk_suppress_output ) {
+	// Queue the frame for the writer thread, or force an update of the
+	// curses display.
+	if ( behind ) {
+		zdk_output_frame(zdk_screen->pixels[0], w, h);
+	}
+	else if ( !zdk_suppress_output ) {
 		refresh();
 	}
 }
@@ -376,7 +400,7 @@ void update_buffer(Screen ** screen, int width, int height) {
 		return;
 	}
 
-	Screen * new_screen = calloc(1, sizeof(Screen));
+	Screen * new_screen = zdk_calloc(1, sizeof(Screen));
 
 	if ( !new_screen ) {
 		*screen = NULL;
@@ -386,19 +410,19 @@ void update_buffer(Screen ** screen, int width, int height) {
 	new_screen->width = width;
 	new_screen->height = height;
 
-	new_screen->pixels = calloc(height, sizeof(char *));
+	new_screen->pixels = zdk_calloc(height, sizeof(char *));
 
 	if ( !new_screen->pixels ) {
-		free(new_screen);
+		zdk_free(new_screen);
 		*screen = NULL;
 		return;
 	}
 
-	new_screen->pixels[0] = calloc(width * height, sizeof(char));
+	new_screen->pixels[0] = zdk_calloc(width * height, sizeof(char));
 
 	if ( !new_screen->pixels[0] ) {
-		free(new_screen->pixels);
-		free(new_screen);
+		zdk_free(new_screen->pixels);
+		zdk_free(new_screen);
 		*screen = NULL;
 		return;
 	}
@@ -492,13 +516,13 @@ void destroy_screen(Screen * scr) {
 	if ( scr ) {
 		if ( scr->pixels ) {
 			if ( scr->pixels[0] ) {
-				free(scr->pixels[0]);
+				zdk_free(scr->pixels[0]);
 			}
 
-			free(scr->pixels);
+			zdk_free(scr->pixels);
 		}
 
-		free(scr);
+		zdk_free(scr);
 	}
 }
 
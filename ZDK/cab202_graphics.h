@@ -413,4 +413,13 @@ FILE * zdk_input_stream;
  */
 bool zdk_suppress_output;
 
+/**
+ *	Override: write frames behind
+ *
+ *	A flag which, if true when setup_screen() is called, makes show_screen()
+ *	queue each frame for a writer thread instead of drawing it through curses,
+ *	so that the program never waits for the terminal. See cab202_output.h.
+ */
+bool zdk_write_behind;
+
 #endif /* GRAPHICS_H_ */
@@ -0,0 +1,452 @@
+/*
+ *	cab202_output.c: Write-behind output to the terminal.
+ *
+ *	$Revision:Sun Jul 24 19:36:39 EAST 2016$
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "cab202_output.h"
+
+// Set on the queued slot while it holds a frame the writer hasn't taken.
+#define NEW_FRAME	4
+
+// Unchanged characters fewer than this between two changed ones are
+// written again, as that is shorter than moving the cursor past them.
+#define GAP			8
+
+// How long the writer writes for between measures of the terminal's
+// throughput, in seconds.
+#define MEASURE_INTERVAL	0.25
+
+// The most times stamps took to show that are kept until they are taken.
+#define MAX_SHOWN	( 4 * ZDK_OUTPUT_STAMPS )
+
+#define MAX(x,y) (((x) > (y)) ? (x) : (y))
+
+/*
+ *	The bytes of one frame, and the stamps of what it shows. There are
+ *	three: the one being encoded, the one queued and the one being written.
+ */
+typedef struct frame_bytes {
+	char * bytes;
+	size_t length;
+	size_t capacity;
+	double stamps[ZDK_OUTPUT_STAMPS];
+	int num_stamps;
+} frame_bytes;
+
+static frame_bytes slots[3];
+static int encoding;
+static unsigned int queued;
+static int writing;
+
+// What the terminal shows once every frame the writer has taken is
+// written, and the last frame queued.
+static char * base;
+static int base_width;
+static int base_height;
+static char * last;
+static int last_width;
+static int last_height;
+static size_t cells_capacity;
+
+static int terminal;
+static pthread_t writer;
+static pthread_mutex_t lock;
+static pthread_cond_t frame_queued;
+static bool running;
+static bool stopping;
+static zdk_output_stats stats;
+
+// The bytes the terminal hasn't taken, how fast it takes them, the mean
+// size of a frame and the size of the last. These are read by other threads.
+static unsigned long long pending_bytes;
+static double throughput;
+static double mean_frame_bytes;
+static unsigned long long last_frame_bytes;
+
+// The bytes written and the time spent writing them since the last measure.
+static unsigned long long window_bytes;
+static double window_seconds;
+static double window_start;
+
+// The stamps for the next frame queued, and how long the stamps of the
+// frames written took to show. The latter outlive the writer thread.
+static double staged[ZDK_OUTPUT_STAMPS];
+static int num_staged;
+static double shown[MAX_SHOWN];
+static int num_shown;
+static pthread_mutex_t shown_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ *	The time in seconds.
+ */
+static double output_now( void ) {
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ *	Keeps how long the stamps of a frame took to show, now that the terminal
+ *	has taken it.
+ */
+static void output_shown( const frame_bytes * frame, double now ) {
+	pthread_mutex_lock( &shown_lock );
+	for ( int i = 0; i < frame->num_stamps && num_shown < MAX_SHOWN; i++ ) {
+		shown[num_shown++] = now - frame->stamps[i];
+	}
+	pthread_mutex_unlock( &shown_lock );
+}
+
+/**
+ *	Writes all of a frame, however many writes it takes. A frame with no
+ *	bytes only carries stamps for the frames written before it.
+ */
+static void output_write( const frame_bytes * frame ) {
+	const char * bytes = frame->bytes;
+	size_t length = frame->length;
+	double start = output_now();
+
+	if ( length == 0 ) {
+		output_shown( frame, start );
+		return;
+	}
+
+	while ( length > 0 ) {
+		ssize_t written = write( terminal, bytes, length );
+		if ( written < 0 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			// The terminal has gone, so nothing more will be taken.
+			__atomic_sub_fetch( &pending_bytes, length, __ATOMIC_RELAXED );
+			break;
+		}
+		bytes += written;
+		length -= written;
+		__atomic_sub_fetch( &pending_bytes, written, __ATOMIC_RELAXED );
+	}
+
+	double end = output_now();
+	output_shown( frame, end );
+	double took = end - start;
+	if ( took > stats.longest_write ) {
+		stats.longest_write = took;
+	}
+	stats.written++;
+	stats.bytes_written += frame->length;
+
+	// A terminal that takes frames as fast as they come measures as fast as
+	// the writes, and one that can't makes the writes wait for it.
+	window_bytes += frame->length;
+	window_seconds += took;
+	if ( end - window_start >= MEASURE_INTERVAL ) {
+		double measured = window_bytes / MAX( window_seconds, 1e-6 );
+		__atomic_store( &throughput, &measured, __ATOMIC_RELAXED );
+		window_bytes = 0;
+		window_seconds = 0;
+		window_start = end;
+	}
+}
+
+/**
+ *	Body of the writer thread.
+ */
+static void * output_run( void * argument ) {
+	while ( true ) {
+		pthread_mutex_lock( &lock );
+		while ( !( __atomic_load_n( &queued, __ATOMIC_ACQUIRE ) & NEW_FRAME ) && !stopping ) {
+			pthread_cond_wait( &frame_queued, &lock );
+		}
+		bool stop = stopping;
+		pthread_mutex_unlock( &lock );
+
+		if ( __atomic_load_n( &queued, __ATOMIC_ACQUIRE ) & NEW_FRAME ) {
+			// The frame may have been taken back since, leaving an empty slot.
+			unsigned int taken = __atomic_exchange_n( &queued, writing, __ATOMIC_ACQ_REL );
+			writing = taken & ~NEW_FRAME;
+			if ( taken & NEW_FRAME ) {
+				output_write( &slots[writing] );
+			}
+		}
+		else if ( stop ) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+/**
+ *	Makes sure the copies of the screen can hold a frame of the given size.
+ *	Frames can come from any thread, so this allocates with the C library
+ *	rather than through the ZDK's allocator hooks.
+ */
+static bool output_fit( int width, int height ) {
+	size_t cells = (size_t) width * height;
+
+	if ( cells > cells_capacity ) {
+		char * bigger_base = realloc( base, cells );
+		if ( bigger_base == NULL ) {
+			return false;
+		}
+		base = bigger_base;
+
+		char * bigger_last = realloc( last, cells );
+		if ( bigger_last == NULL ) {
+			return false;
+		}
+		last = bigger_last;
+		cells_capacity = cells;
+	}
+
+	// Every character, and a cursor move for at most every GAP characters.
+	frame_bytes * frame = &slots[encoding];
+	size_t size = 3 * cells + 16 * height + 16;
+
+	if ( size > frame->capacity ) {
+		char * bigger = realloc( frame->bytes, size );
+		if ( bigger == NULL ) {
+			return false;
+		}
+		frame->bytes = bigger;
+		frame->capacity = size;
+	}
+
+	return true;
+}
+
+/**
+ *	Encodes the changes from what the terminal will show to a frame.
+ */
+static void output_encode( frame_bytes * frame, const char * cells, int width, int height ) {
+	char * bytes = frame->bytes;
+	size_t length = 0;
+
+	// A frame of another size is drawn whole on a blank terminal.
+	const char * shown = base;
+	if ( width != base_width || height != base_height ) {
+		length += sprintf( bytes, "\033[H\033[2J" );
+		shown = NULL;
+	}
+
+	for ( int y = 0; y < height; y++ ) {
+		const char * row = cells + (size_t) y * width;
+		const char * shown_row = shown ? shown + (size_t) y * width : NULL;
+		int x = 0;
+
+		while ( x < width ) {
+			if ( row[x] == ( shown_row ? shown_row[x] : ' ' ) ) {
+				x++;
+				continue;
+			}
+
+			// Take in every changed character up to the next long enough run
+			// of unchanged ones.
+			int start = x;
+			int end = x + 1;
+
+			for ( int next = end; next < width && next < end + GAP; next++ ) {
+				if ( row[next] != ( shown_row ? shown_row[next] : ' ' ) ) {
+					end = next + 1;
+				}
+			}
+
+			length += sprintf( bytes + length, "\033[%d;%dH", y + 1, start + 1 );
+			memcpy( bytes + length, row + start, end - start );
+			length += end - start;
+			x = end;
+		}
+	}
+
+	frame->length = length;
+}
+
+bool zdk_output_start( int output, int width, int height ) {
+	memset( &stats, 0, sizeof( stats ) );
+	pending_bytes = 0;
+	throughput = 0;
+	mean_frame_bytes = 0;
+	last_frame_bytes = 0;
+	window_bytes = 0;
+	window_seconds = 0;
+	window_start = output_now();
+	terminal = output;
+	encoding = 0;
+	queued = 1;
+	writing = 2;
+	num_staged = 0;
+	pthread_mutex_lock( &shown_lock );
+	num_shown = 0;
+	pthread_mutex_unlock( &shown_lock );
+
+	for ( int i = 0; i < 3; i++ ) {
+		slots[i].length = 0;
+		slots[i].num_stamps = 0;
+	}
+
+	if ( !output_fit( width, height ) ) {
+		zdk_output_stop();
+		return false;
+	}
+
+	memset( base, ' ', (size_t) width * height );
+	memcpy( last, base, (size_t) width * height );
+	base_width = last_width = width;
+	base_height = last_height = height;
+
+	stopping = false;
+	pthread_mutex_init( &lock, NULL );
+	pthread_cond_init( &frame_queued, NULL );
+
+	if ( pthread_create( &writer, NULL, output_run, NULL ) != 0 ) {
+		pthread_cond_destroy( &frame_queued );
+		pthread_mutex_destroy( &lock );
+		zdk_output_stop();
+		return false;
+	}
+
+	running = true;
+	return true;
+}
+
+void zdk_output_frame( const char * cells, int width, int height ) {
+	if ( !running ) {
+		return;
+	}
+	__atomic_store_n( &last_frame_bytes, 0, __ATOMIC_RELAXED );
+
+	// A frame the same as the last one queued changes nothing, so it is only
+	// queued to carry its stamps.
+	bool same = width == last_width && height == last_height
+		&& memcmp( cells, last, (size_t) width * height ) == 0;
+
+	if ( same && num_staged == 0 ) {
+		return;
+	}
+
+	// Take back the queued slot. If the writer hasn't taken the frame in it,
+	// the frame is superseded (unless this one is the same), and the terminal
+	// still shows what it showed. The frame's stamps stay for this one.
+	// Otherwise the writer has the last frame queued, stamps and all.
+	unsigned int previous = __atomic_exchange_n( &queued, encoding, __ATOMIC_ACQ_REL );
+	encoding = previous & ~NEW_FRAME;
+	frame_bytes * frame = &slots[encoding];
+
+	if ( previous & NEW_FRAME ) {
+		if ( !same && frame->length > 0 ) {
+			stats.superseded++;
+			stats.bytes_superseded += frame->length;
+			__atomic_sub_fetch( &pending_bytes, frame->length, __ATOMIC_RELAXED );
+		}
+	}
+	else {
+		memcpy( base, last, (size_t) last_width * last_height );
+		base_width = last_width;
+		base_height = last_height;
+		frame->length = 0;
+		frame->num_stamps = 0;
+	}
+
+	for ( int i = 0; i < num_staged && frame->num_stamps < ZDK_OUTPUT_STAMPS; i++ ) {
+		frame->stamps[frame->num_stamps++] = staged[i];
+	}
+	num_staged = 0;
+
+	if ( !same ) {
+		// Without room for the frame, the next one is drawn whole.
+		if ( !output_fit( width, height ) ) {
+			last_width = last_height = 0;
+			frame->length = 0;
+			return;
+		}
+
+		output_encode( frame, cells, width, height );
+		memcpy( last, cells, (size_t) width * height );
+		last_width = width;
+		last_height = height;
+
+		if ( frame->length == 0 && frame->num_stamps == 0 ) {
+			return;
+		}
+
+		size_t length = frame->length;
+		if ( length > 0 ) {
+			double mean = mean_frame_bytes * 0.875 + length * 0.125;
+			__atomic_store( &mean_frame_bytes, &mean, __ATOMIC_RELAXED );
+			__atomic_add_fetch( &pending_bytes, length, __ATOMIC_RELAXED );
+			__atomic_store_n( &last_frame_bytes, length, __ATOMIC_RELAXED );
+			stats.frames++;
+		}
+	}
+
+	previous = __atomic_exchange_n( &queued, encoding | NEW_FRAME, __ATOMIC_ACQ_REL );
+	encoding = previous & ~NEW_FRAME;
+
+	pthread_mutex_lock( &lock );
+	pthread_cond_signal( &frame_queued );
+	pthread_mutex_unlock( &lock );
+}
+
+void zdk_output_stop( void ) {
+	if ( running ) {
+		pthread_mutex_lock( &lock );
+		stopping = true;
+		pthread_cond_signal( &frame_queued );
+		pthread_mutex_unlock( &lock );
+		pthread_join( writer, NULL );
+		pthread_cond_destroy( &frame_queued );
+		pthread_mutex_destroy( &lock );
+		running = false;
+	}
+
+	for ( int i = 0; i < 3; i++ ) {
+		free( slots[i].bytes );
+		slots[i].bytes = NULL;
+		slots[i].length = 0;
+		slots[i].capacity = 0;
+	}
+
+	free( base );
+	free( last );
+	base = NULL;
+	last = NULL;
+	cells_capacity = 0;
+}
+
+void zdk_output_stamp( double happened ) {
+	if ( running && num_staged < ZDK_OUTPUT_STAMPS ) {
+		staged[num_staged++] = happened;
+	}
+}
+
+int zdk_output_shown( double * latencies, int max_latencies ) {
+	pthread_mutex_lock( &shown_lock );
+	int count = num_shown < max_latencies ? num_shown : max_latencies;
+	memcpy( latencies, shown, count * sizeof( double ) );
+	memmove( shown, shown + count, ( num_shown - count ) * sizeof( double ) );
+	num_shown -= count;
+	pthread_mutex_unlock( &shown_lock );
+	return count;
+}
+
+void zdk_output_measure( zdk_output_link * link ) {
+	link->pending = __atomic_load_n( &pending_bytes, __ATOMIC_RELAXED );
+	__atomic_load( &throughput, &link->throughput, __ATOMIC_RELAXED );
+	__atomic_load( &mean_frame_bytes, &link->frame_bytes, __ATOMIC_RELAXED );
+	link->last_bytes = __atomic_load_n( &last_frame_bytes, __ATOMIC_RELAXED );
+}
+
+bool zdk_output_running( void ) {
+	return running;
+}
+
+const zdk_output_stats * zdk_output_totals( void ) {
+	return &stats;
+}
@@ -0,0 +1,136 @@
+/*
+ *	cab202_output.h: Write-behind output to the terminal, so that a program
+ *	never waits for a slow terminal (such as one on a remote session).
+ *
+ *	Each frame is encoded as the bytes that change what the terminal shows
+ *	(ANSI cursor moves and characters) and queued for a writer thread.
+ *	Only one frame is ever queued: if the writer hasn't started on it when
+ *	the next frame comes, the queued frame is superseded, and the new frame
+ *	is encoded against what the terminal will show without it. So the
+ *	queue can't grow, and a terminal that falls behind skips whole frames
+ *	rather than showing them late.
+ *
+ *	The writer writes to the terminal directly rather than through curses,
+ *	which can't be used from two threads at once.
+ *
+ *	$Revision:Sun Jul 24 19:36:39 EAST 2016$
+ */
+
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <stdbool.h>
+
+// The most stamps a frame can carry (see zdk_output_stamp()).
+#define ZDK_OUTPUT_STAMPS	64
+
+/*
+ *	What the output has done since it was started.
+ *
+ *	Members:
+ *		frames - The frames queued.
+ *		written - The frames written to the terminal.
+ *		superseded - The frames replaced by a newer one before they could be
+ *				written, and the bytes they would have written.
+ *		bytes_written - The bytes written to the terminal.
+ *		longest_write - The longest the terminal took to take a frame, in
+ *				seconds.
+ */
+typedef struct zdk_output_stats {
+	unsigned long long frames;
+	unsigned long long written;
+	unsigned long long superseded;
+	unsigned long long bytes_superseded;
+	unsigned long long bytes_written;
+	double longest_write;
+} zdk_output_stats;
+
+/*
+ *	How fast the terminal is taking frames, so that a program can send it
+ *	no more than it can take.
+ *
+ *	Members:
+ *		pending - The bytes queued or being written that the terminal hasn't
+ *				taken yet.
+ *		throughput - The bytes a second the terminal took while the writer
+ *				was writing, over about the last quarter second, or 0 before
+ *				anything has been written.
+ *		frame_bytes - The mean size of the frames queued lately, in bytes.
+ *		last_bytes - The bytes the last frame shown will write, or 0 if it
+ *				changed nothing the terminal shows.
+ */
+typedef struct zdk_output_link {
+	unsigned long long pending;
+	double throughput;
+	double frame_bytes;
+	unsigned long long last_bytes;
+} zdk_output_link;
+
+/**
+ *	Starts the writer thread on a terminal that shows nothing but blanks, at
+ *	the given size. Returns false if it couldn't be started.
+ *
+ *	Notes:
+ *	.	setup_screen() calls this when zdk_write_behind is true.
+ */
+bool zdk_output_start( int terminal, int width, int height );
+
+/**
+ *	Queues the bytes that make the terminal show a frame of characters,
+ *	stored a row after another. Never waits for the terminal.
+ *
+ *	Notes:
+ *	.	Frames may be queued from any thread, but only from one at a time.
+ *	.	show_screen() calls this when the output has been started.
+ */
+void zdk_output_frame( const char * cells, int width, int height );
+
+/**
+ *	Stamps the next frame queued with the time something it shows happened,
+ *	such as a key being pressed, in seconds from CLOCK_MONOTONIC. Once the
+ *	frame has been written to the terminal, how long it took to show is
+ *	kept for zdk_output_shown().
+ *
+ *	Notes:
+ *	.	Stamps are only added by the thread that queues frames.
+ *	.	A frame that is superseded passes its stamps on to the frame that
+ *		supersedes it, as that is the one that shows what they stamp.
+ *	.	A frame the same as the one before it still carries its stamps, and
+ *		they show once the frames before it have been written.
+ *	.	Stamps past ZDK_OUTPUT_STAMPS in a frame are ignored.
+ */
+void zdk_output_stamp( double happened );
+
+/**
+ *	Copies out how long the stamps of the frames written since the last call
+ *	took to show, in seconds, up to max_latencies of them. Returns the number
+ *	copied. This may be called from any thread, and once the output has
+ *	stopped.
+ */
+int zdk_output_shown( double * latencies, int max_latencies );
+
+/**
+ *	Writes the last frame queued and stops the writer thread.
+ *
+ *	Notes:
+ *	.	cleanup_screen() calls this.
+ */
+void zdk_output_stop( void );
+
+/**
+ *	Measures how fast the terminal is taking frames. This may be called from
+ *	any thread while frames are being written.
+ */
+void zdk_output_measure( zdk_output_link * link );
+
+/**
+ *	Returns true if frames are being written behind.
+ */
+bool zdk_output_running( void );
+
+/**
+ *	Returns what the output has done. Only read this once it has stopped.
+ */
+const zdk_output_stats * zdk_output_totals( void );
+
+#endif /* __OUTPUT_H__ */
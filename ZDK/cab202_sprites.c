@@ -17,6 +17,7 @@
 #include <string.h>
 #include "cab202_graphics.h"
 #include "cab202_sprites.h"
+#include "cab202_alloc.h"
 #include "curses.h"
 
 /*
@@ -43,7 +44,7 @@ sprite_id sprite_create( double x, double y, int width, int height, char image[]
 	assert( height > 0 );
 	assert( image != NULL );
 
-	sprite_id sprite = malloc( sizeof( Sprite ) );
+	sprite_id sprite = zdk_malloc( sizeof( Sprite ) );
 
 	if ( sprite != NULL ) {
 		sprite_init( sprite, x, y, width, height, image );
@@ -94,7 +95,7 @@ void sprite_init( sprite_id sprite, double x, double y, int width, int height, c
 
 void sprite_destroy( sprite_id sprite ) {
 	if ( sprite != NULL ) {
-		free( sprite );
+		zdk_free( sprite );
 	}
 }
 
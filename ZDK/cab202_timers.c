@@ -10,6 +10,7 @@
  */
 
 #include "cab202_timers.h"
+#include "cab202_alloc.h"
 #include <assert.h>
 #include <stdlib.h>
 
@@ -32,7 +33,7 @@
 timer_id create_timer( long milliseconds ) {
 	assert( milliseconds > 0 );
 
-	timer_id timer = malloc( sizeof( cab202_timer_t ) );
+	timer_id timer = zdk_malloc( sizeof( cab202_timer_t ) );
 
 	timer->milliseconds = milliseconds;
 	timer_reset( timer );
@@ -45,7 +46,7 @@ timer_id create_timer( long milliseconds ) {
 void destroy_timer( timer_id timer ) {
 	assert( timer != NULL );
 
-	free( timer );
+	zdk_free( timer );
 }
 
 // ---------------------------------------------------------------------------